@@ -0,0 +1,131 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Pool of threads for decoding DV video
+
+#include <algorithm>
+#include <cassert>
+
+#include <boost/bind.hpp>
+
+#include "decode_pool.hpp"
+#include "frame.h"
+
+const unsigned decode_pool::max_threads;
+
+namespace
+{
+    raw_frame_ptr decode_video_frame(
+ 	const auto_codec & decoder, const dv_frame_ptr & dv_frame)
+    {
+	const struct dv_system * system = dv_frame_system(dv_frame.get());
+	raw_frame_ptr result = allocate_raw_frame(system, std::nothrow);
+	if (!result)
+	    return result;
+
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = dv_frame->buffer;
+	packet.size = system->size;
+
+	int got_frame;
+	decoder.get()->opaque = result.get();
+	int used_size = avcodec_decode_video2(decoder.get(),
+					      &result->header, &got_frame,
+					      &packet);
+	assert(got_frame && size_t(used_size) == system->size);
+
+	result->header.opaque =
+	    const_cast<void *>(static_cast<const void *>(system));
+	result->aspect = dv_frame_get_aspect(dv_frame.get());
+	result->header.pts = dv_frame->serial_num;
+	return result;
+    }
+}
+
+decode_pool::decode_pool(unsigned thread_count)
+    : thread_count_(std::max(1U, std::min(thread_count, max_threads))),
+      batch_(0),
+      stopping_(false)
+{
+    // Open all decoders before starting any workers, since opening
+    // a codec takes a global lock.
+    for (unsigned i = 0; i != thread_count_; ++i)
+    {
+	decoders_[i].reset(auto_codec_open_decoder(CODEC_ID_DVVIDEO).release());
+	AVCodecContext * dec = decoders_[i].get();
+	dec->get_buffer = raw_frame_get_buffer;
+	dec->release_buffer = raw_frame_release_buffer;
+	dec->reget_buffer = raw_frame_reget_buffer;
+    }
+
+    for (unsigned i = 1; i != thread_count_; ++i)
+	workers_.create_thread(boost::bind(&decode_pool::run_worker, this, i));
+}
+
+decode_pool::~decode_pool()
+{
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	stopping_ = true;
+	work_cond_.notify_all();
+    }
+    workers_.join_all();
+}
+
+void decode_pool::decode(std::size_t count, const dv_frame_ptr * frames,
+			 raw_frame_ptr * results)
+{
+    batch this_batch;
+    this_batch.frames = frames;
+    this_batch.results = results;
+    this_batch.count = count;
+    this_batch.next = 0;
+    this_batch.done_count = 0;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(!batch_);
+    batch_ = &this_batch;
+    if (count > 1)
+	work_cond_.notify_all();
+
+    decode_batch(lock, decoders_[0]);
+
+    while (this_batch.done_count != count)
+	done_cond_.wait(lock);
+    batch_ = 0;
+}
+
+void decode_pool::run_worker(unsigned index)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (;;)
+    {
+	while (!stopping_ && !(batch_ && batch_->next != batch_->count))
+	    work_cond_.wait(lock);
+	if (stopping_)
+	    break;
+
+	decode_batch(lock, decoders_[index]);
+    }
+}
+
+void decode_pool::decode_batch(boost::mutex::scoped_lock & lock,
+			       const auto_codec & decoder)
+{
+    batch * this_batch = batch_;
+
+    while (this_batch->next != this_batch->count)
+    {
+	std::size_t i = this_batch->next++;
+
+	lock.unlock();
+	raw_frame_ptr result(decode_video_frame(decoder, this_batch->frames[i]));
+	lock.lock();
+
+	this_batch->results[i] = result;
+	if (++this_batch->done_count == this_batch->count)
+	    done_cond_.notify_one();
+    }
+}
@@ -0,0 +1,64 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Pool of threads for decoding DV video
+
+#ifndef DVSWITCH_DECODE_POOL_HPP
+#define DVSWITCH_DECODE_POOL_HPP
+
+#include <cstddef>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "auto_codec.hpp"
+#include "frame_pool.hpp"
+
+// The calling thread takes part in decoding, so a pool with a thread
+// count of 1 decodes frames sequentially without any hand-off.
+
+class decode_pool : boost::noncopyable
+{
+public:
+    explicit decode_pool(unsigned thread_count);
+    ~decode_pool();
+
+    static const unsigned max_threads = 8;
+
+    unsigned thread_count() const { return thread_count_; }
+
+    // Decode count frames concurrently and return when all are
+    // done.  Results are null where no raw frame buffer was
+    // available.  Only one thread may call this at a time.
+    void decode(std::size_t count, const dv_frame_ptr * frames,
+		raw_frame_ptr * results);
+
+private:
+    struct batch
+    {
+	const dv_frame_ptr * frames;
+	raw_frame_ptr * results;
+	std::size_t count, next, done_count;
+    };
+
+    void run_worker(unsigned index);
+    // Decode frames from the current batch until none are left.
+    // The lock must be held on entry and is held again on return.
+    void decode_batch(boost::mutex::scoped_lock & lock,
+		      const auto_codec & decoder);
+
+    unsigned thread_count_;
+    // Index 0 is used by the calling thread
+    auto_codec decoders_[max_threads];
+
+    boost::mutex mutex_; // controls access to the following
+    batch * batch_;
+    bool stopping_;
+    boost::condition work_cond_, done_cond_;
+
+    boost::thread_group workers_;
+};
+
+#endif // !DVSWITCH_DECODE_POOL_HPP
@@ -0,0 +1,68 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Cache of decoded source frames for one mixer tick
+
+#include "decoded_frame_cache.hpp"
+
+decoded_frame_cache::decoded_frame_cache(unsigned serial_num)
+    : serial_num_(serial_num)
+{}
+
+std::size_t decoded_frame_cache::find_index(source_id source,
+					    unsigned lowres) const
+{
+    std::size_t i;
+    for (i = 0; i != entries_.size(); ++i)
+	if (entries_[i].source == source && entries_[i].lowres == lowres)
+	    break;
+    return i;
+}
+
+raw_frame_ptr decoded_frame_cache::find(source_id source, unsigned serial_num,
+					unsigned lowres) const
+{
+    raw_frame_ptr result;
+    if (serial_num == serial_num_)
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	std::size_t i = find_index(source, lowres);
+	if (i != entries_.size())
+	    result = entries_[i].frame;
+    }
+    return result;
+}
+
+void decoded_frame_cache::insert(source_id source, unsigned serial_num,
+				 unsigned lowres, const raw_frame_ptr & frame)
+{
+    if (serial_num != serial_num_ || !frame)
+	return;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    std::size_t i = find_index(source, lowres);
+    if (i == entries_.size())
+    {
+	entries_.resize(i + 1);
+	entries_[i].source = source;
+	entries_[i].lowres = lowres;
+    }
+    entries_[i].frame = frame;
+}
+
+raw_frame_ptr decoded_frame_cache::take(source_id source, unsigned serial_num,
+					unsigned lowres)
+{
+    raw_frame_ptr result;
+    if (serial_num == serial_num_)
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	std::size_t i = find_index(source, lowres);
+	if (i != entries_.size())
+	{
+	    result.swap(entries_[i].frame);
+	    entries_.erase(entries_.begin() + i);
+	}
+    }
+    return result;
+}
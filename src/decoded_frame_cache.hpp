@@ -0,0 +1,65 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Cache of decoded source frames for one mixer tick
+
+#ifndef DVSWITCH_DECODED_FRAME_CACHE_HPP
+#define DVSWITCH_DECODED_FRAME_CACHE_HPP
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "frame_pool.hpp"
+
+// The mixer creates a cache for each clock tick and decodes the
+// source frames it needs for mixing into it.  It then passes the
+// cache on to the monitor along with the source frames, so that any
+// source that has already been decoded need not be decoded again for
+// display.  Other consumers may add frames they decode themselves.
+// Frames are keyed by source, serial number and resolution, where
+// the resolution is the libavcodec lowres factor.  The cache is
+// released, along with its frames, when the last reference to the
+// tick's frames is dropped.
+//
+// Cached frames are shared and must not be modified.
+
+class decoded_frame_cache : boost::noncopyable
+{
+public:
+    typedef unsigned source_id;
+
+    explicit decoded_frame_cache(unsigned serial_num);
+
+    unsigned serial_num() const { return serial_num_; }
+
+    // Find a decoded frame, or return null if there is none
+    raw_frame_ptr find(source_id, unsigned serial_num,
+		       unsigned lowres = 0) const;
+    // Add a decoded frame, replacing any existing frame with the
+    // same key.  Frames for other ticks are ignored.
+    void insert(source_id, unsigned serial_num, unsigned lowres,
+		const raw_frame_ptr &);
+    // Remove a decoded frame from the cache and return it, so that
+    // the caller may modify it
+    raw_frame_ptr take(source_id, unsigned serial_num, unsigned lowres = 0);
+
+private:
+    struct entry
+    {
+	source_id source;
+	unsigned lowres;
+	raw_frame_ptr frame;
+    };
+
+    // Return the index of the entry with the given key, or the
+    // number of entries if there is none.  The lock must be held.
+    std::size_t find_index(source_id, unsigned lowres) const;
+
+    const unsigned serial_num_;
+    mutable boost::mutex mutex_; // controls access to the following
+    std::vector<entry> entries_;
+};
+
+#endif // !DVSWITCH_DECODED_FRAME_CACHE_HPP
@@ -3,6 +3,8 @@
 
 // DIF definitions and metadata access
 
+#include <time.h>
+
 #include "dif.h"
 
 static const uint8_t dv_audio_shuffle_625_50[12][9] = {
@@ -119,6 +121,55 @@ void dv_buffer_set_aspect(uint8_t * buffer, enum dv_frame_aspect aspect)
     }
 }
 
+static unsigned bcd_value(uint8_t bcd)
+{
+    return (bcd >> 4) * 10 + (bcd & 0xf);
+}
+
+bool dv_buffer_get_timecode(const uint8_t * buffer, unsigned * frame_count)
+{
+    const uint8_t * tc_pack =
+	buffer + 6 * DIF_SEQUENCE_SIZE + DIF_BLOCK_SIZE + 6;
+
+    if (tc_pack[0] != 0x13)
+	return false;
+
+    unsigned frame_rate = dv_buffer_system_code(buffer) ? 25 : 30;
+    unsigned minutes = (60 * bcd_value(tc_pack[4] & 0x3f)
+			+ bcd_value(tc_pack[3] & 0x7f));
+    unsigned count = ((60 * minutes + bcd_value(tc_pack[2] & 0x7f))
+		      * frame_rate
+		      + bcd_value(tc_pack[1] & 0x3f));
+
+    // Drop-frame time code skips the first 2 frame numbers of each
+    // minute, except in minutes divisible by 10.
+    if (frame_rate == 30 && (tc_pack[1] & 0x40))
+	count -= 2 * (minutes - minutes / 10);
+
+    *frame_count = count;
+    return true;
+}
+
+bool dv_buffer_get_record_time(const uint8_t * buffer, struct tm * tm)
+{
+    const uint8_t * date_pack = buffer + 3 * DIF_BLOCK_SIZE + 13;
+    const uint8_t * time_pack = buffer + 3 * DIF_BLOCK_SIZE + 18;
+
+    if (date_pack[0] != 0x62 || time_pack[0] != 0x63)
+	return false;
+
+    // Years are only given modulo 100
+    tm->tm_year = bcd_value(date_pack[4]);
+    if (tm->tm_year < 70)
+	tm->tm_year += 100;
+    tm->tm_mon = bcd_value(date_pack[3] & 0x1f) - 1;
+    tm->tm_mday = bcd_value(date_pack[2] & 0x3f);
+    tm->tm_hour = bcd_value(time_pack[4] & 0x3f);
+    tm->tm_min = bcd_value(time_pack[3] & 0x7f);
+    tm->tm_sec = bcd_value(time_pack[2] & 0x7f);
+    return true;
+}
+
 enum dv_sample_rate dv_buffer_get_sample_rate(const uint8_t * buffer)
 {
     const uint8_t * as_pack = buffer + (6 + 3 * 16) * DIF_BLOCK_SIZE + 3;
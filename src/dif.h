@@ -50,6 +50,17 @@ enum dv_frame_aspect
 extern enum dv_frame_aspect dv_buffer_get_aspect(const uint8_t * frame);
 extern void dv_buffer_set_aspect(uint8_t * buffer, enum dv_frame_aspect aspect);
 
+// Get the time code from the subcode, as a count of frames since
+// midnight (for 525-line systems, undoing drop-frame numbering).
+// Return false if there is no time code.
+extern bool dv_buffer_get_timecode(const uint8_t * buffer,
+				   unsigned * frame_count);
+
+// Get the video record date and time from VAUX.  Only the date and
+// time fields of *tm are set.  Return false if they are missing.
+struct tm;
+extern bool dv_buffer_get_record_time(const uint8_t * buffer, struct tm * tm);
+
 struct dv_system
 {
     const char * common_name;
@@ -111,6 +122,49 @@ void dv_buffer_silence_audio(uint8_t * buffer,
 			     enum dv_sample_rate sample_rate_code,
 			     unsigned serial_num);
 
+// Each DIF sequence has 135 video blocks, interleaved with the audio
+// blocks.  Each block holds one compressed macroblock, and each group
+// of 5 consecutive video blocks forms a video segment which can be
+// decoded independently of the others.
+#define DIF_VIDEO_BLOCKS_PER_SEQUENCE 135
+#define DIF_MACROBLOCKS_PER_SEGMENT 5
+#define DIF_VIDEO_SEGMENTS_PER_SEQUENCE \
+    (DIF_VIDEO_BLOCKS_PER_SEQUENCE / DIF_MACROBLOCKS_PER_SEGMENT)
+
+// Get the offset of a video block in a frame buffer
+static inline
+size_t dv_video_block_offset(unsigned seq_num, unsigned block_num)
+{
+    return seq_num * DIF_SEQUENCE_SIZE
+	+ (7 + block_num + block_num / 15) * DIF_BLOCK_SIZE;
+}
+
+// Get the picture areas covered by the macroblocks of a video segment.
+// Return false if the buffer uses a video layout we don't handle.
+bool dv_buffer_get_segment_rects(const uint8_t * buffer,
+				 unsigned seq_num, unsigned seg_num,
+				 struct rectangle * rects);
+
+// Copy video segments from source to dest where none of their
+// macroblocks intersect the given region.  Both buffers must use the
+// same video system and layout.  Return the number of segments copied.
+unsigned dv_buffer_copy_video_outside(uint8_t * dest, const uint8_t * source,
+				      const struct rectangle * region);
+
+// Return whether two buffers hold the same compressed video.  This
+// ignores the header, subcode, VAUX and audio blocks.
+bool dv_buffer_video_equal(const uint8_t * left, const uint8_t * right);
+
+// Extract a thumbnail at 1/8 scale from the DC coefficients of the
+// video without decoding it, i.e. the mean of each 8x8 DCT block.
+// The planes and line sizes are in the order Y, Cb, Cr as for
+// libavcodec.  The luma plane is frame_width / 8 by frame_height / 8
+// pixels.  The chroma planes have one pixel per 8x8 chroma block
+// (45x36 for 625/50, 23x60 for 525/60) and are not written if null.
+// Return false if the buffer uses a video layout we don't handle.
+bool dv_buffer_get_thumbnail(const uint8_t * buffer,
+			     uint8_t * const * planes, const int * linesizes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,248 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// DIF video segment layout, compressed-domain copying and thumbnails
+
+#include <assert.h>
+#include <string.h>
+
+#include "dif.h"
+
+// The picture is divided into superblocks, 5 across and one row per
+// DIF sequence down.  Each superblock holds 27 macroblocks in
+// serpentine order, running down and up successive columns.  Video
+// segment k of sequence i holds the k'th macroblock from 5
+// superblocks in different rows and columns, to spread the effect of
+// tape dropouts.  See IEC 61834-2 section 11.4.2.
+static const unsigned dv_segment_row_offset[DIF_MACROBLOCKS_PER_SEGMENT] = {
+    2, 6, 8, 0, 4
+};
+static const unsigned dv_segment_column[DIF_MACROBLOCKS_PER_SEGMENT] = {
+    2, 1, 3, 0, 4
+};
+
+static inline unsigned serpentine(unsigned k, unsigned column_height)
+{
+    unsigned row = k % column_height;
+    return ((k / column_height) & 1) ? column_height - 1 - row : row;
+}
+
+static inline unsigned apt(const uint8_t * buffer)
+{
+    return buffer[4] & 7;
+}
+
+static bool have_video_layout(const uint8_t * buffer)
+{
+    // 625/50 IEC 61834 uses 4:2:0 sampling; SMPTE 314M (DVCPRO) uses
+    // 4:1:1 with a different layout that we don't handle.  Both
+    // variants of 525/60 use the same 4:1:1 layout.
+    return dv_buffer_system(buffer) == &dv_system_525_60 || apt(buffer) == 0;
+}
+
+bool dv_buffer_get_segment_rects(const uint8_t * buffer,
+				 unsigned seq_num, unsigned seg_num,
+				 struct rectangle * rects)
+{
+    const struct dv_system * system = dv_buffer_system(buffer);
+    unsigned mb_num;
+
+    assert(seq_num < system->seq_count);
+    assert(seg_num < DIF_VIDEO_SEGMENTS_PER_SEQUENCE);
+
+    if (!have_video_layout(buffer))
+	return false;
+
+    for (mb_num = 0; mb_num != DIF_MACROBLOCKS_PER_SEGMENT; ++mb_num)
+    {
+	unsigned sb_row =
+	    (seq_num + dv_segment_row_offset[mb_num]) % system->seq_count;
+	struct rectangle * rect = &rects[mb_num];
+
+	if (system == &dv_system_625_50)
+	{
+	    // 4:2:0 macroblocks are 16x16; superblocks are 9x3
+	    // macroblocks.
+	    unsigned column = dv_segment_column[mb_num] * 9 + seg_num / 3;
+	    unsigned row = sb_row * 3 + serpentine(seg_num, 3);
+	    rect->left = column * 16;
+	    rect->top = row * 16;
+	    rect->right = rect->left + 16;
+	    rect->bottom = rect->top + 16;
+	}
+	else
+	{
+	    // 4:1:1 macroblocks are 32x8, except in the rightmost
+	    // column which is only 16 pixels wide and so has 16x16
+	    // macroblocks.  Superblocks are 4.5x6 macroblocks, with
+	    // the half-columns split between horizontally adjacent
+	    // superblocks.
+	    static const unsigned first_column[DIF_MACROBLOCKS_PER_SEGMENT] = {
+		9, 4, 13, 0, 18
+	    };
+	    unsigned k = seg_num + ((mb_num == 1 || mb_num == 2) ? 3 : 0);
+	    unsigned column = first_column[mb_num] + k / 6;
+	    unsigned row = serpentine(k, 6);
+	    if (column == 22)
+	    {
+		rect->left = 704;
+		rect->top = (sb_row * 6 + row * 2) * 8;
+		rect->right = 720;
+		rect->bottom = rect->top + 16;
+	    }
+	    else
+	    {
+		rect->left = column * 32;
+		rect->top = (sb_row * 6 + row) * 8;
+		rect->right = rect->left + 32;
+		rect->bottom = rect->top + 8;
+	    }
+	}
+    }
+
+    return true;
+}
+
+unsigned dv_buffer_copy_video_outside(uint8_t * dest, const uint8_t * source,
+				      const struct rectangle * region)
+{
+    const struct dv_system * system = dv_buffer_system(source);
+    struct rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+    unsigned seq_num, seg_num, mb_num;
+    unsigned copy_count = 0;
+
+    if (dv_buffer_system(dest) != system || !have_video_layout(dest))
+	return 0;
+
+    for (seq_num = 0; seq_num != system->seq_count; ++seq_num)
+    {
+	for (seg_num = 0; seg_num != DIF_VIDEO_SEGMENTS_PER_SEQUENCE; ++seg_num)
+	{
+	    if (!dv_buffer_get_segment_rects(source, seq_num, seg_num, rects))
+		return 0;
+
+	    for (mb_num = 0; mb_num != DIF_MACROBLOCKS_PER_SEGMENT; ++mb_num)
+	    {
+		rectangle_clip(&rects[mb_num], region);
+		if (!rectangle_is_empty(&rects[mb_num]))
+		    break;
+	    }
+	    if (mb_num != DIF_MACROBLOCKS_PER_SEGMENT)
+		continue;
+
+	    // Bits may overflow between the macroblocks of a segment,
+	    // so the segment must be copied as a whole.  Leave the
+	    // block ids alone.
+	    for (mb_num = 0; mb_num != DIF_MACROBLOCKS_PER_SEGMENT; ++mb_num)
+	    {
+		size_t offset = dv_video_block_offset(
+		    seq_num, seg_num * DIF_MACROBLOCKS_PER_SEGMENT + mb_num);
+		memcpy(dest + offset + DIF_BLOCK_ID_SIZE,
+		       source + offset + DIF_BLOCK_ID_SIZE,
+		       DIF_BLOCK_SIZE - DIF_BLOCK_ID_SIZE);
+	    }
+	    ++copy_count;
+	}
+    }
+
+    return copy_count;
+}
+
+bool dv_buffer_video_equal(const uint8_t * left, const uint8_t * right)
+{
+    const struct dv_system * system = dv_buffer_system(left);
+    unsigned seq_num, block_num;
+
+    if (dv_buffer_system(right) != system || apt(right) != apt(left))
+	return false;
+
+    // Video blocks come in runs of 15 between the audio blocks
+    for (seq_num = 0; seq_num != system->seq_count; ++seq_num)
+    {
+	for (block_num = 0; block_num != DIF_VIDEO_BLOCKS_PER_SEQUENCE;
+	     block_num += 15)
+	{
+	    size_t offset = dv_video_block_offset(seq_num, block_num);
+	    if (memcmp(left + offset, right + offset, 15 * DIF_BLOCK_SIZE))
+		return false;
+	}
+    }
+
+    return true;
+}
+
+// Byte offsets of the DCT block areas within a video block, in the
+// order Y0-Y3, Cr, Cb.  Each area starts with the block's DC
+// coefficient as a 9-bit signed number.
+static const unsigned dct_area_offset[6] = {
+    4, 18, 32, 46, 60, 70
+};
+
+static inline uint8_t dc_to_pixel(const uint8_t * area)
+{
+    int dc = ((area[0] << 1 | area[1] >> 7) ^ 0x100) - 0x100;
+    // The block mean is 128 + dc / 2, as libavcodec rounds it
+    int value = (dc + 257) >> 1;
+    return value > 255 ? 255 : value;
+}
+
+bool dv_buffer_get_thumbnail(const uint8_t * buffer,
+			     uint8_t * const * planes, const int * linesizes)
+{
+    const struct dv_system * system = dv_buffer_system(buffer);
+    // Chroma is subsampled 4:2:0 for 625/50 and 4:1:1 for 525/60
+    const unsigned c_h_shift = system == &dv_system_625_50 ? 1 : 2;
+    const unsigned c_v_shift = system == &dv_system_625_50 ? 1 : 0;
+    struct rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+    unsigned seq_num, seg_num, mb_num, i;
+
+    if (!have_video_layout(buffer))
+	return false;
+
+    for (seq_num = 0; seq_num != system->seq_count; ++seq_num)
+    {
+	for (seg_num = 0; seg_num != DIF_VIDEO_SEGMENTS_PER_SEQUENCE; ++seg_num)
+	{
+	    dv_buffer_get_segment_rects(buffer, seq_num, seg_num, rects);
+
+	    for (mb_num = 0; mb_num != DIF_MACROBLOCKS_PER_SEGMENT; ++mb_num)
+	    {
+		const uint8_t * mb_data = buffer + dv_video_block_offset(
+		    seq_num, seg_num * DIF_MACROBLOCKS_PER_SEGMENT + mb_num);
+		const struct rectangle * rect = &rects[mb_num];
+		unsigned height = rect->bottom - rect->top;
+		uint8_t * y_row =
+		    planes[0] + (rect->top / 8) * linesizes[0] + rect->left / 8;
+
+		// The luma blocks of 32x8 macroblocks are in a row;
+		// those of 16x16 macroblocks are 2x2.
+		for (i = 0; i != 4; ++i)
+		{
+		    uint8_t value = dc_to_pixel(mb_data + dct_area_offset[i]);
+		    if (height == 8)
+			y_row[i] = value;
+		    else
+			y_row[(i >> 1) * linesizes[0] + (i & 1)] = value;
+		}
+
+		if (planes[1] && planes[2])
+		{
+		    // The rightmost 4:1:1 macroblocks have 4x16 chroma
+		    // blocks, so cover 2 rows
+		    unsigned c_x = rect->left >> (c_h_shift + 3);
+		    unsigned c_y = rect->top >> (c_v_shift + 3);
+		    unsigned c_rows = height >> (c_v_shift + 3);
+		    uint8_t cr = dc_to_pixel(mb_data + dct_area_offset[4]);
+		    uint8_t cb = dc_to_pixel(mb_data + dct_area_offset[5]);
+		    for (i = 0; i != c_rows; ++i)
+		    {
+			planes[1][(c_y + i) * linesizes[1] + c_x] = cb;
+			planes[2][(c_y + i) * linesizes[2] + c_x] = cr;
+		    }
+		}
+	    }
+	}
+    }
+
+    return true;
+}
@@ -16,6 +16,7 @@
 
 #include <gdkmm/cursor.h>
 
+#include "dif.h"
 #include "dv_display_widget.hpp"
 #include "frame.h"
 #include "gui.hpp"
@@ -139,6 +140,7 @@ GdkFilterReturn dv_display_widget::filter_x_shm_event(void * void_event,
     if (x_event->type == widget->x_shm_first_event_ + ShmCompletion)
     {
 	widget->shm_busy_ = false;
+	widget->shm_completed();
 	return GDK_FILTER_REMOVE;
     }
 
@@ -156,6 +158,31 @@ dv_display_widget::get_display_region(const dv_system * system,
     return result;
 }
 
+AVFrame * dv_display_widget::decode_video(const dv_frame_ptr & dv_frame)
+{
+    const struct dv_system * system = dv_frame_system(dv_frame.get());
+    AVCodecContext * decoder = decoder_.get();
+
+    AVFrame * header = get_frame_header();
+    if (!header)
+	return 0;
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = dv_frame->buffer;
+    packet.size = system->size;
+
+    int got_frame;
+    int used_size = avcodec_decode_video2(decoder,
+					  header, &got_frame,
+					  &packet);
+    if (used_size <= 0)
+	return 0;
+    assert(got_frame && size_t(used_size) == system->size);
+    header->opaque = const_cast<void *>(static_cast<const void *>(system));
+    return header;
+}
+
 void dv_display_widget::put_frame(const dv_frame_ptr & dv_frame)
 {
     if (!is_realized())
@@ -163,30 +190,13 @@ void dv_display_widget::put_frame(const dv_frame_ptr & dv_frame)
 
     if (dv_frame->serial_num != decoded_serial_num_ && !shm_busy_)
     {
-	const struct dv_system * system = dv_frame_system(dv_frame.get());
-	AVCodecContext * decoder = decoder_.get();
-
-	AVFrame * header = get_frame_header();
-	if (!header)
+	if (!decode_video(dv_frame))
 	    return;
-
-	AVPacket packet;
-	av_init_packet(&packet);
-	packet.data = dv_frame->buffer;
-	packet.size = system->size;
-
-	int got_frame;
-	int used_size = avcodec_decode_video2(decoder,
-					      header, &got_frame,
-					      &packet);
-	if (used_size <= 0)
-	    return;
-	assert(got_frame && size_t(used_size) == system->size);
-	header->opaque = const_cast<void *>(static_cast<const void *>(system));
 	decoded_serial_num_ = dv_frame->serial_num;
 
 	put_frame_buffer(
-	    get_display_region(system, dv_frame_get_aspect(dv_frame.get())));
+	    get_display_region(dv_frame_system(dv_frame.get()),
+			       dv_frame_get_aspect(dv_frame.get())));
 	set_error(dv_frame->format_error);
 	queue_draw();
     }
@@ -229,6 +239,10 @@ void dv_display_widget::set_error(bool)
 {
 }
 
+void dv_display_widget::shm_completed()
+{
+}
+
 int dv_display_widget::get_buffer(AVCodecContext * context, AVFrame * header)
 {
     dv_display_widget * widget =
@@ -815,13 +829,13 @@ struct dv_thumb_display_widget::raw_frame_thumb
 dv_thumb_display_widget::dv_thumb_display_widget()
     : dv_display_widget(dv_block_size_log2),
       raw_frame_(new raw_frame_thumb),
-      x_image_(0),
-      x_shm_info_(0),
-      dest_width_(0),
-      dest_height_(0),
-      error_pixbuf_(load_icon("gtk-dialog-warning", 64)),
-      error_(false)
+      front_(0),
+      decoding_(false),
+      back_ready_(false),
+      error_pixbuf_(load_icon("gtk-dialog-warning", 64))
 {
+    std::memset(images_, 0, sizeof(images_));
+
     // We don't know what the frame format will be, but assume "PAL"
     // 4:3 frames and therefore an active image size of 702x576 and
     // pixel aspect ratio of 59:54.
@@ -832,18 +846,10 @@ dv_thumb_display_widget::~dv_thumb_display_widget()
 {
 }
 
-bool dv_thumb_display_widget::try_init_xshm(PixelFormat pix_fmt,
-					    unsigned height) throw()
+bool dv_thumb_display_widget::try_init_xshm() throw()
 {
-    assert(pix_fmt == PIX_FMT_YUV420P || pix_fmt == PIX_FMT_YUV422P
-	   || pix_fmt == PIX_FMT_YUV410P || pix_fmt == PIX_FMT_YUV411P);
-    assert(height <= FRAME_HEIGHT_MAX / dv_block_size);
-
-    if (x_image_)
-    {
-	raw_frame_->pix_fmt = pix_fmt;
+    if (images_[0].x_image)
 	return true;
-    }
 
     if (!init_x_shm_events())
 	return false;
@@ -861,8 +867,13 @@ bool dv_thumb_display_widget::try_init_xshm(PixelFormat pix_fmt,
     if ((visual->c_class == TrueColor || visual->c_class == DirectColor)
 	&& (depth == 24 || depth == 32))
     {
-	if (XShmSegmentInfo * x_shm_info = new (std::nothrow) XShmSegmentInfo)
+	for (unsigned i = 0; i != 2; ++i)
 	{
+	    thumb_image & image = images_[i];
+	    XShmSegmentInfo * x_shm_info =
+		new (std::nothrow) XShmSegmentInfo;
+	    if (!x_shm_info)
+		break;
 	    if (XImage * x_image = XShmCreateImage(
 		    x_display, visual, depth, ZPixmap,
 		    0, x_shm_info,
@@ -877,48 +888,61 @@ bool dv_thumb_display_widget::try_init_xshm(PixelFormat pix_fmt,
 			 x_display, x_shm_info,
 			 x_image->height * x_image->bytes_per_line)))
 		{
-		    raw_frame_->pix_fmt = pix_fmt;
-		    x_image_ = x_image;
-		    x_shm_info_ = x_shm_info;
+		    image.x_image = x_image;
+		    image.x_shm_info = x_shm_info;
 		}
 		else
 		{
 		    free(x_image);
 		}
 	    }
-	    if (!x_shm_info_)
+	    if (!image.x_shm_info)
+	    {
 		delete x_shm_info;
+		break;
+	    }
 	}
 
-	if (!x_image_)
+	if (!images_[1].x_image)
+	{
 	    std::cerr << "ERROR: Could not create Xshm image\n";
+	    fini_xshm();
+	}
     }
     else
     {
 	std::cerr << "ERROR: Window does not support 24- or 32-bit colour\n";
     }
 
-    return x_image_;
+    return images_[0].x_image;
 }
 
 void dv_thumb_display_widget::fini_xshm() throw()
 {
-    if (XImage * x_image = static_cast<XImage *>(x_image_))
+    bool had_image = images_[0].x_image;
+
+    for (unsigned i = 0; i != 2; ++i)
     {
-	XShmSegmentInfo * x_shm_info =
-	    static_cast<XShmSegmentInfo *>(x_shm_info_);
-	free_x_shm(x_shm_info);
-	delete x_shm_info;
-	x_shm_info_ = 0;
-	free(x_image);
-	x_image_ = 0;
+	thumb_image & image = images_[i];
+	if (XImage * x_image = static_cast<XImage *>(image.x_image))
+	{
+	    XShmSegmentInfo * x_shm_info =
+		static_cast<XShmSegmentInfo *>(image.x_shm_info);
+	    free_x_shm(x_shm_info);
+	    delete x_shm_info;
+	    free(x_image);
+	}
+	std::memset(&image, 0, sizeof(image));
+    }
+    back_ready_ = false;
 
+    if (had_image)
 	fini_x_shm_events();
-    }
 }
 
 void dv_thumb_display_widget::on_unrealize() throw()
 {
+    assert(!decoding_);
     fini_xshm();
 
     dv_display_widget::on_unrealize();
@@ -933,9 +957,15 @@ AVFrame * dv_thumb_display_widget::get_frame_buffer(AVFrame * header,
 						    PixelFormat pix_fmt,
 						    unsigned height)
 {
-    if (!try_init_xshm(pix_fmt, height))
+    assert(pix_fmt == PIX_FMT_YUV420P || pix_fmt == PIX_FMT_YUV422P
+	   || pix_fmt == PIX_FMT_YUV410P || pix_fmt == PIX_FMT_YUV411P);
+    assert(height <= FRAME_HEIGHT_MAX / dv_block_size);
+
+    if (!try_init_xshm())
 	return 0;
 
+    raw_frame_->pix_fmt = pix_fmt;
+
     header->data[0] = raw_frame_->buffer.y;
     header->linesize[0] = frame_thumb_linesize_4;
     header->data[1] = raw_frame_->buffer.c_dummy;
@@ -952,14 +982,25 @@ AVFrame * dv_thumb_display_widget::get_frame_buffer(AVFrame * header,
 void dv_thumb_display_widget::put_frame_buffer(
     const display_region & source_region)
 {
-    XImage * x_image = static_cast<XImage *>(x_image_);
+    scale_frame_buffer(images_[!front_], source_region);
+    flip_images();
+}
 
-    dest_width_ = div_round_nearest<unsigned>((source_region.right - source_region.left)
-					      * source_region.pixel_width,
-					      source_region.pixel_height
-					      * thumb_scale_denom);
-    dest_height_ = div_round_nearest<unsigned>(source_region.bottom - source_region.top,
-					       thumb_scale_denom);
+void dv_thumb_display_widget::scale_frame_buffer(
+    thumb_image & image, const display_region & source_region)
+{
+    XImage * x_image = static_cast<XImage *>(image.x_image);
+
+    const unsigned dest_width =
+	div_round_nearest<unsigned>((source_region.right - source_region.left)
+				    * source_region.pixel_width,
+				    source_region.pixel_height
+				    * thumb_scale_denom);
+    const unsigned dest_height =
+	div_round_nearest<unsigned>(source_region.bottom - source_region.top,
+				    thumb_scale_denom);
+    image.dest_width = dest_width;
+    image.dest_height = dest_height;
 
     // Scale the image up using Bresenham's algorithm
 
@@ -969,8 +1010,8 @@ void dv_thumb_display_widget::put_frame_buffer(
 				   / dv_block_size);
     const unsigned source_height = ((source_region.bottom - source_region.top)
 				    / dv_block_size);
-    assert(source_width <= dest_width_);
-    assert(source_height <= dest_height_);
+    assert(source_width <= dest_width);
+    assert(source_height <= dest_height);
     unsigned source_y = source_region.top / dv_block_size, dest_y = 0;
     unsigned error_y = source_height / 2;
     do
@@ -981,7 +1022,7 @@ void dv_thumb_display_widget::put_frame_buffer(
 	uint8_t * dest = reinterpret_cast<uint8_t *>(
 	    x_image->data + x_image->bytes_per_line * dest_y);
 	uint8_t * dest_row_end =
-	    dest + x_image->bits_per_pixel / 8 * dest_width_;
+	    dest + x_image->bits_per_pixel / 8 * dest_width;
 	unsigned error_x = source_width / 2;
 	uint8_t source_value = *source;
 	do
@@ -994,35 +1035,92 @@ void dv_thumb_display_widget::put_frame_buffer(
 		*dest++ = source_value;
 
 	    error_x += source_width;
-	    if (error_x >= dest_width_)
+	    if (error_x >= dest_width)
 	    {
 		source_value = *++source;
-		error_x -= dest_width_;
+		error_x -= dest_width;
 	    }
 	}
 	while (dest != dest_row_end);
 
 	error_y += source_height;
-	if (error_y >= dest_height_)
+	if (error_y >= dest_height)
 	{
 	    ++source_y;
-	    error_y -= dest_height_;
+	    error_y -= dest_height;
 	}
 	++dest_y;
     }
-    while (dest_y != dest_height_);
+    while (dest_y != dest_height);
+}
 
-    set_size_request(dest_width_, dest_height_);
+void dv_thumb_display_widget::flip_images()
+{
+    front_ = !front_;
+    back_ready_ = false;
+    set_size_request(images_[front_].dest_width, images_[front_].dest_height);
+    queue_draw();
+}
+
+bool dv_thumb_display_widget::begin_frame(const dv_frame_ptr & dv_frame)
+{
+    // The back image must not be replaced until it has been shown
+    if (!is_realized() || decoding_ || back_ready_
+	|| dv_frame->serial_num == decoded_serial_num_
+	|| !try_init_xshm())
+	return false;
+
+    decoded_serial_num_ = dv_frame->serial_num;
+    decoding_ = true;
+    return true;
+}
+
+void dv_thumb_display_widget::decode_frame(const dv_frame_ptr & dv_frame)
+{
+    // This must not touch X or GTK+, only the back image.  The X
+    // server is not reading it, since the images are only flipped
+    // when it has finished with the front image.
+    assert(decoding_);
+
+    // Take the luma of each 8x8 block from its DC coefficient if we
+    // can, which is much cheaper than even a low-resolution decode
+    uint8_t * planes[3] = { raw_frame_->buffer.y, 0, 0 };
+    const int linesizes[3] = { frame_thumb_linesize_4, 0, 0 };
+    if (dv_buffer_get_thumbnail(dv_frame->buffer, planes, linesizes)
+	|| decode_video(dv_frame))
+    {
+	thumb_image & image = images_[!front_];
+	scale_frame_buffer(image,
+			   get_display_region(dv_frame_system(dv_frame.get()),
+					      dv_frame_get_aspect(dv_frame.get())));
+	image.error = dv_frame->format_error;
+	back_ready_ = true;
+    }
+}
+
+void dv_thumb_display_widget::end_frame()
+{
+    assert(decoding_);
+    decoding_ = false;
+    if (back_ready_ && !is_shm_busy())
+	flip_images();
+}
+
+void dv_thumb_display_widget::shm_completed()
+{
+    if (!decoding_ && back_ready_)
+	flip_images();
 }
 
 void dv_thumb_display_widget::set_error(bool error)
 {
-    error_ = error;
+    images_[front_].error = error;
 }
 
 bool dv_thumb_display_widget::on_expose_event(GdkEventExpose *) throw()
 {
-    if (!x_image_ || !dest_width_ || !dest_height_)
+    const thumb_image & image = images_[front_];
+    if (!image.x_image || !image.dest_width || !image.dest_height)
 	return true;
 
     Glib::RefPtr<Gdk::Drawable> drawable;
@@ -1035,19 +1133,19 @@ bool dv_thumb_display_widget::on_expose_event(GdkEventExpose *) throw()
 	XShmPutImage(get_x_display(drawable),
 		     get_x_window(drawable),
 		     gdk_x11_gc_get_xgc(gc->gobj()),
-		     static_cast<XImage *>(x_image_),
+		     static_cast<XImage *>(image.x_image),
 		     0, 0,
 		     dest_x, dest_y,
-		     dest_width_, dest_height_,
+		     image.dest_width, image.dest_height,
 		     /*send_event=*/ True);
 	set_shm_busy();
 
-	if (error_)
+	if (image.error)
 	{
 	    drawable->draw_pixbuf(
 		gc, error_pixbuf_, 0, 0,
-		dest_x + (dest_width_ - error_pixbuf_->get_width()) / 2,
-		dest_y + (dest_height_ - error_pixbuf_->get_height()) / 2,
+		dest_x + (image.dest_width - error_pixbuf_->get_width()) / 2,
+		dest_y + (image.dest_height - error_pixbuf_->get_height()) / 2,
 		-1, -1, Gdk::RGB_DITHER_NORMAL, 0, 0);
 	}
     }
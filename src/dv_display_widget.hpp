@@ -35,17 +35,26 @@ protected:
     bool init_x_shm_events();
     void fini_x_shm_events();
     void set_shm_busy() { shm_busy_ = true; }
+    bool is_shm_busy() const { return shm_busy_; }
+
+    display_region get_display_region(const dv_system * system,
+				      dv_frame_aspect frame_aspect);
+    // Decode the video into the frame buffer and return its header,
+    // or null on failure
+    AVFrame * decode_video(const dv_frame_ptr &);
 
     auto_codec decoder_;
+    unsigned decoded_serial_num_;
 
 private:
-    display_region get_display_region(const dv_system * system,
-				      dv_frame_aspect frame_aspect);
     virtual AVFrame * get_frame_header() = 0;
     virtual AVFrame * get_frame_buffer(AVFrame * header,
 				       PixelFormat pix_fmt, unsigned height) = 0;
     virtual void put_frame_buffer(const display_region &) = 0;
     virtual void set_error(bool);
+    // Called when the X server has finished with a shared memory
+    // image after set_shm_busy()
+    virtual void shm_completed();
 
     static int get_buffer(AVCodecContext *, AVFrame *);
     static void release_buffer(AVCodecContext *, AVFrame *);
@@ -55,7 +64,6 @@ private:
 					      GdkEvent * event,
 					      void * data);
 
-    unsigned decoded_serial_num_;
     int x_shm_first_event_;
     bool shm_busy_;
 };
@@ -128,28 +136,51 @@ public:
     dv_thumb_display_widget();
     ~dv_thumb_display_widget();
 
+    // Update the thumbnail with decoding and scaling done in another
+    // thread.  begin_frame() returns true if the frame should be
+    // shown, and then decode_frame() must be called in the other
+    // thread, and end_frame() in the main thread once that has
+    // returned.  Nothing else may be done with the widget in the
+    // mean time.
+    bool begin_frame(const dv_frame_ptr &);
+    void decode_frame(const dv_frame_ptr &);
+    void end_frame();
+
 private:
     struct raw_frame_thumb;
 
-    bool try_init_xshm(PixelFormat pix_fmt, unsigned height) throw();
+    // The X server reads the front image while the back image is
+    // being drawn
+    struct thumb_image
+    {
+	void * x_image;
+	void * x_shm_info;
+	unsigned dest_width, dest_height;
+	bool error;
+    };
+
+    bool try_init_xshm() throw();
     void fini_xshm() throw();
+    void scale_frame_buffer(thumb_image &, const display_region &);
+    void flip_images();
 
     virtual AVFrame * get_frame_header();
     virtual AVFrame * get_frame_buffer(AVFrame * header,
 				       PixelFormat pix_fmt, unsigned height);
     virtual void put_frame_buffer(const display_region &);
     virtual void set_error(bool);
+    virtual void shm_completed();
 
     virtual bool on_expose_event(GdkEventExpose *) throw();
     virtual void on_unrealize() throw();
 
     std::auto_ptr<raw_frame_thumb> raw_frame_;
-    void * x_image_;
-    void * x_shm_info_;
-    unsigned dest_width_, dest_height_;
+    thumb_image images_[2];
+    unsigned front_;
+    bool decoding_;   // back image is being drawn
+    bool back_ready_; // back image is complete and should be shown
 
     Glib::RefPtr<Gdk::Pixbuf> error_pixbuf_;
-    bool error_;
 };
 
 #endif // !defined(DVSWITCH_DV_DISPLAY_WIDGET_HPP)
@@ -3,10 +3,17 @@
 
 // Gtkmm widget for visual selection of DV streams
 
+#include <algorithm>
 #include <iostream>
 #include <ostream>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
 #include <gdk/gdkkeysyms.h>
+#include <glibmm/main.h>
 #include <gtkmm/label.h>
 #include <gtkmm/separator.h>
 
@@ -39,10 +46,23 @@ dv_selector_widget::dv_selector_widget()
 	  Gdk::Pixbuf::create_from_file(SHAREDIR
 					"/dvswitch/sec-video-source.png")),
       audio_source_pixbuf_(
-	  Gdk::Pixbuf::create_from_file(SHAREDIR "/dvswitch/audio-source.png"))
+	  Gdk::Pixbuf::create_from_file(SHAREDIR "/dvswitch/audio-source.png")),
+      thumb_done_pipe_(O_NONBLOCK, O_NONBLOCK),
+      thumb_workers_stopping_(false)
 {
     set_col_spacings(gui_standard_spacing);
     set_row_spacings(gui_standard_spacing);
+
+    Glib::RefPtr<Glib::IOSource> pipe_io_source(
+	Glib::IOSource::create(thumb_done_pipe_.reader.get(), Glib::IO_IN));
+    pipe_io_source->connect(
+	sigc::mem_fun(this, &dv_selector_widget::on_thumbs_decoded));
+    pipe_io_source->attach();
+}
+
+dv_selector_widget::~dv_selector_widget()
+{
+    stop_thumb_workers();
 }
 
 Gtk::RadioButton * dv_selector_widget::create_radio_button(
@@ -232,7 +252,115 @@ void dv_selector_widget::put_frame(mixer::source_id source_id,
 				   const dv_frame_ptr & source_frame)
 {
     if (source_id < thumbnails_.size())
-	thumbnails_[source_id]->put_frame(source_frame);
+    {
+	start_thumb_workers();
+
+	dv_thumb_display_widget * thumb = thumbnails_[source_id];
+	if (thumb->begin_frame(source_frame))
+	{
+	    thumb_job job = { thumb, source_frame };
+	    boost::mutex::scoped_lock lock(thumb_mutex_);
+	    thumb_queue_.push_back(job);
+	    thumb_queue_cond_.notify_one();
+	}
+    }
+}
+
+void dv_selector_widget::start_thumb_workers()
+{
+    if (thumb_workers_.get())
+	return;
+
+    // Leave a CPU for the main thread, which updates the main display
+    long thread_count =
+	std::max<long>(sysconf(_SC_NPROCESSORS_ONLN) - 1, 1);
+    std::cout << "INFO: Thumbnail decoder threads: " << thread_count << "\n";
+
+    thumb_workers_.reset(new boost::thread_group);
+    for (long i = 0; i != thread_count; ++i)
+	thumb_workers_->create_thread(
+	    boost::bind(&dv_selector_widget::run_thumb_worker, this));
+}
+
+void dv_selector_widget::stop_thumb_workers()
+{
+    if (!thumb_workers_.get())
+	return;
+
+    {
+	boost::mutex::scoped_lock lock(thumb_mutex_);
+	thumb_workers_stopping_ = true;
+	thumb_queue_cond_.notify_all();
+    }
+    thumb_workers_->join_all();
+    thumb_workers_.reset();
+    thumb_workers_stopping_ = false;
+
+    // Finish the frames that were never decoded as well as those that
+    // were
+    for (std::deque<thumb_job>::iterator it = thumb_queue_.begin();
+	 it != thumb_queue_.end();
+	 ++it)
+	thumbs_done_.push_back(it->thumb);
+    thumb_queue_.clear();
+    end_thumb_frames();
+}
+
+void dv_selector_widget::run_thumb_worker()
+{
+    boost::mutex::scoped_lock lock(thumb_mutex_);
+
+    for (;;)
+    {
+	while (!thumb_workers_stopping_ && thumb_queue_.empty())
+	    thumb_queue_cond_.wait(lock);
+	if (thumb_workers_stopping_)
+	    break;
+
+	thumb_job job(thumb_queue_.front());
+	thumb_queue_.pop_front();
+
+	lock.unlock();
+	job.thumb->decode_frame(job.frame);
+	job.frame.reset();
+	lock.lock();
+
+	thumbs_done_.push_back(job.thumb);
+
+	// Poke the event loop.
+	static const char dummy[1] = {0};
+	write(thumb_done_pipe_.writer.get(), dummy, sizeof(dummy));
+    }
+}
+
+void dv_selector_widget::end_thumb_frames()
+{
+    std::vector<dv_thumb_display_widget *> done;
+    {
+	boost::mutex::scoped_lock lock(thumb_mutex_);
+	done.swap(thumbs_done_);
+    }
+    for (std::size_t i = 0; i != done.size(); ++i)
+	done[i]->end_frame();
+}
+
+bool dv_selector_widget::on_thumbs_decoded(Glib::IOCondition) throw()
+{
+    // Empty the pipe; the list of finished thumbnails says what to do.
+    static char dummy[4096];
+    read(thumb_done_pipe_.reader.get(), dummy, sizeof(dummy));
+
+    end_thumb_frames();
+    return true;
+}
+
+void dv_selector_widget::on_unrealize() throw()
+{
+    // The thumbnails must not be unrealized while they are being
+    // decoded
+    stop_thumb_workers();
+
+    Gtk::Table::on_unrealize();
 }
 
 sigc::signal1<void, mixer::source_id> &
@@ -6,13 +6,20 @@
 #ifndef DVSWITCH_DV_SELECTOR_WIDGET_HPP
 #define DVSWITCH_DV_SELECTOR_WIDGET_HPP
 
+#include <deque>
+#include <memory>
 #include <vector>
 
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 #include <gtkmm/accelgroup.h>
 #include <gtkmm/image.h>
 #include <gtkmm/radiobutton.h>
 #include <gtkmm/table.h>
 
+#include "auto_pipe.hpp"
 #include "dv_display_widget.hpp"
 #include "mixer.hpp"
 
@@ -20,6 +27,7 @@ class dv_selector_widget : public Gtk::Table
 {
 public:
     dv_selector_widget();
+    ~dv_selector_widget();
 
     void set_accel_group(const Glib::RefPtr<Gtk::AccelGroup> & accel_group);
 
@@ -41,6 +49,20 @@ private:
     void on_sec_video_selected(mixer::source_id);
     void on_audio_selected(mixer::source_id);
 
+    struct thumb_job
+    {
+	dv_thumb_display_widget * thumb;
+	dv_frame_ptr frame;
+    };
+
+    void start_thumb_workers();
+    void stop_thumb_workers();
+    void run_thumb_worker();
+    void end_thumb_frames();
+    bool on_thumbs_decoded(Glib::IOCondition) throw();
+
+    virtual void on_unrealize() throw();
+
     Glib::RefPtr<Gtk::AccelGroup> accel_group_;
     Glib::RefPtr<Gdk::Pixbuf> pri_video_source_pixbuf_;
     Glib::RefPtr<Gdk::Pixbuf> sec_video_source_pixbuf_;
@@ -54,6 +76,15 @@ private:
     std::vector<dv_thumb_display_widget *> thumbnails_;
     std::vector<Gtk::RadioButton *> pri_video_buttons_;
     std::vector<Gtk::RadioButton *> sec_video_buttons_;
+
+    // Thumbnails are decoded and scaled by worker threads
+    std::auto_ptr<boost::thread_group> thumb_workers_;
+    auto_pipe thumb_done_pipe_;
+    boost::mutex thumb_mutex_; // controls access to the following
+    bool thumb_workers_stopping_;
+    std::deque<thumb_job> thumb_queue_;
+    boost::condition thumb_queue_cond_;
+    std::vector<dv_thumb_display_widget *> thumbs_done_;
 };
 
 #endif // !defined(DVSWITCH_DV_SELECTOR_WIDGET_HPP)
@@ -19,12 +19,14 @@
 static struct option options[] = {
     {"host",   1, NULL, 'h'},
     {"port",   1, NULL, 'p'},
+    {"output", 1, NULL, 'o'},
     {"help",   0, NULL, 'H'},
     {NULL,     0, NULL, 0}
 };
 
 static char * mixer_host = NULL;
 static char * mixer_port = NULL;
+static char * mixer_output = NULL;
 
 static void handle_config(const char * name, const char * value)
 {
@@ -44,7 +46,7 @@ static void usage(const char * progname)
 {
     fprintf(stderr,
 	    "\
-Usage: %s [-h HOST] [-p PORT] COMMAND...\n",
+Usage: %s [-h HOST] [-p PORT] [-o OUTPUT] COMMAND...\n",
 	    progname);
 }
 
@@ -56,7 +58,7 @@ int main(int argc, char ** argv)
     // Parse arguments.
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "h:p:", options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "h:p:o:", options, NULL)) != -1)
     {
 	switch (opt)
 	{
@@ -68,6 +70,10 @@ int main(int argc, char ** argv)
 	    free(mixer_port);
 	    mixer_port = strdup(optarg);
 	    break;
+	case 'o':
+	    free(mixer_output);
+	    mixer_output = strdup(optarg);
+	    break;
 	case 'H': // --help
 	    usage(argv[0]);
 	    return 0;
@@ -96,11 +102,7 @@ int main(int argc, char ** argv)
     printf("INFO: Connecting to %s:%s\n", mixer_host, mixer_port);
     int sock = create_connected_socket(mixer_host, mixer_port);
     assert(sock >= 0); // create_connected_socket() should handle errors
-    if (write(sock, GREETING_RAW_SINK, GREETING_SIZE) != GREETING_SIZE)
-    {
-	perror("ERROR: write");
-	exit(1);
-    }
+    send_sink_greeting(sock, GREETING_RAW_SINK, mixer_output);
     if (dup2(sock, STDIN_FILENO) < 0)
     {
 	perror("ERROR: dup2");
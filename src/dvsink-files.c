@@ -6,7 +6,9 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,25 +16,38 @@
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
 #include "config.h"
 #include "dif.h"
+#include "frame_index.h"
 #include "protocol.h"
 #include "socket.h"
 
 static struct option options[] = {
     {"host",   1, NULL, 'h'},
     {"port",   1, NULL, 'p'},
+    {"output", 1, NULL, 'o'},
+    {"direct", 0, NULL, 'd'},
     {"help",   0, NULL, 'H'},
     {NULL,     0, NULL, 0}
 };
 
 static char * mixer_host = NULL;
 static char * mixer_port = NULL;
+static char * mixer_output = NULL;
 static char * output_name_format = NULL;
+static bool direct_io = false;
 
 static void handle_config(const char * name, const char * value)
 {
@@ -57,7 +72,7 @@ static void usage(const char * progname)
 {
     fprintf(stderr,
 	    "\
-Usage: %s [-h HOST] [-p PORT] [NAME-FORMAT]\n",
+Usage: %s [-h HOST] [-p PORT] [-o OUTPUT] [-d] [NAME-FORMAT]\n",
 	    progname);
 }
 
@@ -65,7 +80,7 @@ struct transfer_params {
     int            sock;
 };
 
-static int create_file(const char * format, char ** name)
+static int create_file(const char * format, int flags, char ** name)
 {
     time_t now;
     struct tm now_local;
@@ -105,7 +120,7 @@ static int create_file(const char * format, char ** name)
 	name_len -= 3;
     for (;;)
     {
-	file = open(name_buf, O_CREAT | O_EXCL | O_WRONLY, 0666);
+	file = open(name_buf, O_CREAT | O_EXCL | O_WRONLY | flags, 0666);
 	if (file >= 0)
 	{
 	    *name = name_buf;
@@ -144,101 +159,771 @@ static int create_file(const char * format, char ** name)
     return file;
 }
 
-static ssize_t write_retry(int fd, const void * buf, size_t count)
+static ssize_t pwrite_retry(int fd, const void * buf, size_t count,
+			    off_t offset)
 {
     ssize_t chunk, total = 0;
 
     do
     {
-	chunk = write(fd, buf, count);
+	chunk = pwrite(fd, buf, count, offset);
 	if (chunk < 0)
 	    return chunk;
 	total += chunk;
 	buf = (const char *)buf + chunk;
 	count -= chunk;
+	offset += chunk;
     }
     while (count);
 
     return total;
 }
 
+// Frames are read into a ring of buffers and written to disk
+// asynchronously, so that a slow disk doesn't hold up reading from
+// the mixer.  (If the mixer's queue for this sink overflows, it cuts
+// the recording.)  Writes are done through io_uring where the kernel
+// supports it, otherwise by a writer thread.  Up to RING_SIZE frames
+// may be waiting to be written.
+//
+// In direct mode (-d) files are written with O_DIRECT, so that a long
+// recording doesn't push everything else out of the page cache.  Each
+// buffer then holds a batch of frames, which is written up to the
+// last whole block, and the remainder is carried over to the next
+// batch.  Files are preallocated in large extents, synced
+// periodically, and truncated to the length of the frames in them
+// when closed.
+//
+// Each file has a frame index (see frame_index.h), which is written
+// directly by the main thread as frames are received, and finished
+// with an end record once all writes to the file are complete.
+
+#define RING_SIZE 32
+
+#define DIRECT_ALIGN 4096 // enough for any common logical block size
+#define DIRECT_BATCH_SIZE (512 * 1024)
+#define DIRECT_EXTENT_SIZE ((off_t)64 * 1024 * 1024)
+#define DIRECT_SYNC_INTERVAL ((off_t)16 * 1024 * 1024)
+
+struct output_file
+{
+    int fd;
+    int index_fd;
+    uint32_t frame_count; // frames received so far
+    uint8_t end_cut;	// cut flag that ended the file
+    off_t size;		// bytes submitted for writing so far
+    off_t length;	// bytes of frames received so far
+    off_t allocated;	// bytes preallocated, or -1 if not possible
+    off_t synced;	// size when last synced
+    unsigned pending;	// number of writes and syncs not yet completed
+    bool closing;	// close once there are no pending writes
+};
+
+struct frame_buffer
+{
+    struct output_file * file;
+    off_t offset;
+    struct iovec iov;	// the part of the buffer still to be written
+    size_t fill;	// bytes of frames in the buffer
+    uint8_t * data;	// aligned for O_DIRECT
+};
+
+static struct frame_buffer * free_buffers[RING_SIZE];
+static unsigned free_count;
+
+struct frame_writer
+{
+    // Return a free buffer, waiting for a write to complete if
+    // necessary
+    struct frame_buffer * (*get_buffer)(void);
+    // Start writing the frame in a buffer to its file
+    void (*submit)(struct frame_buffer *);
+    // Close a file once all writes to it are complete
+    void (*close_file)(struct output_file *);
+    // Wait for all writes to complete
+    void (*finish)(void);
+};
+
+static void init_buffers(void)
+{
+    // A batch may overrun DIRECT_BATCH_SIZE by up to a frame
+    size_t data_size =
+	direct_io ? DIRECT_BATCH_SIZE + DIF_MAX_FRAME_SIZE : DIF_MAX_FRAME_SIZE;
+    unsigned i;
+    int err;
+
+    for (i = 0; i != RING_SIZE; ++i)
+    {
+	free_buffers[i] = malloc(sizeof(struct frame_buffer));
+	if (!free_buffers[i])
+	{
+	    perror("ERROR: malloc");
+	    exit(1);
+	}
+	err = posix_memalign((void **)&free_buffers[i]->data, DIRECT_ALIGN,
+			     data_size);
+	if (err)
+	{
+	    errno = err;
+	    perror("ERROR: posix_memalign");
+	    exit(1);
+	}
+    }
+    free_count = RING_SIZE;
+}
+
+static void write_index(struct output_file * file,
+			const uint8_t * buffer, size_t size)
+{
+    if (write(file->index_fd, buffer, size) != (ssize_t)size)
+    {
+	perror("ERROR: write");
+	exit(1);
+    }
+}
+
+static void release_file(struct output_file * file)
+{
+    if (file->closing && !file->pending)
+    {
+	// Remove the padding of the last block and any unused
+	// preallocation
+	if (direct_io && ftruncate(file->fd, file->length) < 0)
+	{
+	    perror("ERROR: ftruncate");
+	    exit(1);
+	}
+
+	// All frames are now written, so mark the index complete
+	// (unless it's empty)
+	if (file->frame_count)
+	{
+	    struct frame_index_record record = {
+		.frame_num = file->frame_count,
+		.cut = file->end_cut,
+		.flags = FRAME_INDEX_FLAG_END
+	    };
+	    uint8_t buffer[FRAME_INDEX_RECORD_SIZE];
+
+	    frame_index_encode_record(buffer, &record);
+	    write_index(file, buffer, sizeof(buffer));
+	}
+	if (close(file->index_fd) < 0)
+	{
+	    perror("ERROR: close");
+	    exit(1);
+	}
+	if (close(file->fd) < 0)
+	{
+	    perror("ERROR: close");
+	    exit(1);
+	}
+	free(file);
+    }
+}
+
+// Check whether a file is due to be synced after a write completes
+// up to the given offset, and if so note that it is being synced
+static bool start_sync(struct output_file * file, off_t end)
+{
+    if (!direct_io || end < file->synced + DIRECT_SYNC_INTERVAL)
+	return false;
+    file->synced = end;
+    return true;
+}
+
+static void complete_write(struct frame_buffer * buf)
+{
+    struct output_file * file = buf->file;
+
+    --file->pending;
+    release_file(file);
+    free_buffers[free_count++] = buf;
+}
+
+// Writer thread
+
+static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thread_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t thread_free_cond = PTHREAD_COND_INITIALIZER;
+static struct frame_buffer * thread_queue[RING_SIZE];
+static unsigned thread_queue_head, thread_queue_count;
+static bool thread_stopping;
+static pthread_t thread_id;
+
+static void * run_writer_thread(void * unused)
+{
+    (void)unused;
+
+    pthread_mutex_lock(&thread_mutex);
+
+    for (;;)
+    {
+	while (!thread_queue_count && !thread_stopping)
+	    pthread_cond_wait(&thread_work_cond, &thread_mutex);
+	if (!thread_queue_count)
+	    break;
+
+	struct frame_buffer * buf = thread_queue[thread_queue_head];
+	thread_queue_head = (thread_queue_head + 1) % RING_SIZE;
+	--thread_queue_count;
+
+	pthread_mutex_unlock(&thread_mutex);
+	if (pwrite_retry(buf->file->fd, buf->iov.iov_base, buf->iov.iov_len,
+			 buf->offset)
+	    != (ssize_t)buf->iov.iov_len)
+	{
+	    perror("ERROR: write");
+	    exit(1);
+	}
+	if (start_sync(buf->file, buf->offset + buf->iov.iov_len)
+	    && (fdatasync(buf->file->fd) < 0
+		|| fdatasync(buf->file->index_fd) < 0))
+	{
+	    perror("ERROR: fdatasync");
+	    exit(1);
+	}
+	pthread_mutex_lock(&thread_mutex);
+
+	complete_write(buf);
+	pthread_cond_signal(&thread_free_cond);
+    }
+
+    pthread_mutex_unlock(&thread_mutex);
+    return NULL;
+}
+
+static struct frame_buffer * thread_get_buffer(void)
+{
+    struct frame_buffer * buf;
+
+    pthread_mutex_lock(&thread_mutex);
+    while (!free_count)
+	pthread_cond_wait(&thread_free_cond, &thread_mutex);
+    buf = free_buffers[--free_count];
+    pthread_mutex_unlock(&thread_mutex);
+
+    return buf;
+}
+
+static void thread_submit(struct frame_buffer * buf)
+{
+    pthread_mutex_lock(&thread_mutex);
+    ++buf->file->pending;
+    thread_queue[(thread_queue_head + thread_queue_count++) % RING_SIZE] = buf;
+    pthread_cond_signal(&thread_work_cond);
+    pthread_mutex_unlock(&thread_mutex);
+}
+
+static void thread_close_file(struct output_file * file)
+{
+    pthread_mutex_lock(&thread_mutex);
+    file->closing = true;
+    release_file(file);
+    pthread_mutex_unlock(&thread_mutex);
+}
+
+static void thread_finish(void)
+{
+    pthread_mutex_lock(&thread_mutex);
+    thread_stopping = true;
+    pthread_cond_signal(&thread_work_cond);
+    pthread_mutex_unlock(&thread_mutex);
+    pthread_join(thread_id, NULL);
+}
+
+static const struct frame_writer thread_writer = {
+    thread_get_buffer, thread_submit, thread_close_file, thread_finish
+};
+
+static const struct frame_writer * init_thread_writer(void)
+{
+    int err = pthread_create(&thread_id, NULL, run_writer_thread, NULL);
+    if (err)
+    {
+	errno = err;
+	perror("ERROR: pthread_create");
+	exit(1);
+    }
+    return &thread_writer;
+}
+
+// io_uring, used directly through system calls.  All of this runs in
+// the main thread.  Completions of syncs are distinguished from
+// completions of writes by setting the low bit of user_data.
+
+#ifdef __NR_io_uring_setup
+
+#define URING_SYNC_TAG 1
+
+static struct
+{
+    int fd;
+    unsigned * sq_tail, * sq_mask, * sq_array;
+    struct io_uring_sqe * sqes;
+    unsigned * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_cqe * cqes;
+    unsigned in_flight;
+} uring;
+
+static struct io_uring_sqe * uring_next_sqe(void)
+{
+    unsigned index = *uring.sq_tail & *uring.sq_mask;
+    struct io_uring_sqe * sqe = &uring.sqes[index];
+
+    // Each entry is submitted as soon as it is filled in, so there
+    // is always room
+    memset(sqe, 0, sizeof(*sqe));
+    uring.sq_array[index] = index;
+    return sqe;
+}
+
+static void uring_submit_sqe(void)
+{
+    __atomic_store_n(uring.sq_tail, *uring.sq_tail + 1, __ATOMIC_RELEASE);
+    ++uring.in_flight;
+
+    while (syscall(__NR_io_uring_enter, uring.fd, 1, 0, 0, NULL, 0) < 0)
+    {
+	if (errno != EINTR && errno != EAGAIN)
+	{
+	    perror("ERROR: io_uring_enter");
+	    exit(1);
+	}
+    }
+}
+
+static void uring_submit(struct frame_buffer * buf)
+{
+    struct io_uring_sqe * sqe = uring_next_sqe();
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = buf->file->fd;
+    sqe->off = buf->offset;
+    sqe->addr = (uintptr_t)&buf->iov;
+    sqe->len = 1;
+    sqe->user_data = (uintptr_t)buf;
+    uring_submit_sqe();
+}
+
+static void uring_submit_sync(struct output_file * file, int fd)
+{
+    struct io_uring_sqe * sqe = uring_next_sqe();
+
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->user_data = (uintptr_t)file | URING_SYNC_TAG;
+    ++file->pending;
+    uring_submit_sqe();
+}
+
+// Handle completed writes and syncs, first waiting for at least min_complete
+static void uring_reap(unsigned min_complete)
+{
+    unsigned head, tail;
+
+    while (min_complete
+	   && syscall(__NR_io_uring_enter, uring.fd, 0, min_complete,
+		      IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+    {
+	if (errno != EINTR)
+	{
+	    perror("ERROR: io_uring_enter");
+	    exit(1);
+	}
+    }
+
+    head = *uring.cq_head;
+    tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+	const struct io_uring_cqe * cqe = &uring.cqes[head & *uring.cq_mask];
+	uint64_t user_data = cqe->user_data;
+	int result = cqe->res;
+	struct frame_buffer * buf;
+
+	++head;
+	__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+	--uring.in_flight;
+
+	if (user_data & URING_SYNC_TAG)
+	{
+	    struct output_file * file =
+		(struct output_file *)(uintptr_t)(user_data & ~URING_SYNC_TAG);
+
+	    if (result < 0)
+	    {
+		errno = -result;
+		perror("ERROR: fdatasync");
+		exit(1);
+	    }
+	    --file->pending;
+	    release_file(file);
+	    continue;
+	}
+
+	buf = (struct frame_buffer *)(uintptr_t)user_data;
+	if (result < 0)
+	{
+	    errno = -result;
+	    perror("ERROR: write");
+	    exit(1);
+	}
+	if ((size_t)result < buf->iov.iov_len)
+	{
+	    // Short write; write the rest
+	    buf->iov.iov_base = (uint8_t *)buf->iov.iov_base + result;
+	    buf->iov.iov_len -= result;
+	    buf->offset += result;
+	    uring_submit(buf);
+	}
+	else
+	{
+	    if (start_sync(buf->file, buf->offset + buf->iov.iov_len))
+	    {
+		uring_submit_sync(buf->file, buf->file->fd);
+		uring_submit_sync(buf->file, buf->file->index_fd);
+	    }
+	    complete_write(buf);
+	}
+    }
+}
+
+static struct frame_buffer * uring_get_buffer(void)
+{
+    uring_reap(0);
+    while (!free_count)
+	uring_reap(1);
+    return free_buffers[--free_count];
+}
+
+static void uring_submit_new(struct frame_buffer * buf)
+{
+    ++buf->file->pending;
+    uring_submit(buf);
+}
+
+static void uring_close_file(struct output_file * file)
+{
+    file->closing = true;
+    release_file(file);
+}
+
+static void uring_finish(void)
+{
+    while (uring.in_flight)
+	uring_reap(1);
+}
+
+static const struct frame_writer uring_writer = {
+    uring_get_buffer, uring_submit_new, uring_close_file, uring_finish
+};
+
+static const struct frame_writer * init_uring_writer(void)
+{
+    struct io_uring_params params;
+    uint8_t * sq_ring, * cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+
+    memset(&params, 0, sizeof(params));
+    uring.fd = syscall(__NR_io_uring_setup, RING_SIZE, &params);
+    if (uring.fd < 0)
+	return NULL;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes
+	+ params.cq_entries * sizeof(struct io_uring_cqe);
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+    cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+		      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		      uring.fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED
+	|| uring.sqes == MAP_FAILED)
+    {
+	perror("WARN: mmap");
+	close(uring.fd);
+	return NULL;
+    }
+
+    uring.sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+    uring.sq_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+    uring.cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+    uring.cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+    uring.cq_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+    return &uring_writer;
+}
+
+#else // !defined(__NR_io_uring_setup)
+
+static const struct frame_writer * init_uring_writer(void)
+{
+    return NULL;
+}
+
+#endif
+
+static const struct frame_writer * init_writer(void)
+{
+    const struct frame_writer * writer;
+
+    init_buffers();
+
+    if ((writer = init_uring_writer()))
+    {
+	printf("INFO: Writing files with io_uring\n");
+    }
+    else
+    {
+	printf("INFO: Writing files with a writer thread\n");
+	writer = init_thread_writer();
+    }
+    fflush(stdout);
+
+    return writer;
+}
+
+static struct output_file * open_output_file(const char * format,
+					     char ** name)
+{
+    struct output_file * file = malloc(sizeof(struct output_file));
+    if (!file)
+    {
+	perror("ERROR: malloc");
+	exit(1);
+    }
+    file->fd = create_file(format, direct_io ? O_DIRECT : 0, name);
+
+    char * index_name = malloc(strlen(*name) + sizeof(FRAME_INDEX_SUFFIX));
+    if (!index_name)
+    {
+	perror("ERROR: malloc");
+	exit(1);
+    }
+    sprintf(index_name, "%s" FRAME_INDEX_SUFFIX, *name);
+    file->index_fd = open(index_name, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (file->index_fd < 0)
+    {
+	fprintf(stderr, "ERROR: open %s: %s\n", index_name, strerror(errno));
+	exit(1);
+    }
+    free(index_name);
+
+    file->frame_count = 0;
+    file->end_cut = 0;
+    file->size = 0;
+    file->length = 0;
+    file->allocated = 0;
+    file->synced = 0;
+    file->pending = 0;
+    file->closing = false;
+    return file;
+}
+
+static bool read_fully(int sock, uint8_t * buf, size_t * buf_pos,
+		       size_t wanted_size, ssize_t * read_size)
+{
+    while (*buf_pos != wanted_size)
+    {
+	*read_size = read(sock, buf + *buf_pos, wanted_size - *buf_pos);
+	if (*read_size <= 0)
+	    return false;
+	*buf_pos += *read_size;
+    }
+    return true;
+}
+
+// Append a frame's record to the index, preceded by the header if
+// it is the first frame
+static void index_frame(struct output_file * file, uint8_t cut,
+			const uint8_t * frame, size_t frame_size)
+{
+    // mktime() is relatively slow and the record time only changes
+    // once a second, so remember the last conversion
+    static struct tm last_tm;
+    static time_t last_time;
+
+    uint8_t buffer[FRAME_INDEX_HEADER_SIZE + FRAME_INDEX_RECORD_SIZE];
+    size_t size = 0;
+    struct frame_index_record record;
+    unsigned serial_num;
+    struct tm tm;
+
+    if (file->frame_count == 0)
+    {
+	frame_index_encode_header(buffer, frame_size);
+	size = FRAME_INDEX_HEADER_SIZE;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.frame_num = file->frame_count++;
+    record.cut = cut;
+    if (dv_buffer_get_timecode(frame, &serial_num))
+    {
+	record.serial_num = serial_num;
+	record.flags |= FRAME_INDEX_FLAG_SERIAL;
+    }
+    memset(&tm, 0, sizeof(tm));
+    if (dv_buffer_get_record_time(frame, &tm))
+    {
+	if (memcmp(&tm, &last_tm, sizeof(tm)) != 0)
+	{
+	    last_tm = tm;
+	    tm.tm_isdst = -1;
+	    last_time = mktime(&tm);
+	}
+	record.record_time = last_time;
+	record.flags |= FRAME_INDEX_FLAG_TIME;
+    }
+
+    frame_index_encode_record(buffer + size, &record);
+    write_index(file, buffer, size + FRAME_INDEX_RECORD_SIZE);
+}
+
+// Preallocate space up to the given offset, so that files are laid
+// out contiguously on disk
+static void reserve_space(struct output_file * file, off_t end)
+{
+    while (file->allocated >= 0 && file->allocated < end)
+    {
+	if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->allocated,
+		      DIRECT_EXTENT_SIZE) < 0)
+	{
+	    perror("WARN: fallocate");
+	    file->allocated = -1;
+	    break;
+	}
+	file->allocated += DIRECT_EXTENT_SIZE;
+    }
+}
+
+// Start writing the first size bytes of a buffer at the end of a file
+static void submit_buffer(const struct frame_writer * writer,
+			  struct output_file * file,
+			  struct frame_buffer * buf, size_t size)
+{
+    if (direct_io)
+	reserve_space(file, file->size + size);
+    buf->file = file;
+    buf->offset = file->size;
+    buf->iov.iov_base = buf->data;
+    buf->iov.iov_len = size;
+    file->size += size;
+    writer->submit(buf);
+}
+
+// Write out any partial batch and close a file
+static void finish_file(const struct frame_writer * writer,
+			struct output_file * file, struct frame_buffer ** frame,
+			uint8_t cut)
+{
+    struct frame_buffer * buf = *frame;
+
+    file->end_cut = cut;
+
+    if (buf && buf->fill)
+    {
+	// Pad to a whole block; release_file() truncates the padding
+	size_t size = (buf->fill + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+	memset(buf->data + buf->fill, 0, size - buf->fill);
+	submit_buffer(writer, file, buf, size);
+	*frame = NULL;
+    }
+
+    writer->close_file(file);
+}
+
 static void transfer_frames(struct transfer_params * params)
 {
-    static uint8_t buf[SINK_FRAME_HEADER_SIZE + DIF_MAX_FRAME_SIZE];
+    const struct frame_writer * writer = init_writer();
     const struct dv_system * system;
 
-    int file = -1;
+    struct output_file * file = NULL;
+    struct frame_buffer * frame = NULL;
     char * name;
-    ssize_t read_size;
+    ssize_t read_size = 0;
 
     for (;;)
     {
-	size_t wanted_size = SINK_FRAME_HEADER_SIZE;
+	uint8_t header[SINK_FRAME_HEADER_SIZE];
 	size_t buf_pos = 0;
-	do
-	{
-	    read_size = read(params->sock, buf + buf_pos,
-			     wanted_size - buf_pos);
-	    if (read_size <= 0)
-		goto read_failed;
-	    buf_pos += read_size;
-	}
-	while (buf_pos != wanted_size);
+
+	if (!read_fully(params->sock, header, &buf_pos, SINK_FRAME_HEADER_SIZE,
+			&read_size))
+	    goto read_failed;
 
 	// Open/close files as necessary
-	if (buf[SINK_FRAME_CUT_FLAG_POS] || file < 0)
+	if (header[SINK_FRAME_CUT_FLAG_POS] || !file)
 	{
-	    bool starting = file < 0;
+	    bool starting = !file;
 
-	    if (file >= 0)
+	    if (file)
 	    {
-		close(file);
-		file = -1;
+		finish_file(writer, file, &frame,
+			    header[SINK_FRAME_CUT_FLAG_POS]);
+		file = NULL;
 	    }
 
 	    // Check for stop indicator
-	    if (buf[SINK_FRAME_CUT_FLAG_POS] == SINK_FRAME_CUT_STOP)
+	    if (header[SINK_FRAME_CUT_FLAG_POS] == SINK_FRAME_CUT_STOP)
 	    {
 		printf("INFO: Stopped recording\n");
 		fflush(stdout);
 		continue;
 	    }
 
-	    file = create_file(output_name_format, &name);
+	    file = open_output_file(output_name_format, &name);
 	    if (starting)
 		printf("INFO: Started recording\n");
 	    printf("INFO: Created file %s\n", name);
 	    fflush(stdout);
 	}
 
-	wanted_size = SINK_FRAME_HEADER_SIZE + DIF_SEQUENCE_SIZE;
-	do
+	if (!frame)
 	{
-	    read_size = read(params->sock, buf + buf_pos,
-			     wanted_size - buf_pos);
-	    if (read_size <= 0)
-		goto read_failed;
-	    buf_pos += read_size;
+	    frame = writer->get_buffer();
+	    frame->fill = 0;
 	}
-	while (buf_pos != wanted_size);
 
-	system = dv_buffer_system(buf + SINK_FRAME_HEADER_SIZE);
-	wanted_size = SINK_FRAME_HEADER_SIZE + system->size;
-	do
+	// Read the frame into the buffer, after any earlier frames in
+	// the same batch
+	uint8_t * buf = frame->data + frame->fill;
+	buf_pos = 0;
+
+	if (!read_fully(params->sock, buf, &buf_pos, DIF_SEQUENCE_SIZE,
+			&read_size))
+	    goto read_failed;
+
+	system = dv_buffer_system(buf);
+	if (!read_fully(params->sock, buf, &buf_pos, system->size,
+			&read_size))
+	    goto read_failed;
+
+	index_frame(file, header[SINK_FRAME_CUT_FLAG_POS], buf, system->size);
+	frame->fill += system->size;
+	file->length += system->size;
+
+	if (!direct_io)
 	{
-	    read_size = read(params->sock, buf + buf_pos,
-			     wanted_size - buf_pos);
-	    if (read_size <= 0)
-		goto read_failed;
-	    buf_pos += read_size;
+	    submit_buffer(writer, file, frame, frame->fill);
+	    frame = NULL;
 	}
-	while (buf_pos != wanted_size);
-
-	if (write_retry(file, buf + SINK_FRAME_HEADER_SIZE, system->size)
-	    != (ssize_t)system->size)
+	else if (frame->fill >= DIRECT_BATCH_SIZE)
 	{
-	    perror("ERROR: write");
-	    exit(1);
+	    // Write whole blocks and carry the rest over to the next batch
+	    struct frame_buffer * next = writer->get_buffer();
+	    size_t size = frame->fill & ~(size_t)(DIRECT_ALIGN - 1);
+
+	    next->fill = frame->fill - size;
+	    memcpy(next->data, frame->data + size, next->fill);
+	    submit_buffer(writer, file, frame, size);
+	    frame = next;
 	}
     }
 
@@ -249,8 +934,9 @@ read_failed:
 	exit(1);
     }
 
-    if (file >= 0)
-	close(file);
+    if (file)
+	finish_file(writer, file, &frame, 0);
+    writer->finish();
 }
 
 int main(int argc, char ** argv)
@@ -261,7 +947,7 @@ int main(int argc, char ** argv)
     // Parse arguments.
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "h:p:", options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "h:p:o:d", options, NULL)) != -1)
     {
 	switch (opt)
 	{
@@ -273,6 +959,13 @@ int main(int argc, char ** argv)
 	    free(mixer_port);
 	    mixer_port = strdup(optarg);
 	    break;
+	case 'o':
+	    free(mixer_output);
+	    mixer_output = strdup(optarg);
+	    break;
+	case 'd':
+	    direct_io = true;
+	    break;
 	case 'H': // --help
 	    usage(argv[0]);
 	    return 0;
@@ -312,11 +1005,7 @@ int main(int argc, char ** argv)
     fflush(stdout);
     params.sock = create_connected_socket(mixer_host, mixer_port);
     assert(params.sock >= 0); // create_connected_socket() should handle errors
-    if (write(params.sock, GREETING_REC_SINK, GREETING_SIZE) != GREETING_SIZE)
-    {
-	perror("ERROR: write");
-	exit(1);
-    }
+    send_sink_greeting(params.sock, GREETING_REC_SINK, mixer_output);
     printf("INFO: Connected.\n");
 
     transfer_frames(&params);
@@ -5,20 +5,28 @@
 /* Source that reads a DIF ("raw DV") file */
 
 #include <assert.h>
+#include <dirent.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <netinet/in.h>
 
 #include "config.h"
 #include "dif.h"
+#include "frame_index.h"
 #include "frame_timer.h"
 #include "protocol.h"
 #include "socket.h"
@@ -27,6 +35,7 @@ static struct option options[] = {
     {"host",   1, NULL, 'h'},
     {"port",   1, NULL, 'p'},
     {"loop",   0, NULL, 'l'},
+    {"playlist", 1, NULL, 'P'},
     {"help",   0, NULL, 'H'},
     {NULL,     0, NULL, 0}
 };
@@ -52,7 +61,7 @@ static void usage(const char * progname)
 {
     fprintf(stderr,
 	    "\
-Usage: %s [-h HOST] [-p PORT] [-l] FILE\n",
+Usage: %s [-h HOST] [-p PORT] [-l] [-P PLAYLIST] [FILE|DIRECTORY]...\n",
 	    progname);
 }
 
@@ -84,14 +93,46 @@ static ssize_t read_retry(int fd, void * buf, size_t count)
     return total;
 }
 
-static void transfer_frames(struct transfer_params * params)
+/* Frame pacing, reset whenever the video system changes */
+struct frame_pacer {
+    const struct dv_system * system;
+    uint64_t                 timestamp;
+    unsigned int             interval;
+};
+
+static void pacer_start_frame(struct frame_pacer * pacer,
+			      const struct dv_system * system)
 {
-    const struct dv_system * last_system = 0, * system;
-    static uint8_t buf[DIF_MAX_FRAME_SIZE];
-    uint64_t frame_timestamp = 0;
-    unsigned int frame_interval = 0;
+    if (system != pacer->system)
+    {
+	pacer->system = system;
+	pacer->timestamp = frame_timer_get();
+	pacer->interval = (1000000000 / system->frame_rate_numer
+			   * system->frame_rate_denom);
+    }
+}
 
-    frame_timer_init();
+static void pacer_end_frame(struct frame_pacer * pacer)
+{
+    pacer->timestamp += pacer->interval;
+    frame_timer_wait(pacer->timestamp);
+}
+
+static void fail_incomplete_frame(ssize_t size)
+{
+    if (size < 0)
+	perror("ERROR: read");
+    else
+	fputs("ERROR: Failed to read complete frame\n", stderr);
+    exit(1);
+}
+
+/* Transfer frames from a file that can't be mapped, such as a pipe */
+static void transfer_frames_read(struct transfer_params * params)
+{
+    const struct dv_system * system;
+    static uint8_t buf[DIF_MAX_FRAME_SIZE];
+    struct frame_pacer pacer = { 0, 0, 0 };
 
     for (;;)
     {
@@ -107,44 +148,536 @@ static void transfer_frames(struct transfer_params * params)
 	    exit(1);
 	}
 	if (size != (ssize_t)DIF_SEQUENCE_SIZE)
+	    fail_incomplete_frame(size);
+
+	system = dv_buffer_system(buf);
+	pacer_start_frame(&pacer, system);
+
+	size = read_retry(params->file, buf + DIF_SEQUENCE_SIZE,
+			  system->size - DIF_SEQUENCE_SIZE);
+	if (size != (ssize_t)(system->size - DIF_SEQUENCE_SIZE))
+	    fail_incomplete_frame(size);
+	if (write(params->sock, buf, system->size) != (ssize_t)system->size)
 	{
-	    if (size < 0)
-		perror("ERROR: read");
-	    else
-		fputs("ERROR: Failed to read complete frame\n", stderr);
+	    perror("ERROR: write");
 	    exit(1);
 	}
 
-	system = dv_buffer_system(buf);
+	pacer_end_frame(&pacer);
+    }
+}
+
+/*
+ * A playlist is a sequence of regular files, each played from an in
+ * point to an out point.  Each file is opened and mapped into memory
+ * by a prefetcher thread, which also keeps the next PREFETCH_SIZE
+ * bytes to be played (wrapping around to the start when looping) in
+ * the page cache.  Frames are then sent with sendfile(), so opening
+ * files and waiting for a slow disk or network filesystem delay the
+ * prefetcher rather than the paced output, and one file follows
+ * another without a gap.  Positions are counted as bytes played since
+ * the start, so that they keep increasing across files and loops.
+ */
+
+#define PREFETCH_SIZE (16 * 1024 * 1024) /* about 4 seconds */
+#define PREFETCH_CHUNK (1024 * 1024)
+
+/* In and out points are given as frame numbers, or as times of day
+ * which are looked up in the file's frame index. */
+struct playlist_point {
+    enum { point_none, point_frame, point_time } type;
+    unsigned       value; /* frame number or seconds since midnight */
+};
+
+struct playlist_entry {
+    char *                name;
+    struct playlist_point in, out;
 
-	/* (Re)set the timer according to this frame's video system. */
-	if (system != last_system)
+    /* Set by the prefetcher before the entry is played */
+    bool                  ready;
+    int                   file;
+    const uint8_t *       map;
+    size_t                map_size;
+    size_t                start, end; /* range of the file to play */
+};
+
+static struct playlist_entry * playlist;
+static unsigned playlist_len, playlist_capacity;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            loop;
+    bool            stopping;
+    uint64_t        sent_pos;	  /* bytes played so far */
+    uint64_t        prefetch_pos; /* bytes prefetched so far */
+} prefetch = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static void add_entry(char * name, const struct playlist_point * in,
+		      const struct playlist_point * out)
+{
+    if (playlist_len == playlist_capacity)
+    {
+	playlist_capacity = playlist_capacity ? 2 * playlist_capacity : 16;
+	playlist = realloc(playlist, playlist_capacity * sizeof(*playlist));
+	if (!playlist)
 	{
-	    last_system = system;
-	    frame_timestamp = frame_timer_get();
-	    frame_interval = (1000000000 / system->frame_rate_numer
-			      * system->frame_rate_denom);
+	    perror("ERROR: realloc");
+	    exit(1);
 	}
+    }
 
-	size = read_retry(params->file, buf + DIF_SEQUENCE_SIZE,
-			  system->size - DIF_SEQUENCE_SIZE);
-	if (size != (ssize_t)(system->size - DIF_SEQUENCE_SIZE))
+    struct playlist_entry * entry = &playlist[playlist_len++];
+    memset(entry, 0, sizeof(*entry));
+    entry->name = name;
+    entry->in = *in;
+    entry->out = *out;
+    entry->file = -1;
+}
+
+static int is_dv_name(const struct dirent * ent)
+{
+    size_t len = strlen(ent->d_name);
+    return len > 3 && strcmp(ent->d_name + len - 3, ".dv") == 0;
+}
+
+/* Add a file, or all the DV files in a directory in name order */
+static void add_path(const char * path)
+{
+    static const struct playlist_point none = { point_none, 0 };
+    struct stat st;
+    struct dirent ** names;
+    int count, i;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+	add_entry(strdup(path), &none, &none);
+	return;
+    }
+
+    count = scandir(path, &names, is_dv_name, alphasort);
+    if (count < 0)
+    {
+	fprintf(stderr, "ERROR: scandir %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    if (count == 0)
+	fprintf(stderr, "WARN: No DV files in %s\n", path);
+    for (i = 0; i != count; ++i)
+    {
+	char * name = malloc(strlen(path) + 1 + strlen(names[i]->d_name) + 1);
+	if (!name)
 	{
-	    if (size < 0)
-		perror("ERROR: read");
-	    else
-		fputs("ERROR: Failed to read complete frame\n", stderr);
+	    perror("ERROR: malloc");
 	    exit(1);
 	}
-	if (write(params->sock, buf, system->size) != (ssize_t)system->size)
+	sprintf(name, "%s/%s", path, names[i]->d_name);
+	add_entry(name, &none, &none);
+	free(names[i]);
+    }
+    free(names);
+}
+
+static bool parse_point(const char * text, struct playlist_point * point)
+{
+    unsigned hour, min, sec;
+    char extra;
+
+    if (strcmp(text, "-") == 0)
+    {
+	point->type = point_none;
+	return true;
+    }
+    if (sscanf(text, "%u:%u:%u%c", &hour, &min, &sec, &extra) == 3)
+    {
+	point->type = point_time;
+	point->value = (hour * 60 + min) * 60 + sec;
+	return hour < 24 && min < 60 && sec < 60;
+    }
+    if (sscanf(text, "%u%c", &point->value, &extra) == 1)
+    {
+	point->type = point_frame;
+	return true;
+    }
+    return false;
+}
+
+/*
+ * Read a playlist file.  Each line names a file, optionally followed
+ * by an in point and an out point, separated by white space.  An out
+ * point is the first frame not to be played.  Relative names are
+ * relative to the directory containing the playlist.  Empty lines
+ * and lines beginning with '#' are ignored.
+ */
+static void read_playlist(const char * list_name)
+{
+    FILE * list = fopen(list_name, "r");
+    const char * base_end = strrchr(list_name, '/');
+    size_t base_len = base_end ? base_end + 1 - list_name : 0;
+    char line[1024];
+    unsigned line_num = 0;
+
+    if (!list)
+    {
+	fprintf(stderr, "ERROR: open %s: %s\n", list_name, strerror(errno));
+	exit(1);
+    }
+
+    while (fgets(line, sizeof(line), list))
+    {
+	struct playlist_point in = { point_none, 0 }, out = { point_none, 0 };
+	char * fields[4];
+	unsigned n_fields = 0;
+	char * token;
+
+	++line_num;
+	for (token = strtok(line, " \t\r\n");
+	     token && n_fields != 4;
+	     token = strtok(NULL, " \t\r\n"))
+	    fields[n_fields++] = token;
+	if (n_fields == 0 || fields[0][0] == '#')
+	    continue;
+
+	if (n_fields > 3
+	    || (n_fields > 1 && !parse_point(fields[1], &in))
+	    || (n_fields > 2 && !parse_point(fields[2], &out)))
+	{
+	    fprintf(stderr, "ERROR: %s:%u: invalid playlist entry\n",
+		    list_name, line_num);
+	    exit(1);
+	}
+
+	char * name = malloc(base_len + strlen(fields[0]) + 1);
+	if (!name)
+	{
+	    perror("ERROR: malloc");
+	    exit(1);
+	}
+	if (fields[0][0] == '/')
+	    strcpy(name, fields[0]);
+	else
+	    sprintf(name, "%.*s%s", (int)base_len, list_name, fields[0]);
+	add_entry(name, &in, &out);
+    }
+
+    fclose(list);
+}
+
+/* Find the frame number for a point in a file of frame_count frames */
+static unsigned resolve_point(const struct playlist_entry * entry,
+			      const struct playlist_point * point,
+			      const struct frame_index * index,
+			      unsigned frame_count, unsigned def)
+{
+    unsigned frame_num;
+
+    switch (point->type)
+    {
+    case point_frame:
+	return point->value < frame_count ? point->value : frame_count;
+
+    case point_time:
+	/* Find the first frame recorded at or after the given time */
+	if (!index)
+	{
+	    fprintf(stderr,
+		    "WARN: %s has no frame index; ignoring time %u:%02u:%02u\n",
+		    entry->name, point->value / 3600, point->value / 60 % 60,
+		    point->value % 60);
+	    return def;
+	}
+	for (frame_num = 0; frame_num != frame_count; ++frame_num)
+	{
+	    const struct frame_index_record * record =
+		&index->records[frame_num];
+	    if (record->flags & FRAME_INDEX_FLAG_TIME)
+	    {
+		time_t time = record->record_time;
+		struct tm tm;
+		localtime_r(&time, &tm);
+		if ((unsigned)((tm.tm_hour * 60 + tm.tm_min) * 60 + tm.tm_sec)
+		    >= point->value)
+		    break;
+	    }
+	}
+	return frame_num;
+
+    default:
+	return def;
+    }
+}
+
+/*
+ * Open and map a playlist entry and work out the range to play.  If
+ * it can't be played, warn and leave the range empty so that it will
+ * be skipped.
+ */
+static void open_entry(struct playlist_entry * entry)
+{
+    struct frame_index index;
+    bool have_index;
+    struct stat st;
+    void * map;
+    size_t frame_size;
+    unsigned frame_count, in_frame, out_frame;
+
+    entry->file = open(entry->name, O_RDONLY, 0);
+    if (entry->file < 0 || fstat(entry->file, &st) < 0)
+    {
+	fprintf(stderr, "WARN: open %s: %s\n", entry->name, strerror(errno));
+	return;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size < DIF_SEQUENCE_SIZE)
+    {
+	fprintf(stderr, "WARN: %s is not a regular DV file\n", entry->name);
+	return;
+    }
+    if ((off_t)(size_t)st.st_size != st.st_size)
+    {
+	fprintf(stderr, "WARN: %s is too large to map\n", entry->name);
+	return;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, entry->file, 0);
+    if (map == MAP_FAILED)
+    {
+	fprintf(stderr, "WARN: mmap %s: %s\n", entry->name, strerror(errno));
+	return;
+    }
+    entry->map = map;
+    entry->map_size = st.st_size;
+    if (memcmp(entry->map, DIF_SIGNATURE, DIF_SIGNATURE_SIZE) != 0)
+    {
+	fprintf(stderr, "WARN: %s is not a DV file\n", entry->name);
+	return;
+    }
+
+    /* Use the index if there is one.  After a crash it may cover more
+     * or fewer frames than the file. */
+    have_index = frame_index_read(entry->name, &index);
+    frame_size = have_index ? index.frame_size
+	: dv_buffer_system(entry->map)->size;
+    frame_count = entry->map_size / frame_size;
+    if (have_index && index.frame_count < frame_count)
+	frame_count = index.frame_count;
+
+    in_frame = resolve_point(entry, &entry->in, have_index ? &index : NULL,
+			     frame_count, 0);
+    out_frame = resolve_point(entry, &entry->out, have_index ? &index : NULL,
+			      frame_count, frame_count);
+    if (have_index)
+	frame_index_free(&index);
+    if (out_frame < in_frame)
+	out_frame = in_frame;
+
+    entry->start = (size_t)in_frame * frame_size;
+    entry->end = (size_t)out_frame * frame_size;
+
+    /* Sequential access lets the kernel drop pages soon after they
+     * are sent, but a looping clip should stay in memory. */
+    if (!prefetch.loop)
+	madvise(map, entry->map_size, MADV_SEQUENTIAL);
+}
+
+static void close_entry(struct playlist_entry * entry)
+{
+    if (entry->map)
+	munmap((void *)entry->map, entry->map_size);
+    if (entry->file >= 0)
+	close(entry->file);
+}
+
+static void * run_prefetcher(void * unused)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned index = 0;  /* entry being prefetched */
+    size_t offset = 0;   /* offset within the range to play */
+    uint64_t pass_pos = 0; /* prefetch_pos at the start of the playlist */
+    volatile uint8_t sink;
+
+    (void)unused;
+
+    pthread_mutex_lock(&prefetch.mutex);
+
+    for (;;)
+    {
+	while (!prefetch.stopping
+	       && (prefetch.prefetch_pos >= prefetch.sent_pos + PREFETCH_SIZE
+		   || index == playlist_len))
+	    pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+	if (prefetch.stopping)
+	    break;
+
+	struct playlist_entry * entry = &playlist[index];
+
+	if (!entry->ready)
+	{
+	    pthread_mutex_unlock(&prefetch.mutex);
+	    open_entry(entry);
+	    pthread_mutex_lock(&prefetch.mutex);
+	    entry->ready = true;
+	    pthread_cond_broadcast(&prefetch.cond);
+	    continue;
+	}
+
+	if (offset == entry->end - entry->start)
+	{
+	    offset = 0;
+	    /* Loop unless a whole pass found nothing to play, in which
+	     * case wait for the sender to give up */
+	    if (++index == playlist_len && prefetch.loop
+		&& prefetch.prefetch_pos != pass_pos)
+	    {
+		index = 0;
+		pass_pos = prefetch.prefetch_pos;
+	    }
+	    continue;
+	}
+
+	size_t start = entry->start + offset;
+	size_t len = entry->end - start;
+	if (len > PREFETCH_CHUNK)
+	    len = PREFETCH_CHUNK;
+
+	pthread_mutex_unlock(&prefetch.mutex);
+
+	/* Start reading the whole chunk, then wait for it by touching
+	 * each page. */
+	size_t page_start = start & ~(page_size - 1);
+	size_t pos;
+	madvise((void *)(entry->map + page_start), start + len - page_start,
+		MADV_WILLNEED);
+	for (pos = page_start; pos < start + len; pos += page_size)
+	    sink = entry->map[pos];
+	(void)sink;
+
+	pthread_mutex_lock(&prefetch.mutex);
+	offset += len;
+	prefetch.prefetch_pos += len;
+    }
+
+    pthread_mutex_unlock(&prefetch.mutex);
+    return NULL;
+}
+
+static void send_mapped(int sock, const struct playlist_entry * entry,
+			off_t offset, size_t size)
+{
+    static bool use_sendfile = true;
+    ssize_t chunk;
+
+    while (size)
+    {
+	if (use_sendfile)
+	{
+	    chunk = sendfile(sock, entry->file, &offset, size);
+	    if (chunk < 0 && (errno == EINVAL || errno == ENOSYS))
+	    {
+		/* Not supported for this socket; copy from the mapping */
+		use_sendfile = false;
+		continue;
+	    }
+	}
+	else
+	{
+	    chunk = write(sock, entry->map + offset, size);
+	    if (chunk > 0)
+		offset += chunk;
+	}
+	if (chunk <= 0)
 	{
 	    perror("ERROR: write");
 	    exit(1);
 	}
+	size -= chunk;
+    }
+}
+
+static void note_sent(size_t size)
+{
+    pthread_mutex_lock(&prefetch.mutex);
+    prefetch.sent_pos += size;
+    pthread_cond_signal(&prefetch.cond);
+    pthread_mutex_unlock(&prefetch.mutex);
+}
+
+static void transfer_playlist(struct transfer_params * params)
+{
+    const struct dv_system * system;
+    struct frame_pacer pacer = { 0, 0, 0 };
+    pthread_t prefetch_thread;
+    unsigned index = 0;
+    bool played = false;
+    int err;
+
+    err = pthread_create(&prefetch_thread, NULL, run_prefetcher, NULL);
+    if (err)
+    {
+	errno = err;
+	perror("ERROR: pthread_create");
+	exit(1);
+    }
+
+    for (;;)
+    {
+	if (index == playlist_len)
+	{
+	    /* End of playlist; exit or loop */
+	    if (!params->opt_loop)
+		break;
+	    if (!played)
+	    {
+		fputs("ERROR: Nothing to play\n", stderr);
+		exit(1);
+	    }
+	    index = 0;
+	    played = false;
+	}
+
+	struct playlist_entry * entry = &playlist[index++];
+	size_t pos;
+
+	pthread_mutex_lock(&prefetch.mutex);
+	while (!entry->ready)
+	    pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+	pthread_mutex_unlock(&prefetch.mutex);
+
+	if (playlist_len > 1 && entry->end != entry->start)
+	{
+	    printf("INFO: Playing %s\n", entry->name);
+	    fflush(stdout);
+	}
 
-	frame_timestamp += frame_interval;
-	frame_timer_wait(frame_timestamp);
+	for (pos = entry->start;
+	     entry->end - pos >= DIF_SEQUENCE_SIZE;
+	     pos += system->size)
+	{
+	    system = dv_buffer_system(entry->map + pos);
+	    if (entry->end - pos < system->size)
+		break;
+	    pacer_start_frame(&pacer, system);
+	    send_mapped(params->sock, entry, pos, system->size);
+	    note_sent(system->size);
+	    played = true;
+	    pacer_end_frame(&pacer);
+	}
+
+	/* Count any incomplete frame at the end as played, to keep the
+	 * prefetcher in step */
+	if (pos != entry->end)
+	    note_sent(entry->end - pos);
     }
+
+    pthread_mutex_lock(&prefetch.mutex);
+    prefetch.stopping = true;
+    pthread_cond_signal(&prefetch.cond);
+    pthread_mutex_unlock(&prefetch.mutex);
+    pthread_join(prefetch_thread, NULL);
+
+    for (index = 0; index != playlist_len; ++index)
+	close_entry(&playlist[index]);
 }
 
 static int is_dv_file(int fd)
@@ -170,11 +703,12 @@ int main(int argc, char ** argv)
 
     struct transfer_params params;
     params.opt_loop = false;
+    const char * playlist_name = NULL;
 
     /* Parse arguments. */
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "h:p:l", options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "h:p:lP:", options, NULL)) != -1)
     {
 	switch (opt)
 	{
@@ -189,6 +723,9 @@ int main(int argc, char ** argv)
 	case 'l':
 	    params.opt_loop = true;
 	    break;
+	case 'P':
+	    playlist_name = optarg;
+	    break;
 	case 'H': /* --help */
 	    usage(argv[0]);
 	    return 0;
@@ -205,36 +742,75 @@ int main(int argc, char ** argv)
 	return 2;
     }
 
-    if (optind != argc - 1)
+    if (optind == argc && !playlist_name)
     {
-	if (optind == argc)
-	{
-	    fprintf(stderr, "%s: missing filename\n",
-		    argv[0]);
-	}
-	else
-	{
-	    fprintf(stderr, "%s: excess argument \"%s\"\n",
-		    argv[0], argv[optind + 1]);
-	}
+	fprintf(stderr, "%s: missing filename\n",
+		argv[0]);
 	usage(argv[0]);
 	return 2;
     }
 
-    const char * filename = argv[optind];
+    /* Build the playlist. */
 
-    /* Prepare to read the file and connect a socket to the mixer. */
+    if (playlist_name)
+	read_playlist(playlist_name);
+    for (; optind != argc; ++optind)
+	add_path(argv[optind]);
+    if (playlist_len == 0)
+    {
+	fprintf(stderr, "%s: nothing to play\n", argv[0]);
+	return 2;
+    }
+
+    /* Prepare to read the file(s) and connect a socket to the mixer.
+     * A single file that can't be mapped, such as a pipe or a file
+     * too large for the address space, is read instead. */
 
-    printf("INFO: Reading from %s\n", filename);
-    params.file = open(filename, O_RDONLY, 0);
-    if (params.file < 0)
+    params.file = -1;
+    prefetch.loop = params.opt_loop;
+    if (playlist_len == 1)
     {
-	perror("ERROR: open");
-	return 1;
+	const char * filename = playlist[0].name;
+	struct stat st;
+
+	printf("INFO: Reading from %s\n", filename);
+	params.file = open(filename, O_RDONLY, 0);
+	if (params.file < 0)
+	{
+	    perror("ERROR: open");
+	    return 1;
+	}
+	if (!is_dv_file(params.file)) {
+	    fprintf(stderr, "ERROR: %s is not a DV file\n", filename);
+	    return 1;
+	}
+	if (fstat(params.file, &st) == 0 && S_ISREG(st.st_mode))
+	{
+	    struct playlist_entry * entry = &playlist[0];
+
+	    /* The prefetcher won't open the entry again */
+	    open_entry(entry);
+	    entry->ready = true;
+	    if (entry->map)
+	    {
+		close(params.file);
+		params.file = -1;
+	    }
+	    else
+	    {
+		if (entry->in.type != point_none
+		    || entry->out.type != point_none)
+		    fprintf(stderr,
+			    "WARN: Ignoring in and out points for %s\n",
+			    filename);
+		printf("INFO: Reading %s without mapping it\n", filename);
+		close_entry(entry);
+	    }
+	}
     }
-    if (!is_dv_file(params.file)) {
-        fprintf(stderr, "ERROR: %s is not a DV file\n", filename);
-	return 1;
+    else
+    {
+	printf("INFO: Reading from %u files\n", playlist_len);
     }
     printf("INFO: Connecting to %s:%s\n", mixer_host, mixer_port);
     params.sock = create_connected_socket(mixer_host, mixer_port);
@@ -246,10 +822,18 @@ int main(int argc, char ** argv)
     }
     printf("INFO: Connected.\n");
 
-    transfer_frames(&params);
+    frame_timer_init();
+    if (params.file >= 0)
+    {
+	transfer_frames_read(&params);
+	close(params.file);
+    }
+    else
+    {
+	transfer_playlist(&params);
+    }
 
     close(params.sock);
-    close(params.file);
 
     return 0;
 }
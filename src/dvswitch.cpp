@@ -3,12 +3,15 @@
 
 // Top level of DVswitch
 
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
 #include <iostream>
 #include <ostream>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <getopt.h>
 
@@ -22,6 +25,8 @@
 
 #include "config.h"
 #include "connector.hpp"
+#include "frame.h"
+#include "frame_pool.hpp"
 #include "mixer.hpp"
 #include "mixer_window.hpp"
 #include "server.hpp"
@@ -37,6 +42,13 @@ namespace
 
     std::string mixer_host;
     std::string mixer_port;
+    bool mixer_zero_copy = false;
+    int mixer_clock_priority = 0;
+    long mixer_dv_frames = 0;
+    long mixer_raw_frames = 0;
+    const dv_system * mixer_raw_frame_system = &dv_system_625_50;
+    unsigned mixer_frame_flags = 0;
+    std::vector<std::string> mixer_outputs;
 
     extern "C"
     {
@@ -46,7 +58,162 @@ namespace
 		mixer_host = value;
 	    else if (strcmp(name, "MIXER_PORT") == 0)
 		mixer_port = value;
+	    else if (strcmp(name, "MIXER_ZERO_COPY") == 0)
+		mixer_zero_copy = strcmp(value, "yes") == 0;
+	    else if (strcmp(name, "MIXER_CLOCK_PRIORITY") == 0)
+		mixer_clock_priority = std::atoi(value);
+	    else if (strcmp(name, "MIXER_DV_FRAMES") == 0)
+		mixer_dv_frames = std::atol(value);
+	    else if (strcmp(name, "MIXER_RAW_FRAMES") == 0)
+		mixer_raw_frames = std::atol(value);
+	    else if (strcmp(name, "MIXER_RAW_FRAME_SYSTEM") == 0)
+		mixer_raw_frame_system = (strcmp(value, "525") == 0
+					  ? &dv_system_525_60
+					  : &dv_system_625_50);
+	    else if (strcmp(name, "MIXER_FRAME_HUGE_PAGES") == 0)
+	    {
+		if (strcmp(value, "yes") == 0)
+		    mixer_frame_flags |= frame_pool_huge_pages;
+		else
+		    mixer_frame_flags &= ~frame_pool_huge_pages;
+	    }
+	    else if (strcmp(name, "MIXER_OUTPUT") == 0)
+		mixer_outputs.push_back(value);
+	    else if (strcmp(name, "MIXER_FRAME_LOCK") == 0)
+	    {
+		if (strcmp(value, "yes") == 0)
+		    mixer_frame_flags |= frame_pool_lock;
+		else
+		    mixer_frame_flags &= ~frame_pool_lock;
+	    }
+	}
+    }
+
+    unsigned reserve_raw_frames(std::size_t count, unsigned flags)
+    {
+	return reserve_raw_frame_pool(mixer_raw_frame_system, count, flags);
+    }
+
+    void reserve_frames(const char * name, long count, std::size_t size,
+			unsigned (*reserve)(std::size_t, unsigned))
+    {
+	if (count <= 0)
+	    return;
+
+	unsigned flags = reserve(count, mixer_frame_flags);
+	std::cout << "INFO: Reserved " << count << " " << name
+		  << " frame buffers (" << ((count * size) >> 20) << " MiB)\n";
+	if ((mixer_frame_flags & frame_pool_huge_pages)
+	    && !(flags & frame_pool_huge_pages))
+	    std::cerr << "WARN: Could not use huge pages for " << name
+		      << " frame buffers\n";
+	if ((mixer_frame_flags & frame_pool_lock)
+	    && !(flags & frame_pool_lock))
+	    std::cerr << "WARN: Could not lock " << name
+		      << " frame buffers into memory\n";
+    }
+
+    // Parse a source number, counting from 1 as in the user interface
+    mixer::source_id parse_source_number(const std::string & output,
+					 const std::string & number)
+    {
+	char * end;
+	long value = std::strtol(number.c_str(), &end, 10);
+	if (number.empty() || *end || value < 1)
+	    throw std::invalid_argument("invalid source number \"" + number
+					+ "\" for output " + output);
+	return value - 1;
+    }
+
+    // Parse a picture-in-picture region given as WIDTHxHEIGHT+LEFT+TOP
+    rectangle parse_region(const std::string & output,
+			   const std::string & geometry)
+    {
+	unsigned width, height, left, top;
+	int end = -1;
+	if (std::sscanf(geometry.c_str(), "%ux%u+%u+%u%n",
+			&width, &height, &left, &top, &end) != 4
+	    || end != int(geometry.size())
+	    || width == 0 || width > FRAME_WIDTH || left > FRAME_WIDTH - width
+	    || height == 0 || height > FRAME_HEIGHT_MAX
+	    || top > FRAME_HEIGHT_MAX - height)
+	    throw std::invalid_argument("invalid region \"" + geometry
+					+ "\" for output " + output);
+	rectangle region;
+	region.left = left;
+	region.top = top;
+	region.right = left + width;
+	region.bottom = top + height;
+	return region;
+    }
+
+    // Parse a fade level, as a percentage of the secondary source
+    uint8_t parse_level(const std::string & output, const std::string & level)
+    {
+	char * end;
+	long value = std::strtol(level.c_str(), &end, 10);
+	if (level.empty() || *end || value < 0 || value > 100)
+	    throw std::invalid_argument("invalid fade level \"" + level
+					+ "\" for output " + output);
+	return (value * 255 + 50) / 100;
+    }
+
+    // Add an output described as one of:
+    //     NAME:VIDEO[:AUDIO]
+    //     NAME:PIP:PRI:SEC:WIDTHxHEIGHT+LEFT+TOP[:AUDIO]
+    //     NAME:FADE:PRI:SEC:LEVEL[:AUDIO]
+    // The audio source defaults to the (primary) video source.
+    void add_output(mixer & mixer, const std::string & desc)
+    {
+	std::vector<std::string> fields;
+	std::string::size_type pos = 0;
+	for (;;)
+	{
+	    std::string::size_type end = desc.find(':', pos);
+	    fields.push_back(desc.substr(pos, end == std::string::npos
+					 ? std::string::npos : end - pos));
+	    if (end == std::string::npos)
+		break;
+	    pos = end + 1;
 	}
+
+	const std::string & name = fields[0];
+	std::size_t video_fields;
+	if (fields.size() >= 2 && (fields[1] == "PIP" || fields[1] == "FADE"))
+	    video_fields = 4;
+	else
+	    video_fields = 1;
+	if (name.empty() || fields.size() < 1 + video_fields
+	    || fields.size() > 2 + video_fields)
+	    throw std::invalid_argument("invalid output \"" + desc + "\"");
+
+	std::tr1::shared_ptr<mixer::video_mix> video_mix;
+	mixer::source_id pri_id;
+	if (video_fields == 1)
+	{
+	    pri_id = parse_source_number(name, fields[1]);
+	    video_mix = mixer::create_video_mix_simple(pri_id);
+	}
+	else
+	{
+	    pri_id = parse_source_number(name, fields[2]);
+	    mixer::source_id sec_id = parse_source_number(name, fields[3]);
+	    if (fields[1] == "PIP")
+		video_mix = mixer::create_video_mix_pic_in_pic(
+		    pri_id, sec_id, parse_region(name, fields[4]));
+	    else
+		video_mix = mixer::create_video_mix_fade(
+		    pri_id, sec_id, false, 0, parse_level(name, fields[4]));
+	}
+	mixer::source_id audio_id =
+	    fields.size() == 2 + video_fields
+	    ? parse_source_number(name, fields[1 + video_fields])
+	    : pri_id;
+
+	mixer::output_id id = mixer.add_output(name);
+	mixer.set_output_video_mix(id, video_mix);
+	mixer.set_output_audio_source(id, audio_id);
+	std::cout << "INFO: Added output " << name << "\n";
     }
 
     void usage(const char * progname)
@@ -97,6 +264,13 @@ int main(int argc, char **argv)
 	    return 2;
 	}
 
+	// Frame buffers must be reserved before anything allocates them
+	reserve_frames("DV", mixer_dv_frames, sizeof(dv_frame),
+		       reserve_dv_frame_pool);
+	reserve_frames("raw", mixer_raw_frames,
+		       raw_frame_size(mixer_raw_frame_system),
+		       reserve_raw_frames);
+
 	// The mixer must be created before the window, since we pass
 	// a reference to the mixer into the window's constructor to
 	// allow it to adjust the mixer's controls.
@@ -107,7 +281,11 @@ int main(int argc, char **argv)
 	// now we arrange this by attaching the window to an auto_ptr.
 	std::auto_ptr<mixer_window> the_window;
 	mixer the_mixer;
-	server the_server(mixer_host, mixer_port, the_mixer);
+	if (mixer_clock_priority > 0)
+	    the_mixer.set_clock_priority(mixer_clock_priority);
+	for (std::size_t i = 0; i != mixer_outputs.size(); ++i)
+	    add_output(the_mixer, mixer_outputs[i]);
+	server the_server(mixer_host, mixer_port, the_mixer, mixer_zero_copy);
 	connector the_connector(the_mixer);
 	the_window.reset(new mixer_window(the_mixer, the_connector));
 	the_mixer.set_monitor(the_window.get());
@@ -12,33 +12,74 @@
 
 #include "frame.h"
 
-int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
+static inline size_t align_plane_size(size_t size)
 {
-    struct raw_frame * frame = context->opaque;
+    return (size + RAW_FRAME_ALIGN - 1) & ~(size_t)(RAW_FRAME_ALIGN - 1);
+}
+
+// Work out the line sizes and offsets of the planes of a raw frame.
+// Return the total size of the frame, or 0 if the pixel format is
+// not one that DV uses.
+static size_t raw_frame_layout(enum PixelFormat pix_fmt, unsigned height,
+			       int linesize[3], size_t offset[3])
+{
+    unsigned chroma_height;
 
-    if (context->pix_fmt == PIX_FMT_YUV420P)
+    linesize[0] = FRAME_LINESIZE_4;
+    if (pix_fmt == PIX_FMT_YUV420P)
     {
-	header->data[0] = frame->buffer._420.y;
-	header->linesize[0] = FRAME_LINESIZE_4;
-	header->data[1] = frame->buffer._420.cb;
-	header->linesize[1] = FRAME_LINESIZE_2;
-	header->data[2] = frame->buffer._420.cr;
-	header->linesize[2] = FRAME_LINESIZE_2;
+	linesize[1] = linesize[2] = FRAME_LINESIZE_2;
+	chroma_height = height / 2;
     }
-    else if (context->pix_fmt == PIX_FMT_YUV411P)
+    else if (pix_fmt == PIX_FMT_YUV411P)
     {
-	header->data[0] = frame->buffer._411.y;
-	header->linesize[0] = FRAME_LINESIZE_4;
-	header->data[1] = frame->buffer._411.cb;
-	header->linesize[1] = FRAME_LINESIZE_1;
-	header->data[2] = frame->buffer._411.cr;
-	header->linesize[2] = FRAME_LINESIZE_1;
+	linesize[1] = linesize[2] = FRAME_LINESIZE_1;
+	chroma_height = height;
     }
     else
+    {
+	return 0;
+    }
+
+    offset[0] = RAW_FRAME_BUFFER_OFFSET;
+    offset[1] = offset[0] + align_plane_size((size_t)linesize[0] * height);
+    offset[2] = offset[1] + align_plane_size((size_t)linesize[1] * chroma_height);
+    return offset[2] + align_plane_size((size_t)linesize[2] * chroma_height);
+}
+
+size_t raw_frame_size(const struct dv_system * system)
+{
+    int linesize[3];
+    size_t offset[3];
+    size_t size_411 = raw_frame_layout(PIX_FMT_YUV411P, system->frame_height,
+				       linesize, offset);
+
+    // 525/60 always uses 4:1:1 sampling.  625/50 uses 4:2:0 for IEC
+    // 61834 but 4:1:1 for SMPTE 314M (DVCPRO).
+    if (system == &dv_system_525_60)
+	return size_411;
+    size_t size_420 = raw_frame_layout(PIX_FMT_YUV420P, system->frame_height,
+				       linesize, offset);
+    return size_411 > size_420 ? size_411 : size_420;
+}
+
+int raw_frame_get_buffer(AVCodecContext * context, AVFrame * header)
+{
+    struct raw_frame * frame = context->opaque;
+    size_t offset[3];
+
+    if (!raw_frame_layout(context->pix_fmt, context->height,
+			  header->linesize, offset))
     {
 	assert(!"unexpected pixel format");
+	return -1;
     }
 
+    for (int plane = 0; plane != 3; ++plane)
+	header->data[plane] = (uint8_t *)frame + offset[plane];
+    header->data[3] = 0;
+    header->linesize[3] = 0;
+
     frame->pix_fmt = context->pix_fmt;
     header->type = FF_BUFFER_TYPE_USER;
 
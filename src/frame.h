@@ -24,6 +24,7 @@ extern "C" {
 struct dv_frame
 {
     uint64_t timestamp;           // set by mixer
+    uint64_t mix_timestamp;       // set by mixer
     unsigned serial_num;          // set by mixer
     bool do_record;               // set by mixer
     bool cut_before;              // set by mixer
@@ -62,28 +63,34 @@ dv_frame_get_sample_rate(const struct dv_frame * frame)
 #define FRAME_LINESIZE_2	((FRAME_WIDTH / 2 + 15) & ~15)
 #define FRAME_LINESIZE_1	((FRAME_WIDTH / 4 + 15) & ~15)
 
+// Alignment of raw frame planes, suitable for the widest SIMD loads
+#define RAW_FRAME_ALIGN		64
+
 struct raw_frame
 {
     AVFrame header;
     enum PixelFormat pix_fmt;
     enum dv_frame_aspect aspect;
-    union
-    {
-	struct
-	{
-	    uint8_t y[FRAME_LINESIZE_4 * FRAME_HEIGHT_MAX];
-	    uint8_t cb[FRAME_LINESIZE_2 * FRAME_HEIGHT_MAX / 2];
-	    uint8_t cr[FRAME_LINESIZE_2 * FRAME_HEIGHT_MAX / 2];
-	} _420;
-	struct
-	{
-	    uint8_t y[FRAME_LINESIZE_4 * FRAME_HEIGHT_MAX];
-	    uint8_t cb[FRAME_LINESIZE_1 * FRAME_HEIGHT_MAX];
-	    uint8_t cr[FRAME_LINESIZE_1 * FRAME_HEIGHT_MAX];
-	} _411;
-    } buffer __attribute__((aligned(16)));
+    // The planes follow, starting at RAW_FRAME_BUFFER_OFFSET.  They
+    // are laid out for the actual pixel format and frame height, so
+    // the buffer size depends on the video system; see
+    // raw_frame_size().
 };
 
+#define RAW_FRAME_BUFFER_OFFSET						\
+    ((sizeof(struct raw_frame) + RAW_FRAME_ALIGN - 1) & ~(RAW_FRAME_ALIGN - 1))
+
+static inline uint8_t * raw_frame_buffer(struct raw_frame * frame)
+{
+    return (uint8_t *)frame + RAW_FRAME_BUFFER_OFFSET;
+}
+
+// Get the size of a raw frame, including its header, that can hold
+// a decoded frame of the given video system in any pixel format
+// that the decoder may use for it.  The frame must be aligned to
+// RAW_FRAME_ALIGN.
+extern size_t raw_frame_size(const struct dv_system * system);
+
 // Buffer management functions for use with raw_frame.
 // These require that context->opaque is a pointer to the
 // struct raw_frame to be used.
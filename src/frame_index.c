@@ -0,0 +1,125 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Frame index files written alongside recordings
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_index.h"
+
+static void put_u32(uint8_t * p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t get_u32(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void frame_index_encode_header(uint8_t * buffer, uint32_t frame_size)
+{
+    memset(buffer, 0, FRAME_INDEX_HEADER_SIZE);
+    memcpy(buffer, FRAME_INDEX_MAGIC, 4);
+    buffer[4] = FRAME_INDEX_VERSION;
+    put_u32(buffer + 8, frame_size);
+}
+
+bool frame_index_decode_header(const uint8_t * buffer, uint32_t * frame_size)
+{
+    if (memcmp(buffer, FRAME_INDEX_MAGIC, 4) != 0
+	|| buffer[4] != FRAME_INDEX_VERSION)
+	return false;
+    *frame_size = get_u32(buffer + 8);
+    return *frame_size != 0;
+}
+
+void frame_index_encode_record(uint8_t * buffer,
+			       const struct frame_index_record * record)
+{
+    put_u32(buffer, record->frame_num);
+    put_u32(buffer + 4, record->serial_num);
+    put_u32(buffer + 8, record->record_time);
+    buffer[12] = record->cut;
+    buffer[13] = record->flags | FRAME_INDEX_FLAG_VALID;
+    buffer[14] = 0;
+    buffer[15] = 0;
+}
+
+bool frame_index_decode_record(const uint8_t * buffer, uint32_t frame_num,
+			       struct frame_index_record * record)
+{
+    record->frame_num = get_u32(buffer);
+    record->serial_num = get_u32(buffer + 4);
+    record->record_time = get_u32(buffer + 8);
+    record->cut = buffer[12];
+    record->flags = buffer[13];
+    return (record->flags & FRAME_INDEX_FLAG_VALID)
+	&& record->frame_num == frame_num;
+}
+
+bool frame_index_read(const char * dif_name, struct frame_index * index)
+{
+    char * name;
+    FILE * file;
+    uint8_t buffer[FRAME_INDEX_RECORD_SIZE];
+    struct frame_index_record record;
+    size_t capacity = 0;
+    bool valid = false;
+
+    name = malloc(strlen(dif_name) + sizeof(FRAME_INDEX_SUFFIX));
+    if (!name)
+	return false;
+    sprintf(name, "%s" FRAME_INDEX_SUFFIX, dif_name);
+    file = fopen(name, "rb");
+    free(name);
+    if (!file)
+	return false;
+
+    index->frame_count = 0;
+    index->complete = false;
+    index->records = NULL;
+
+    if (fread(buffer, FRAME_INDEX_HEADER_SIZE, 1, file) != 1
+	|| !frame_index_decode_header(buffer, &index->frame_size))
+	goto out;
+
+    while (fread(buffer, FRAME_INDEX_RECORD_SIZE, 1, file) == 1
+	   && frame_index_decode_record(buffer, index->frame_count, &record))
+    {
+	if (record.flags & FRAME_INDEX_FLAG_END)
+	{
+	    index->complete = true;
+	    break;
+	}
+	if (index->frame_count == capacity)
+	{
+	    struct frame_index_record * records;
+	    capacity = capacity ? 2 * capacity : 1024;
+	    records = realloc(index->records, capacity * sizeof(*records));
+	    if (!records)
+		goto out;
+	    index->records = records;
+	}
+	index->records[index->frame_count++] = record;
+    }
+    valid = true;
+
+out:
+    fclose(file);
+    if (!valid)
+	frame_index_free(index);
+    return valid;
+}
+
+void frame_index_free(struct frame_index * index)
+{
+    free(index->records);
+    index->records = NULL;
+    index->frame_count = 0;
+}
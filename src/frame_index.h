@@ -0,0 +1,102 @@
+// Copyright 2010 Ben Hutchings.
+// See the file "COPYING" for licence details.
+
+// Frame index files written alongside recordings
+
+#ifndef DVSWITCH_FRAME_INDEX_H
+#define DVSWITCH_FRAME_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// dvsink-files writes an index for each DIF file it creates, named by
+// appending FRAME_INDEX_SUFFIX to the DIF file name.  The index
+// consists of a header, a record for each frame in order, and
+// finally an end record which is written once all frames have been
+// written to the DIF file.  All frames in a file have the same size,
+// so frame n starts at offset n * frame_size.  Numbers are stored
+// little-endian.
+//
+// Records are appended as frames are received, so after a crash
+// there is no end record and the index may run ahead of or behind
+// the DIF file.  The recording can then be recovered by keeping only
+// the frames that are complete in both.  A reader should stop at the
+// first record that fails frame_index_decode_record(), since a crash
+// may leave a partial or zero-filled record at the end.
+
+#define FRAME_INDEX_SUFFIX ".idx"
+
+// Header:
+// 0-3: magic "DVIX"
+// 4: version
+// 5-7: reserved, 0
+// 8-11: frame size in bytes
+// 12-15: reserved, 0
+#define FRAME_INDEX_HEADER_SIZE 16
+#define FRAME_INDEX_MAGIC "DVIX"
+#define FRAME_INDEX_VERSION 1
+
+// Record:
+// 0-3: frame number, or number of frames in an end record
+// 4-7: mixer serial number, from the time code; this wraps daily
+// 8-11: record time in seconds since the epoch, from the record date
+//       and time packs
+// 12: cut flag (SINK_FRAME_CUT_*) from the sink frame header, or in
+//     an end record the cut flag that ended the file (0 if the
+//     mixer disconnected)
+// 13: flags (FRAME_INDEX_FLAG_*)
+// 14-15: reserved, 0
+#define FRAME_INDEX_RECORD_SIZE 16
+
+// Set in every record, so that zero-filled records are invalid
+#define FRAME_INDEX_FLAG_VALID 1
+// Serial number is present
+#define FRAME_INDEX_FLAG_SERIAL 2
+// Record time is present
+#define FRAME_INDEX_FLAG_TIME 4
+// End record
+#define FRAME_INDEX_FLAG_END 8
+
+struct frame_index_record
+{
+    uint32_t frame_num;
+    uint32_t serial_num;
+    uint32_t record_time;
+    uint8_t cut;
+    uint8_t flags;
+};
+
+void frame_index_encode_header(uint8_t * buffer, uint32_t frame_size);
+// Decode a header.  Return false if it is not a valid header.
+bool frame_index_decode_header(const uint8_t * buffer, uint32_t * frame_size);
+
+void frame_index_encode_record(uint8_t * buffer,
+			       const struct frame_index_record * record);
+// Decode the record expected to have the given frame number.  Return
+// false if it is not a valid record for that position.
+bool frame_index_decode_record(const uint8_t * buffer, uint32_t frame_num,
+			       struct frame_index_record * record);
+
+// Contents of an index file
+struct frame_index
+{
+    uint32_t frame_size;
+    uint32_t frame_count;	// number of valid frame records
+    bool complete;		// whether there is an end record
+    struct frame_index_record * records;
+};
+
+// Read the index for a DIF file, stopping at the end record or the
+// first invalid record.  Return false if there is no valid index.
+bool frame_index_read(const char * dif_name, struct frame_index * index);
+void frame_index_free(struct frame_index * index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !defined(DVSWITCH_FRAME_INDEX_H)
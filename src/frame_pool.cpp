@@ -3,7 +3,13 @@
 
 // DIF and raw video frame buffer pools
 
-#include <boost/pool/object_pool.hpp>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include <sys/mman.h>
+
+#include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
 
 #include "avcodec_wrap.h"
@@ -13,51 +19,366 @@
 
 namespace
 {
-    boost::mutex dv_frame_pool_mutex; // controls access to the following
-    boost::object_pool<dv_frame> dv_frame_pool(100);
+    // Pool of fixed-size blocks.  Blocks are allocated from the
+    // system in chunks and are not returned until the pool is
+    // destroyed.  Alternatively, all blocks can be reserved in one
+    // region up front, and then the pool never grows.  Free blocks
+    // are kept on a lock-free stack, so allocation and freeing only
+    // take a lock when the pool has to grow.  The stack is linked
+    // by block index rather than pointer, so that the head can also
+    // hold a modification count to avoid the ABA problem.  The
+    // header also holds the reference count for the frame pointer
+    // types and a pointer back to the pool.
+    class block_pool
+    {
+    public:
+	block_pool(std::size_t size, unsigned chunk_len);
+	~block_pool();
+	unsigned reserve(std::size_t count, unsigned flags);
+	void * allocate(); // returns 0 if the pool is exhausted
+	void free(void *);
+	static void add_ref(void * block)
+	{
+	    header(block)->ref_count.fetch_add(1, boost::memory_order_relaxed);
+	}
+	static void release(void * block)
+	{
+	    block_header * h = header(block);
+	    if (h->ref_count.fetch_sub(1, boost::memory_order_release) == 1)
+	    {
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		h->pool->free(block);
+	    }
+	}
+	frame_pool_stats get_stats() const;
+
+    private:
+	// Each block is preceded by a header, which is padded to a
+	// cache line to keep the blocks aligned and to avoid false
+	// sharing between them.
+	struct block_header
+	{
+	    block_pool * pool;
+	    uint32_t index;
+	    boost::atomic<uint32_t> next; // index + 1, or 0 at end
+	    boost::atomic<uint32_t> ref_count;
+	};
+	static const std::size_t header_size = 64;
+	static const unsigned max_chunks = 1024;
+
+	block_header * header(uint32_t index) const
+	{
+	    return reinterpret_cast<block_header *>(
+		chunks_[index / chunk_len_] + (index % chunk_len_) * stride_);
+	}
+	static block_header * header(void * block)
+	{
+	    return reinterpret_cast<block_header *>(
+		static_cast<char *>(block) - header_size);
+	}
+	void push(uint32_t index);
+	void * grow();
+
+	const std::size_t stride_;
+	unsigned chunk_len_;
+	bool is_reserved_;
+	std::size_t reserved_size_;
+
+	// Stack head: modification count in the upper 32 bits, and
+	// index + 1 of the top block (or 0) in the lower 32 bits
+	boost::atomic<uint64_t> free_head_;
+
+	boost::mutex grow_mutex_; // serialises growth of the following
+	char * chunks_[max_chunks];
+	boost::atomic<unsigned> chunk_count_;
+
+	boost::atomic<std::size_t> in_use_, in_use_max_;
+    };
+
+    block_pool::block_pool(std::size_t size, unsigned chunk_len)
+	: stride_((header_size + size + header_size - 1) & ~(header_size - 1)),
+	  chunk_len_(chunk_len),
+	  is_reserved_(false),
+	  reserved_size_(0),
+	  free_head_(0),
+	  chunk_count_(0),
+	  in_use_(0),
+	  in_use_max_(0)
+    {}
 
-    void free_dv_frame(dv_frame * frame)
+    block_pool::~block_pool()
     {
-	boost::mutex::scoped_lock lock(dv_frame_pool_mutex);
-	if (frame)
-	    dv_frame_pool.free(frame);
+	if (is_reserved_)
+	    munmap(chunks_[0], reserved_size_);
+	else
+	    for (unsigned i = 0; i != chunk_count_; ++i)
+		std::free(chunks_[i]);
     }
 
-    boost::mutex raw_frame_pool_mutex; // controls access to the following
-    boost::object_pool<raw_frame> raw_frame_pool(10);
+    unsigned block_pool::reserve(std::size_t count, unsigned flags)
+    {
+	static const std::size_t huge_page_size = 2 << 20;
+
+	boost::mutex::scoped_lock lock(grow_mutex_);
+
+	assert(chunk_count_ == 0);
+	if (count == 0 || count > UINT32_MAX - 1)
+	    throw std::bad_alloc();
+
+	// Map and fault in all the blocks now, rather than part-way
+	// through a live event.  Try huge pages first if wanted,
+	// which need the size to be rounded up.
+	unsigned result = 0;
+	std::size_t size = stride_ * count;
+	void * region = MAP_FAILED;
+	if (flags & frame_pool_huge_pages)
+	{
+	    std::size_t huge_size =
+		(size + huge_page_size - 1) & ~(huge_page_size - 1);
+	    region = mmap(0, huge_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+			  | MAP_POPULATE,
+			  -1, 0);
+	    if (region != MAP_FAILED)
+	    {
+		size = huge_size;
+		result |= frame_pool_huge_pages;
+	    }
+	}
+	if (region == MAP_FAILED)
+	{
+	    region = mmap(0, size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+			  -1, 0);
+	    if (region == MAP_FAILED)
+		throw std::bad_alloc();
+	    // Transparent huge pages are the next best thing
+	    if ((flags & frame_pool_huge_pages)
+		&& madvise(region, size, MADV_HUGEPAGE) == 0)
+		result |= frame_pool_huge_pages;
+	}
+	if ((flags & frame_pool_lock) && mlock(region, size) == 0)
+	    result |= frame_pool_lock;
+
+	chunks_[0] = static_cast<char *>(region);
+	chunk_len_ = count;
+	is_reserved_ = true;
+	reserved_size_ = size;
+	chunk_count_ = 1;
 
-    void free_raw_frame(raw_frame * frame)
+	for (uint32_t i = 0; i != count; ++i)
+	{
+	    header(i)->pool = this;
+	    header(i)->index = i;
+	    push(i);
+	}
+
+	return result;
+    }
+
+    void * block_pool::allocate()
     {
-	boost::mutex::scoped_lock lock(raw_frame_pool_mutex);
-	if (frame)
-	    raw_frame_pool.free(frame);
+	uint64_t head = free_head_.load(boost::memory_order_acquire);
+	void * result;
+
+	for (;;)
+	{
+	    uint32_t top = uint32_t(head);
+	    if (top == 0)
+	    {
+		result = grow();
+		if (!result)
+		    return 0;
+		break;
+	    }
+	    block_header * block = header(top - 1);
+	    uint64_t new_head =
+		((head >> 32) + 1) << 32
+		| block->next.load(boost::memory_order_relaxed);
+	    if (free_head_.compare_exchange_weak(head, new_head,
+						 boost::memory_order_acquire))
+	    {
+		result = reinterpret_cast<char *>(block) + header_size;
+		break;
+	    }
+	}
+
+	header(result)->ref_count.store(0, boost::memory_order_relaxed);
+
+	std::size_t in_use = ++in_use_;
+	std::size_t in_use_max = in_use_max_.load(boost::memory_order_relaxed);
+	while (in_use > in_use_max
+	       && !in_use_max_.compare_exchange_weak(
+		   in_use_max, in_use, boost::memory_order_relaxed))
+	    ;
+
+	return result;
+    }
+
+    void block_pool::free(void * block)
+    {
+	--in_use_;
+	push(header(block)->index);
     }
 
-    boost::mutex pcm_packet_pool_mutex; // controls access to the following
-    boost::object_pool<pcm_packet> pcm_packet_pool(100);
+    void block_pool::push(uint32_t index)
+    {
+	block_header * block = header(index);
+	uint64_t head = free_head_.load(boost::memory_order_relaxed);
+	uint64_t new_head;
+
+	do
+	{
+	    block->next.store(uint32_t(head), boost::memory_order_relaxed);
+	    new_head = ((head >> 32) + 1) << 32 | (index + 1);
+	}
+	while (!free_head_.compare_exchange_weak(head, new_head,
+						 boost::memory_order_release));
+    }
 
-    void free_pcm_packet(pcm_packet * frame)
+    void * block_pool::grow()
     {
-	boost::mutex::scoped_lock lock(pcm_packet_pool_mutex);
-	if (frame)
-	    pcm_packet_pool.free(frame);
+	boost::mutex::scoped_lock lock(grow_mutex_);
+
+	unsigned chunk_num = chunk_count_;
+	if (is_reserved_ || chunk_num == max_chunks)
+	    return 0;
+	void * chunk;
+	if (posix_memalign(&chunk, header_size, stride_ * chunk_len_))
+	    return 0;
+	chunks_[chunk_num] = static_cast<char *>(chunk);
+	chunk_count_ = chunk_num + 1;
+
+	// Keep the first block and put the rest on the free stack
+	uint32_t first = chunk_num * chunk_len_;
+	for (uint32_t i = 0; i != chunk_len_; ++i)
+	{
+	    header(first + i)->pool = this;
+	    header(first + i)->index = first + i;
+	    if (i != 0)
+		push(first + i);
+	}
+	return reinterpret_cast<char *>(header(first)) + header_size;
+    }
+
+    frame_pool_stats block_pool::get_stats() const
+    {
+	frame_pool_stats result;
+	result.capacity = chunk_count_ * chunk_len_;
+	result.limit = is_reserved_ ? result.capacity : 0;
+	result.in_use = in_use_;
+	result.in_use_max = in_use_max_;
+	return result;
+    }
+
+    block_pool dv_frame_pool(sizeof(dv_frame), 32);
+    block_pool pcm_packet_pool(sizeof(pcm_packet), 32);
+
+    // Raw frames for 525/60 are smaller, so they have their own pool
+    block_pool raw_frame_pool_525(raw_frame_size(&dv_system_525_60), 4);
+    block_pool raw_frame_pool_625(raw_frame_size(&dv_system_625_50), 4);
+
+    block_pool & raw_frame_pool(const dv_system * system)
+    {
+	return (system == &dv_system_525_60
+		? raw_frame_pool_525 : raw_frame_pool_625);
     }
 }
 
+void intrusive_ptr_add_ref(dv_frame * frame)
+{
+    block_pool::add_ref(frame);
+}
+
+void intrusive_ptr_release(dv_frame * frame)
+{
+    block_pool::release(frame);
+}
+
+void intrusive_ptr_add_ref(raw_frame * frame)
+{
+    block_pool::add_ref(frame);
+}
+
+void intrusive_ptr_release(raw_frame * frame)
+{
+    block_pool::release(frame);
+}
+
+void intrusive_ptr_add_ref(pcm_packet * packet)
+{
+    block_pool::add_ref(packet);
+}
+
+void intrusive_ptr_release(pcm_packet * packet)
+{
+    block_pool::release(packet);
+}
+
 dv_frame_ptr allocate_dv_frame()
 {
-    boost::mutex::scoped_lock lock(dv_frame_pool_mutex);
-    return dv_frame_ptr(dv_frame_pool.malloc(), free_dv_frame);
+    dv_frame_ptr result(allocate_dv_frame(std::nothrow));
+    if (!result)
+	throw std::bad_alloc();
+    return result;
+}
+
+dv_frame_ptr allocate_dv_frame(const std::nothrow_t &)
+{
+    return dv_frame_ptr(static_cast<dv_frame *>(dv_frame_pool.allocate()));
 }
 
-raw_frame_ptr allocate_raw_frame()
+raw_frame_ptr allocate_raw_frame(const dv_system * system)
 {
-    boost::mutex::scoped_lock lock(raw_frame_pool_mutex);
-    return raw_frame_ptr(raw_frame_pool.malloc(), free_raw_frame);
+    raw_frame_ptr result(allocate_raw_frame(system, std::nothrow));
+    if (!result)
+	throw std::bad_alloc();
+    return result;
+}
+
+raw_frame_ptr allocate_raw_frame(const dv_system * system,
+				 const std::nothrow_t &)
+{
+    return raw_frame_ptr(
+	static_cast<raw_frame *>(raw_frame_pool(system).allocate()));
 }
 
 pcm_packet_ptr allocate_pcm_packet()
 {
-    boost::mutex::scoped_lock lock(pcm_packet_pool_mutex);
-    return pcm_packet_ptr(pcm_packet_pool.malloc(), free_pcm_packet);
+    pcm_packet * packet = static_cast<pcm_packet *>(pcm_packet_pool.allocate());
+    if (!packet)
+	throw std::bad_alloc();
+    return pcm_packet_ptr(packet);
+}
+
+unsigned reserve_dv_frame_pool(std::size_t count, unsigned flags)
+{
+    return dv_frame_pool.reserve(count, flags);
+}
+
+unsigned reserve_raw_frame_pool(const dv_system * system,
+				std::size_t count, unsigned flags)
+{
+    return raw_frame_pool(system).reserve(count, flags);
+}
+
+frame_pool_stats get_dv_frame_pool_stats()
+{
+    return dv_frame_pool.get_stats();
+}
+
+frame_pool_stats get_raw_frame_pool_stats()
+{
+    frame_pool_stats result = raw_frame_pool_525.get_stats();
+    frame_pool_stats stats_625 = raw_frame_pool_625.get_stats();
+    result.capacity += stats_625.capacity;
+    result.limit += stats_625.limit;
+    result.in_use += stats_625.in_use;
+    result.in_use_max += stats_625.in_use_max;
+    return result;
+}
+
+frame_pool_stats get_pcm_packet_pool_stats()
+{
+    return pcm_packet_pool.get_stats();
 }
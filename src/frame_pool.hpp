@@ -6,7 +6,10 @@
 #ifndef DVSWITCH_FRAME_POOL_HPP
 #define DVSWITCH_FRAME_POOL_HPP
 
-#include <tr1/memory>
+#include <cstddef>
+#include <new>
+
+#include <boost/intrusive_ptr.hpp>
 
 // Memory pool for frame buffers.  This should make frame
 // (de)allocation relatively cheap.
@@ -14,19 +17,68 @@
 struct dv_frame;
 struct raw_frame;
 struct pcm_packet;
+struct dv_system;
+
+// Reference-counting pointers to frames.  The reference count is
+// kept in the pool alongside each buffer, so allocating a frame
+// needs no separate control block and copying a pointer updates a
+// single counter.  Frames are passed between threads and held by
+// several sinks at once, so copying still costs an atomic operation;
+// where a reference can be handed over instead, swap it.
+typedef boost::intrusive_ptr<dv_frame> dv_frame_ptr;
+typedef boost::intrusive_ptr<raw_frame> raw_frame_ptr;
+typedef boost::intrusive_ptr<pcm_packet> pcm_packet_ptr;
 
-// Reference-counting pointers to frames
-typedef std::tr1::shared_ptr<dv_frame> dv_frame_ptr;
-typedef std::tr1::shared_ptr<raw_frame> raw_frame_ptr;
-typedef std::tr1::shared_ptr<pcm_packet> pcm_packet_ptr;
+// Reference counting functions used by boost::intrusive_ptr.  The
+// buffer is returned to its pool when the count drops to zero.
+void intrusive_ptr_add_ref(dv_frame *);
+void intrusive_ptr_release(dv_frame *);
+void intrusive_ptr_add_ref(raw_frame *);
+void intrusive_ptr_release(raw_frame *);
+void intrusive_ptr_add_ref(pcm_packet *);
+void intrusive_ptr_release(pcm_packet *);
 
-// Allocate a DV frame buffer
+// Allocate a DV frame buffer.  If the pool is exhausted, the first
+// version throws std::bad_alloc and the second returns a null pointer.
 dv_frame_ptr allocate_dv_frame();
+dv_frame_ptr allocate_dv_frame(const std::nothrow_t &);
 
-// Allocate a raw frame buffer
-raw_frame_ptr allocate_raw_frame();
+// Allocate a raw frame buffer big enough for the given video
+// system, as above
+raw_frame_ptr allocate_raw_frame(const dv_system *);
+raw_frame_ptr allocate_raw_frame(const dv_system *, const std::nothrow_t &);
 
 // Allocate a PCM pcket buffer
 pcm_packet_ptr allocate_pcm_packet();
 
+// By default the pools grow as needed.  Alternatively, a fixed number
+// of buffers can be reserved at startup.  They are faulted in
+// immediately, and optionally put in huge pages and locked into RAM.
+// This must be done before any buffers are allocated from the pool.
+// The return value shows which of the options took effect.  Raw
+// frame buffers are reserved for one video system; those for the
+// other are still allocated as needed.
+enum
+{
+    frame_pool_huge_pages = 1,
+    frame_pool_lock = 2
+};
+unsigned reserve_dv_frame_pool(std::size_t count, unsigned flags);
+unsigned reserve_raw_frame_pool(const dv_system *,
+				std::size_t count, unsigned flags);
+
+struct frame_pool_stats
+{
+    std::size_t capacity;	// buffers allocated from the system
+    std::size_t limit;		// reserved buffer count, or 0 if none
+    std::size_t in_use;		// buffers currently in use
+    std::size_t in_use_max;	// high-water mark of in_use
+};
+
+// Get a snapshot of each pool's usage.  The raw frame statistics
+// cover both video systems.
+frame_pool_stats get_dv_frame_pool_stats();
+frame_pool_stats get_raw_frame_pool_stats();
+frame_pool_stats get_pcm_packet_pool_stats();
+
 #endif // !DVSWITCH_FRAME_POOL_HPP
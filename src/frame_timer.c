@@ -6,9 +6,10 @@
 
 #include <errno.h>
 #include <pthread.h>
-#include <signal.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -17,20 +18,14 @@
 
 #include "frame_timer.h"
 
-static timer_t frame_timer_id;
 struct timespec frame_timer_res;
 
+const unsigned frame_timer_lateness_limits[FRAME_TIMER_LATENESS_BUCKETS - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000
+};
+
 void frame_timer_init(void)
 {
-    sigset_t sigset_alarm;
-    sigemptyset(&sigset_alarm);
-    sigaddset(&sigset_alarm, SIGALRM);
-    if (pthread_sigmask(SIG_BLOCK, &sigset_alarm, NULL) != 0)
-    {
-	perror("FATAL: pthread_sigmask");
-	exit(1);
-    }
-
     // On Linux, CLOCK_MONOTONIC matches the kernel interval timer
     // (resolution is controlled by HZ) and there is no
     // CLOCK_MONOTONIC_HR.
@@ -51,16 +46,6 @@ void frame_timer_init(void)
 	      stderr);
 	exit(1);
     }
-
-    struct sigevent event = {
-	.sigev_notify = SIGEV_SIGNAL,
-	.sigev_signo =  SIGALRM
-    };
-    if (timer_create(CLOCK_MONOTONIC, &event, &frame_timer_id) != 0)
-    {
-	perror("FATAL: timer_create");
-	exit(1);
-    }
 }
 
 uint64_t frame_timer_get(void)
@@ -76,20 +61,52 @@ uint64_t frame_timer_get(void)
 
 void frame_timer_wait(uint64_t point)
 {
-    struct itimerspec interval = {
-	.it_value = { .tv_sec = point / 1000000000,
-		      .tv_nsec = point % 1000000000 },
-	.it_interval = { .tv_sec = 0,
-			 .tv_nsec = 0 }
+    // An absolute sleep needs no timer or signal of its own, so any
+    // number of threads can do this at once.  It also doesn't drift
+    // if we are interrupted and restart.
+    struct timespec until = {
+	.tv_sec = point / 1000000000,
+	.tv_nsec = point % 1000000000
     };
-    if (timer_settime(frame_timer_id, TIMER_ABSTIME, &interval, 0) != 0)
+    int rc;
+    while ((rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0))
+	   == EINTR)
+	;
+    if (rc != 0)
     {
-	perror("FATAL: timer_settime");
+	errno = rc;
+	perror("FATAL: clock_nanosleep");
 	exit(1);
     }
-    sigset_t sigset_alarm;
-    sigemptyset(&sigset_alarm);
-    sigaddset(&sigset_alarm, SIGALRM);
-    int dummy;
-    sigwait(&sigset_alarm, &dummy);
+}
+
+void frame_timer_open(struct frame_timer * timer)
+{
+    memset(&timer->stats, 0, sizeof(timer->stats));
+}
+
+void frame_timer_wait_next(struct frame_timer * timer, uint64_t point)
+{
+    frame_timer_wait(point);
+
+    uint64_t lateness = frame_timer_get() - point;
+    unsigned bucket = 0;
+    while (bucket != FRAME_TIMER_LATENESS_BUCKETS - 1
+	   && lateness >= frame_timer_lateness_limits[bucket] * 1000ULL)
+	++bucket;
+
+    struct frame_timer_stats * stats = &timer->stats;
+    ++stats->wakeup_count;
+    stats->total_lateness += lateness;
+    if (lateness > stats->max_lateness)
+	stats->max_lateness = lateness;
+    ++stats->lateness_hist[bucket];
+}
+
+int frame_timer_set_realtime(pthread_t thread, int priority)
+{
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return pthread_setschedparam(thread, SCHED_FIFO, &param);
 }
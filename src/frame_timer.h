@@ -6,14 +6,14 @@
 #ifndef DVSWITCH_FRAME_TIMER_H
 #define DVSWITCH_FRAME_TIMER_H
 
+#include <pthread.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Initialise timer in a disarmed state.  Must be called in the first
-// thread before any more threads are created and before any of the
+// Check that the timer is usable.  Must be called before any of the
 // following functions are used.
 void frame_timer_init(void);
 
@@ -25,6 +25,37 @@ uint64_t frame_timer_get(void);
 // timestamp.
 void frame_timer_wait(uint64_t timestamp);
 
+// Histogram of wakeup lateness.  Bucket i counts wakeups that were
+// less than frame_timer_lateness_limits[i] us late; the last bucket
+// counts all later wakeups.
+#define FRAME_TIMER_LATENESS_BUCKETS 10
+extern const unsigned
+frame_timer_lateness_limits[FRAME_TIMER_LATENESS_BUCKETS - 1];
+
+struct frame_timer_stats
+{
+    uint64_t wakeup_count;
+    uint64_t total_lateness, max_lateness; // in ns
+    uint64_t lateness_hist[FRAME_TIMER_LATENESS_BUCKETS];
+};
+
+// Timer for a single clock, which records how late it wakes up.
+// Each clock should have its own timer, used only by the clock
+// thread.
+struct frame_timer
+{
+    struct frame_timer_stats stats;
+};
+
+void frame_timer_open(struct frame_timer * timer);
+
+// As frame_timer_wait(), but record the lateness of the wakeup.
+void frame_timer_wait_next(struct frame_timer * timer, uint64_t timestamp);
+
+// Run the given thread under the SCHED_FIFO policy at the given
+// priority.  Return 0 or an error number.
+int frame_timer_set_realtime(pthread_t thread, int priority);
+
 #ifdef __cplusplus
 }
 #endif
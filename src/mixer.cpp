@@ -8,6 +8,7 @@
 // mixes frames at each clock tick, and passes frames in the sinks and
 // monitor.
 
+#include <algorithm>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
@@ -21,6 +22,8 @@
 #include <boost/thread/thread.hpp>
 
 #include "auto_codec.hpp"
+#include "decode_pool.hpp"
+#include "decoded_frame_cache.hpp"
 #include "frame.h"
 #include "frame_timer.h"
 #include "mixer.hpp"
@@ -33,29 +36,200 @@ struct mixer::video_mix
 {
     virtual void validate(const mixer &) = 0;
     virtual void set_active(const mixer &, bool active) = 0;
-    virtual bool apply(const mix_data &, const auto_codec &,
+    // Register the source frames that apply() will need decoded
+    virtual void want_decoded(const mix_data &, decoded_frames &) {}
+    virtual bool apply(const mix_data &, decoded_frames &,
 		       raw_frame_ptr &, dv_frame_ptr &) = 0;
+    // Copy unmixed video from the sources into the mixed frame after
+    // it has been encoded, to avoid generational loss
+    virtual void pass_through_video(const mix_data &, dv_frame &) {}
     virtual void status(mixer::monitor * monitor) = 0;
+    // Return whether the mixed video would be the same as for the
+    // last mix data this was called with.  This is called for each
+    // mix before apply(), which is skipped if the result is true.
+    virtual bool is_unchanged(const mix_data &) { return false; }
 };
 
+namespace
+{
+    // Check whether a source frame has the same video as the last
+    // one used, and remember it for next time
+    bool update_last_frame(dv_frame_ptr & last, const dv_frame_ptr & frame)
+    {
+	bool result = last && frame
+	    && (last == frame
+		|| dv_buffer_video_equal(last->buffer, frame->buffer));
+	last = frame;
+	return result;
+    }
+
+    dv_frame_ptr copy_dv_frame(const dv_frame_ptr & frame)
+    {
+	dv_frame_ptr result(allocate_dv_frame(std::nothrow));
+	if (result)
+	    std::memcpy(result.get(), frame.get(),
+			offsetof(dv_frame, buffer)
+			+ dv_frame_system(frame.get())->size);
+	return result;
+    }
+
+    raw_frame_ptr copy_raw_frame(const raw_frame_ptr & frame)
+    {
+	const dv_system * system = raw_frame_system(frame.get());
+	raw_frame_ptr result(allocate_raw_frame(system, std::nothrow));
+	if (result)
+	{
+	    // The plane pointers point into the frame itself
+	    std::memcpy(result.get(), frame.get(), raw_frame_size(system));
+	    for (int i = 0; i != 3; ++i)
+		result->header.data[i] = (raw_frame_buffer(result.get())
+					  + (frame->header.data[i]
+					     - raw_frame_buffer(frame.get())));
+	}
+	return result;
+    }
+}
+
+// Decoding of source frames for a single tick.  The video mixes for
+// all outputs register the sources they need, which are then decoded
+// in a single batch, so that each source is decoded at most once per
+// tick however many outputs use it.  The decoded frames are kept in
+// the tick's cache for the monitor.
+
+class mixer::decoded_frames
+{
+public:
+    decoded_frames(decode_pool & decoders, const mix_data & m,
+		   decoded_frame_cache & cache)
+	: decoders_(decoders),
+	  m_(m),
+	  cache_(cache),
+	  uses_(m.source_frames.size()),
+	  is_decoded_(m.source_frames.size()),
+	  is_retained_(false)
+    {}
+    // Register a use of the given source's decoded frame
+    void want(source_id id) { ++uses_.at(id); }
+    // Set whether to keep an unmodified copy of frames that mixes
+    // modify, so that they stay in the cache
+    void set_retained(bool retained) { is_retained_ = retained; }
+    // Decode the frames for all registered uses
+    void decode();
+    // Get the decoded frame for the given source, which must not be
+    // modified.  This is null if the source has no frame for this
+    // tick, or it has the wrong format, or decoding failed.
+    raw_frame_ptr get(source_id);
+    // As above, but the frame may be modified.  It is copied if it
+    // is still needed for other uses.
+    raw_frame_ptr get_writable(source_id);
+
+private:
+    bool can_decode(source_id id) const
+    {
+	const dv_frame_ptr & frame = m_.source_frames[id];
+	return frame && dv_frame_system(frame.get()) == m_.format.system;
+    }
+
+    decode_pool & decoders_;
+    const mix_data & m_;
+    decoded_frame_cache & cache_;
+    std::vector<unsigned> uses_;
+    std::vector<bool> is_decoded_;
+    bool is_retained_;
+};
+
+void mixer::decoded_frames::decode()
+{
+    dv_frame_ptr source_dv[max_sources];
+    raw_frame_ptr source_raw[max_sources];
+    source_id ids[max_sources];
+    std::size_t count = 0;
+
+    for (source_id id = 0; id != uses_.size(); ++id)
+    {
+	if (uses_[id] && !is_decoded_[id])
+	{
+	    is_decoded_[id] = true;
+	    if (can_decode(id))
+	    {
+		source_dv[count] = m_.source_frames[id];
+		ids[count] = id;
+		++count;
+	    }
+	}
+    }
+
+    if (count)
+    {
+	decoders_.decode(count, source_dv, source_raw);
+	for (std::size_t i = 0; i != count; ++i)
+	    cache_.insert(ids[i], cache_.serial_num(), 0, source_raw[i]);
+    }
+}
+
+raw_frame_ptr mixer::decoded_frames::get(source_id id)
+{
+    // Decode now if this use wasn't registered
+    if (!is_decoded_.at(id))
+    {
+	is_decoded_[id] = true;
+	if (can_decode(id))
+	{
+	    raw_frame_ptr frame;
+	    decoders_.decode(1, &m_.source_frames[id], &frame);
+	    cache_.insert(id, cache_.serial_num(), 0, frame);
+	}
+    }
+    if (uses_[id])
+	--uses_[id];
+    return cache_.find(id, cache_.serial_num());
+}
+
+raw_frame_ptr mixer::decoded_frames::get_writable(source_id id)
+{
+    raw_frame_ptr result;
+    if (raw_frame_ptr frame = get(id))
+    {
+	if (uses_[id] || is_retained_)
+	    result = copy_raw_frame(frame);
+	// If a copy is only wanted for the cache, we can do without
+	if (!result && !uses_[id])
+	{
+	    result = cache_.take(id, cache_.serial_num());
+	    is_decoded_[id] = false;
+	}
+    }
+    return result;
+}
+
 mixer::mixer()
     : clock_state_(run_state_wait),
+      clock_running_(false),
       clock_thread_(boost::bind(&mixer::run_clock, this)),
       mixer_queue_(10),
       mixer_state_(run_state_wait),
+      mix_count_(0),
+      repeat_count_(0),
+      mix_dropped_count_(0),
+      output_queue_(output_queue_len),
+      output_state_(run_state_wait),
       mixer_thread_(boost::bind(&mixer::run_mixer, this)),
+      output_thread_(boost::bind(&mixer::run_output, this)),
       recorders_count_(0),
       monitor_(0)
 {
     format_.system = NULL;
     format_.frame_aspect = dv_frame_aspect_auto;
     format_.sample_rate = dv_sample_rate_auto;
+    // This must never be reallocated; see put_frame()
+    sources_.reserve(max_sources);
     settings_.video_mix = create_video_mix_simple(0);
     settings_.audio_source_id = 0;
     settings_.do_record = false;
     settings_.cut_before = false;
-    sources_.reserve(5);
+    std::memset(&clock_stats_, 0, sizeof(clock_stats_));
     sinks_.reserve(5);
+    sink_outputs_.reserve(5);
 }
 
 mixer::~mixer()
@@ -72,7 +246,88 @@ mixer::~mixer()
     }
 
     clock_thread_.join();
+    // The mixer thread stops the output thread when it finishes
     mixer_thread_.join();
+    output_thread_.join();
+}
+
+const unsigned mixer::latency_stats::bucket_limits[bucket_count - 1] = {
+    100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000
+};
+
+mixer::latency_stats::latency_stats()
+    : count(0),
+      total(0),
+      max(0)
+{
+    std::fill(buckets, buckets + bucket_count, 0);
+}
+
+void mixer::latency_stats::record(uint64_t latency)
+{
+    unsigned bucket = 0;
+    while (bucket != bucket_count - 1
+	   && latency >= bucket_limits[bucket] * uint64_t(1000))
+	++bucket;
+
+    ++count;
+    total += latency;
+    if (latency > max)
+	max = latency;
+    ++buckets[bucket];
+}
+
+mixer::source_stats::source_stats()
+    : is_active(false),
+      queue_len(0),
+      queue_capacity(0),
+      frame_count(0),
+      missing_count(0),
+      dropped_count(0)
+{}
+
+mixer::sink_stats::sink_stats()
+    : is_active(false),
+      queue_len(0),
+      queue_capacity(0),
+      frame_count(0),
+      dropped_count(0)
+{}
+
+mixer::source_data::source_data()
+    : frames(full_queue_len),
+      src(NULL),
+      dropped_count(0),
+      frame_count(0),
+      missing_count(0)
+{}
+
+mixer::source_data::source_data(const source_data & other)
+    : frames(other.frames),
+      src(other.src),
+      dropped_count(other.dropped_count.load()),
+      frame_count(other.frame_count),
+      missing_count(other.missing_count),
+      latency(other.latency)
+{}
+
+mixer::source_data & mixer::source_data::operator=(const source_data & other)
+{
+    frames = other.frames;
+    src = other.src;
+    dropped_count = other.dropped_count.load();
+    frame_count = other.frame_count;
+    missing_count = other.missing_count;
+    latency = other.latency;
+    return *this;
+}
+
+void mixer::source_data::reset_stats()
+{
+    dropped_count = 0;
+    frame_count = 0;
+    missing_count = 0;
+    latency = latency_stats();
 }
 
 mixer::source_id mixer::add_source(source * src, const source_settings &)
@@ -84,11 +339,17 @@ mixer::source_id mixer::add_source(source * src, const source_settings &)
 	if (!sources_[id].src)
 	{
 	    sources_[id].src = src;
+	    sources_[id].reset_stats();
 	    return id;
 	}
     }
+    if (id == max_sources)
+	throw std::range_error("too many sources");
     sources_.resize(id + 1);
     sources_[id].src = src;
+    // Outputs may have been waiting for this source
+    for (std::size_t i = 0; i != outputs_.size(); ++i)
+	update_output_validity(outputs_[i]);
     return id;
 }
 
@@ -100,82 +361,101 @@ void mixer::remove_source(source_id id)
 
 void mixer::put_frame(source_id id, const dv_frame_ptr & frame)
 {
-    bool was_full;
-    bool should_notify_clock = false;
+    // This is only called from the thread servicing the source,
+    // which is the only writer to its queue, so we don't need to
+    // lock anything unless we start the clock.
+    assert(id < max_sources);
+    source_data & source = sources_[id];
 
+    if (source.frames.full())
     {
-	boost::mutex::scoped_lock lock(source_mutex_);
-
-	source_data & source = sources_.at(id);
-	was_full = source.frames.full();
-
-	if (!was_full)
-	{
-	    frame->timestamp = frame_timer_get();
-	    source.frames.push(frame);
-
-	    // Start clock ticking once first source has reached the
-	    // target queue length
-	    if (clock_state_ == run_state_wait
-		&& id == 0 && source.frames.size() == target_queue_len)
-	    {
-		clock_state_ = run_state_run;
-		should_notify_clock = true; // after we unlock the mutex
-	    }
-
-	    // Auto-select format
-	    if (clock_state_ == run_state_run)
-	    {
-		format_settings format;
-		format.system = dv_frame_system(frame.get());
-		format.frame_aspect = dv_frame_get_aspect(frame.get());
-		format.sample_rate = dv_frame_get_sample_rate(frame.get());
+	source.dropped_count.fetch_add(1, boost::memory_order_relaxed);
+	std::cerr << "WARN: Dropped frame from source " << 1 + id
+		  << " due to full queue\n";
+	return;
+    }
 
-		frame->format_error = false;
+    // Start clock ticking once first source has reached the
+    // target queue length
+    bool should_start_clock =
+	id == 0 && !clock_running_.load(boost::memory_order_acquire)
+	&& source.frames.size() + 1 == target_queue_len;
+    if (should_start_clock)
+	clock_running_.store(true, boost::memory_order_release);
 
-		if (format_.system == NULL)
-		    format_.system = format.system;
-		else if (format_.system != format.system)
-		{
-		    std::cerr << "WARN: Source " << 1 + id
-			      << " using wrong video system\n";
-		    frame->format_error = true;
-		}
+    frame->format_error = false;
+    if (clock_running_.load(boost::memory_order_acquire))
+	check_format(id, *frame);
 
-		if (format_.frame_aspect == dv_frame_aspect_auto)
-		    format_.frame_aspect = format.frame_aspect;
-		else if (format_.frame_aspect != format.frame_aspect)
-		    // Override frame aspect ratio
-		    dv_frame_set_aspect(frame.get(), format_.frame_aspect);
+    frame->timestamp = frame_timer_get();
+    source.frames.push(frame);
 
-		if (format_.sample_rate == dv_sample_rate_auto &&
-		    format.sample_rate >= 0)
-		{
-		    format_.sample_rate = format.sample_rate;
-		}
-		else if (format_.sample_rate != format.sample_rate)
-		{
-		    std::cerr << "WARN: Source " << 1 + id
-			      << "using wrong sample rate\n";
-		    frame->format_error = true;
-		}
-	    }
+    if (should_start_clock)
+    {
+	{
+	    boost::mutex::scoped_lock lock(source_mutex_);
+	    if (clock_state_ == run_state_wait)
+		clock_state_ = run_state_run;
 	}
+	clock_state_cond_.notify_one();
     }
+}
 
-    if (should_notify_clock)
-	clock_state_cond_.notify_one();
+void mixer::check_format(source_id id, dv_frame & frame)
+{
+    // Auto-select format from the first source frame, or check
+    // against the selected format.  Each part of the format is
+    // selected independently with compare-and-swap so that this
+    // doesn't need a lock.
+
+    const dv_system * system = dv_frame_system(&frame);
+    const dv_system * expected_system = NULL;
+    if (!format_.system.compare_exchange_strong(expected_system, system)
+	&& expected_system != system)
+    {
+	std::cerr << "WARN: Source " << 1 + id
+		  << " using wrong video system\n";
+	frame.format_error = true;
+    }
 
-    if (was_full)
-	std::cerr << "WARN: Dropped frame from source " << 1 + id
-		  << " due to full queue\n";
+    dv_frame_aspect frame_aspect = dv_frame_get_aspect(&frame);
+    dv_frame_aspect expected_frame_aspect = dv_frame_aspect_auto;
+    if (!format_.frame_aspect.compare_exchange_strong(expected_frame_aspect,
+						      frame_aspect)
+	&& expected_frame_aspect != frame_aspect)
+	// Override frame aspect ratio
+	dv_frame_set_aspect(&frame, expected_frame_aspect);
+
+    dv_sample_rate sample_rate = dv_frame_get_sample_rate(&frame);
+    dv_sample_rate expected_sample_rate = dv_sample_rate_auto;
+    if (sample_rate < 0
+	|| !format_.sample_rate.compare_exchange_strong(expected_sample_rate,
+							sample_rate))
+    {
+	if (sample_rate < 0)
+	    expected_sample_rate = format_.sample_rate.load();
+	if (expected_sample_rate != sample_rate)
+	{
+	    std::cerr << "WARN: Source " << 1 + id
+		      << " using wrong sample rate\n";
+	    frame.format_error = true;
+	}
+    }
 }
 
-mixer::sink_id mixer::add_sink(sink * sink, bool will_record)
+mixer::sink_id mixer::add_sink(sink * sink, bool will_record,
+			       output_id output)
 {
+    {
+	boost::mutex::scoped_lock lock(source_mutex_);
+	if (output > outputs_.size())
+	    throw std::range_error("output id out of range");
+    }
+
     boost::mutex::scoped_lock lock(sink_mutex_);
     // XXX We may want to be able to reuse sink slots.
     sinks_.push_back(sink);
+    sink_outputs_.push_back(output);
     if (will_record)
 	++recorders_count_;
     return sinks_.size() - 1;
@@ -194,16 +474,18 @@ void mixer::remove_sink(sink_id id, bool will_record)
 
 mixer::format_settings mixer::get_format() const
 {
-    boost::mutex::scoped_lock lock(source_mutex_);
-    mixer::format_settings result = format_;
-    lock.unlock();
+    mixer::format_settings result;
+    result.system = format_.system.load();
+    result.frame_aspect = format_.frame_aspect.load();
+    result.sample_rate = format_.sample_rate.load();
     return result;
 }
 
 void mixer::set_format(format_settings format)
 {
-    boost::mutex::scoped_lock lock(source_mutex_);
-    format_ = format;
+    format_.system.store(format.system);
+    format_.frame_aspect.store(format.frame_aspect);
+    format_.sample_rate.store(format.sample_rate);
 }
 
 void mixer::set_audio_source(source_id id)
@@ -215,6 +497,80 @@ void mixer::set_audio_source(source_id id)
 	throw std::range_error("audio source id out of range");
 }
 
+void mixer::update_output_validity(output_settings & output)
+{
+    try
+    {
+	output.video_mix->validate(*this);
+	output.is_valid = true;
+    }
+    catch (std::range_error &)
+    {
+	output.is_valid = false;
+    }
+}
+
+mixer::output_id mixer::add_output(const std::string & name)
+{
+    boost::mutex::scoped_lock lock(source_mutex_);
+    if (name.empty())
+	throw std::invalid_argument("output name is empty");
+    for (std::size_t i = 0; i != outputs_.size(); ++i)
+	if (outputs_[i].name == name)
+	    throw std::invalid_argument("output name is already used");
+    outputs_.resize(outputs_.size() + 1);
+    output_settings & output = outputs_.back();
+    output.name = name;
+    output.video_mix = create_video_mix_simple(0);
+    output.audio_source_id = 0;
+    update_output_validity(output);
+    return outputs_.size();
+}
+
+mixer::output_id mixer::find_output(const std::string & name) const
+{
+    if (name.empty())
+	return main_output_id;
+    boost::mutex::scoped_lock lock(source_mutex_);
+    for (std::size_t i = 0; i != outputs_.size(); ++i)
+	if (outputs_[i].name == name)
+	    return 1 + i;
+    return invalid_id;
+}
+
+void mixer::set_output_video_mix(output_id id,
+				 std::tr1::shared_ptr<video_mix> video_mix)
+{
+    if (id == main_output_id)
+    {
+	set_video_mix(video_mix);
+	return;
+    }
+    boost::mutex::scoped_lock lock(source_mutex_);
+    if (id > outputs_.size())
+	throw std::range_error("output id out of range");
+    output_settings & output = outputs_[id - 1];
+    output.video_mix = video_mix;
+    update_output_validity(output);
+}
+
+void mixer::set_output_audio_source(output_id id, source_id source)
+{
+    if (id == main_output_id)
+    {
+	set_audio_source(source);
+	return;
+    }
+    // The source need not be registered yet; the output is silent
+    // until it is
+    boost::mutex::scoped_lock lock(source_mutex_);
+    if (id > outputs_.size())
+	throw std::range_error("output id out of range");
+    if (source >= max_sources)
+	throw std::range_error("audio source id out of range");
+    outputs_[id - 1].audio_source_id = source;
+}
+
 void mixer::set_monitor(monitor * monitor)
 {
     assert(monitor && !monitor_);
@@ -239,6 +595,75 @@ bool mixer::can_record() const
     return recorders_count_ != 0;
 }
 
+void mixer::set_clock_priority(int priority)
+{
+    int error = frame_timer_set_realtime(clock_thread_.native_handle(),
+					 priority);
+    if (error)
+	std::cerr << "WARN: Failed to set clock thread priority: "
+		  << std::strerror(error) << "\n";
+}
+
+frame_timer_stats mixer::get_clock_stats() const
+{
+    boost::mutex::scoped_lock lock(source_mutex_);
+    return clock_stats_;
+}
+
+mixer::stats mixer::get_stats() const
+{
+    stats result;
+
+    {
+	boost::mutex::scoped_lock lock(source_mutex_);
+	result.clock = clock_stats_;
+	result.sources.resize(sources_.size());
+	for (source_id id = 0; id != sources_.size(); ++id)
+	{
+	    const source_data & source = sources_[id];
+	    source_stats & source_result = result.sources[id];
+	    source_result.is_active = source.src != NULL;
+	    source_result.queue_len = source.frames.size();
+	    source_result.queue_capacity = source.frames.capacity();
+	    source_result.frame_count = source.frame_count;
+	    source_result.missing_count = source.missing_count;
+	    source_result.dropped_count = source.dropped_count.load();
+	    source_result.latency = source.latency;
+	}
+    }
+
+    {
+	boost::mutex::scoped_lock lock(mixer_mutex_);
+	result.mixer_queue_len = mixer_queue_.size();
+	result.mixer_queue_capacity = mixer_queue_.capacity();
+	result.mix_count = mix_count_;
+	result.repeat_count = repeat_count_;
+	result.mix_dropped_count = mix_dropped_count_;
+	result.mix_latency = mix_latency_;
+    }
+
+    {
+	boost::mutex::scoped_lock lock(output_mutex_);
+	result.output_queue_len = output_queue_.size();
+	result.output_queue_capacity = output_queue_.capacity();
+    }
+
+    {
+	boost::mutex::scoped_lock lock(sink_mutex_);
+	result.sinks.resize(sinks_.size());
+	for (sink_id id = 0; id != sinks_.size(); ++id)
+	{
+	    if (sinks_[id])
+	    {
+		sinks_[id]->get_stats(result.sinks[id]);
+		result.sinks[id].is_active = true;
+	    }
+	}
+    }
+
+    return result;
+}
+
 namespace
 {
     // Ensure the frame timer is initialised at startup
@@ -261,6 +686,9 @@ void mixer::run_clock()
 	    settings_.video_mix->set_active(*this, true);
     }
 
+    frame_timer timer;
+    frame_timer_open(&timer);
+
     // Interval to the next frame (in ns)
     unsigned int frame_interval = 0;
     // Weighted rolling average frame interval
@@ -268,7 +696,8 @@ void mixer::run_clock()
 
     for (uint64_t tick_timestamp = frame_timer_get();
 	 ;
-	 tick_timestamp += frame_interval, frame_timer_wait(tick_timestamp))
+	 tick_timestamp += frame_interval,
+	     frame_timer_wait_next(&timer, tick_timestamp))
     {
 	mix_data m;
 
@@ -279,21 +708,41 @@ void mixer::run_clock()
 	    if (clock_state_ == run_state_stop)
 		break;
 
-	    m.format = format_;
+	    m.tick_timestamp = tick_timestamp;
+	    m.format = get_format();
 	    m.settings = settings_;
 	    settings_.cut_before = false;
+	    clock_stats_ = timer.stats;
+
+	    m.extra_outputs.resize(outputs_.size());
+	    for (std::size_t i = 0; i != outputs_.size(); ++i)
+	    {
+		if (outputs_[i].is_valid)
+		    m.extra_outputs[i].video_mix = outputs_[i].video_mix;
+		else
+		    m.extra_outputs[i].video_mix.reset();
+		m.extra_outputs[i].audio_source_id =
+		    outputs_[i].audio_source_id;
+	    }
 
 	    m.source_frames.resize(sources_.size());
 	    for (source_id id = 0; id != sources_.size(); ++id)
 	    {
-		if (sources_[id].frames.empty())
+		source_data & source = sources_[id];
+		if (source.frames.empty())
 		{
 		    m.source_frames[id].reset();
+		    if (source.src)
+			++source.missing_count;
 		}
 		else
 		{
-		    m.source_frames[id] = sources_[id].frames.front();
-		    sources_[id].frames.pop();
+		    source.frames.pop_swap(m.source_frames[id]);
+		    ++source.frame_count;
+		    const uint64_t arrival = m.source_frames[id]->timestamp;
+		    source.latency.record(tick_timestamp > arrival
+					  ? tick_timestamp - arrival
+					  : 0);
 		}
 	    }
 	}
@@ -368,9 +817,13 @@ void mixer::run_clock()
 	    free_len = mixer_queue_.capacity() - mixer_queue_.size();
 	    if (free_len != 0)
 	    {
-		mixer_queue_.push(m); // really want to move m here
+		mixer_queue_.push_swap(m);
 		mixer_state_ = run_state_run;
 	    }
+	    else
+	    {
+		++mix_dropped_count_;
+	    }
 	}
 
 	if (free_len != 0)
@@ -400,30 +853,6 @@ namespace
 	return result;
     }
 
-    raw_frame_ptr decode_video_frame(
- 	const auto_codec & decoder, const dv_frame_ptr & dv_frame)
-    {
-	const struct dv_system * system = dv_frame_system(dv_frame.get());
-	raw_frame_ptr result = allocate_raw_frame();
-
-	AVPacket packet;
-	av_init_packet(&packet);
-	packet.data = dv_frame->buffer;
-	packet.size = system->size;
-
-	int got_frame;
-	decoder.get()->opaque = result.get();
-	int used_size = avcodec_decode_video2(decoder.get(),
-					      &result->header, &got_frame,
-					      &packet);
-	assert(got_frame && size_t(used_size) == system->size);
-
-	result->header.opaque =
-	    const_cast<void *>(static_cast<const void *>(system));
-	result->aspect = dv_frame_get_aspect(dv_frame.get());
-	return result;
-    }
-
     inline unsigned bcd(unsigned v)
     {
 	assert(v < 100);
@@ -450,8 +879,10 @@ namespace
 	    // Skip the first 2 frame numbers of each minute, except in
 	    // minutes divisible by 10.  This results in a "drop frame
 	    // timecode" with a nominal frame rate of 30 Hz.
-	    frame_num = frame_num + 2 * frame_num / (60 * 30 - 2)
-		- 2 * (frame_num + 2) / (10 * 60 * 30 - 18);
+	    unsigned block_pos = frame_num % (10 * 60 * 30 - 18);
+	    frame_num += 18 * (frame_num / (10 * 60 * 30 - 18));
+	    if (block_pos > 1)
+		frame_num += 2 * ((block_pos - 2) / (60 * 30 - 2));
 	    frame_rate = 30;
 	}
 
@@ -609,7 +1040,7 @@ public:
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &,
+    virtual bool apply(const mix_data &, decoded_frames &,
 		       raw_frame_ptr &, dv_frame_ptr &);
     virtual void status(mixer::monitor *) {}
     source_id source_id_;
@@ -628,7 +1059,7 @@ void mixer::video_mix_simple::set_active(const mixer & mixer, bool active)
 	    active ? source_active_video : source_active_none);
 }
 
-bool mixer::video_mix_simple::apply(const mix_data & m, const auto_codec &,
+bool mixer::video_mix_simple::apply(const mix_data & m, decoded_frames &,
 				    raw_frame_ptr &, dv_frame_ptr & mixed_dv)
 {
     const dv_frame_ptr & source_dv = m.source_frames[source_id_];
@@ -641,6 +1072,24 @@ bool mixer::video_mix_simple::apply(const mix_data & m, const auto_codec &,
 // Picture-in-picture video mix - replaces some region of primary source with
 // a secondary source scaled to fit
 
+namespace
+{
+    struct auto_scaler_closer
+    {
+	void operator()(video_effect_scaler * scaler) const
+	{
+	    video_effect_scaler_free(scaler);
+	}
+    };
+    struct auto_scaler_factory
+    {
+	video_effect_scaler * operator()() const { return 0; }
+    };
+    typedef auto_handle<video_effect_scaler *,
+			auto_scaler_closer, auto_scaler_factory>
+    auto_scaler;
+}
+
 class mixer::video_mix_pic_in_pic : public video_mix
 {
 public:
@@ -648,16 +1097,32 @@ public:
 			 source_id sec_source_id, rectangle dest_region)
 	: pri_source_id_(pri_source_id),
 	  sec_source_id_(sec_source_id),
-	  dest_region_(dest_region)
+	  dest_region_(dest_region),
+	  scaler_system_(0),
+	  scaler_pix_fmt_(PIX_FMT_NONE),
+	  pix_fmt_mismatch_(false)
     {}
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &,
+    virtual void want_decoded(const mix_data &, decoded_frames &);
+    virtual bool apply(const mix_data &, decoded_frames &,
 		       raw_frame_ptr &, dv_frame_ptr &);
+    virtual void pass_through_video(const mix_data &, dv_frame &);
     virtual void status(mixer::monitor *) {}
+    virtual bool is_unchanged(const mix_data &);
     source_id pri_source_id_, sec_source_id_;
     rectangle dest_region_;
+    dv_frame_ptr last_pri_source_dv_, last_sec_source_dv_;
+    // Scaling tables for the secondary source, which only change if
+    // its video system or pixel format does.  This is only used by
+    // the mixer thread.
+    auto_scaler scaler_;
+    const dv_system * scaler_system_;
+    PixelFormat scaler_pix_fmt_;
+    // Whether the last mix failed because the sources' pixel
+    // formats differed, so we only warn once
+    bool pix_fmt_mismatch_;
 };
 
 void mixer::video_mix_pic_in_pic::validate(const mixer & mixer)
@@ -677,10 +1142,17 @@ void mixer::video_mix_pic_in_pic::set_active(const mixer & mixer, bool active)
 	    active ? source_active_video : source_active_none);
 }
 
+void mixer::video_mix_pic_in_pic::want_decoded(const mix_data &,
+					       decoded_frames & decoded)
+{
+    decoded.want(pri_source_id_);
+    decoded.want(sec_source_id_);
+}
+
 bool mixer::video_mix_pic_in_pic::apply(const mix_data & m,
-					const auto_codec & decoder,
+					decoded_frames & decoded,
 					raw_frame_ptr & mixed_raw,
-					dv_frame_ptr &)
+					dv_frame_ptr & mixed_dv)
 {
     const dv_frame_ptr & pri_source_dv = m.source_frames[pri_source_id_];
     const dv_frame_ptr & sec_source_dv = m.source_frames[sec_source_id_];
@@ -690,20 +1162,80 @@ bool mixer::video_mix_pic_in_pic::apply(const mix_data & m,
 	sec_source_dv &&
 	dv_frame_system(sec_source_dv.get()) == m.format.system)
     {
-	// Decode sources
-	mixed_raw = decode_video_frame(decoder, pri_source_dv);
-	raw_frame_ptr sec_source_raw =
-	    decode_video_frame(decoder, sec_source_dv);
+	// Get decoded sources.  The primary is mixed in place.
+	mixed_raw = decoded.get_writable(pri_source_id_);
+	const raw_frame_ptr & sec_source_raw = decoded.get(sec_source_id_);
+	if (!mixed_raw || !sec_source_raw)
+	{
+	    mixed_raw.reset();
+	    return false;
+	}
+
+	// The scaler can't convert between pixel formats, which
+	// differ between the IEC and SMPTE variants of 625-line DV.
+	// Show the primary source alone until they match.
+	if (mixed_raw->pix_fmt != sec_source_raw->pix_fmt)
+	{
+	    if (!pix_fmt_mismatch_)
+		std::cerr << "WARN: Sources " << 1 + pri_source_id_
+			  << " and " << 1 + sec_source_id_
+			  << " have different pixel formats;"
+			  << " not showing picture-in-picture\n";
+	    pix_fmt_mismatch_ = true;
+	    mixed_raw.reset();
+	    mixed_dv = pri_source_dv;
+	    return false;
+	}
+
+	pix_fmt_mismatch_ = false;
 
 	// Mix raw video
-	video_effect_pic_in_pic(
-	    make_raw_frame_ref(mixed_raw), dest_region_,
-	    make_raw_frame_ref(sec_source_raw),
-	    raw_frame_system(sec_source_raw.get())->active_region);
+	const dv_system * system = raw_frame_system(sec_source_raw.get());
+	if (!scaler_.get() || system != scaler_system_
+	    || sec_source_raw->pix_fmt != scaler_pix_fmt_)
+	{
+	    // The region may have been configured without knowing the
+	    // video system, so keep it within the frame
+	    rectangle dest_region = dest_region_;
+	    dest_region &= system->active_region;
+	    scaler_.reset(video_effect_scaler_new(sec_source_raw->pix_fmt,
+						  dest_region,
+						  system->active_region));
+	    if (!scaler_.get())
+		throw std::bad_alloc();
+	    scaler_system_ = system;
+	    scaler_pix_fmt_ = sec_source_raw->pix_fmt;
+	}
+	video_effect_pic_in_pic_scaled(scaler_.get(),
+				       make_raw_frame_ref(mixed_raw),
+				       make_raw_frame_ref(sec_source_raw));
     }
     return false;
 }
 
+bool mixer::video_mix_pic_in_pic::is_unchanged(const mix_data & m)
+{
+    // Update both, even if the first differs
+    bool pri_same = update_last_frame(last_pri_source_dv_,
+				      m.source_frames[pri_source_id_]);
+    bool sec_same = update_last_frame(last_sec_source_dv_,
+				      m.source_frames[sec_source_id_]);
+    return pri_same && sec_same;
+}
+
+void mixer::video_mix_pic_in_pic::pass_through_video(const mix_data & m,
+						     dv_frame & mixed_dv)
+{
+    // Video segments that don't overlap the secondary picture are
+    // the same as in the primary source apart from generational loss,
+    // so restore them from it.  This only improves quality: the whole
+    // frame has already been decoded and encoded, as libavcodec can't
+    // encode part of a frame.
+    dv_buffer_copy_video_outside(mixed_dv.buffer,
+				 m.source_frames[pri_source_id_]->buffer,
+				 &dest_region_);
+}
+
 // Fade video mix - performs a linear interpolation of the values of both
 // sources on an 8-bit scale. Useful for fading.
 
@@ -718,6 +1250,7 @@ public:
 	  sec_source_id_(sec_source_id),
 	  timed_(timed),
 	  scale_(scale),
+	  last_scale_(scale),
 	  bucketsize_(ms / 255),
 	  modulo_(0),
 	  ms_per_frame_(0)
@@ -727,12 +1260,17 @@ public:
 private:
     virtual void validate(const mixer &);
     virtual void set_active(const mixer &, bool active);
-    virtual bool apply(const mix_data &, const auto_codec &, raw_frame_ptr &, dv_frame_ptr &);
+    virtual void want_decoded(const mix_data &, decoded_frames &);
+    virtual bool apply(const mix_data &, decoded_frames &, raw_frame_ptr &, dv_frame_ptr &);
     virtual void status(mixer::monitor * monitor);
+    virtual bool is_unchanged(const mix_data &);
 
     source_id pri_source_id_, sec_source_id_;
     bool timed_;
     uint8_t scale_;
+    // Inputs to the last mix, for is_unchanged()
+    uint8_t last_scale_;
+    dv_frame_ptr last_pri_source_dv_, last_sec_source_dv_;
     int bucketsize_;
     int modulo_;
     int ms_per_frame_;
@@ -762,8 +1300,28 @@ void mixer::video_mix_fade::status(mixer::monitor * monitor)
     monitor->effect_status(0, scale_, 255, timed_);
 }
 
+bool mixer::video_mix_fade::is_unchanged(const mix_data & m)
+{
+    // The scale only changes in apply() while timed, so it must have
+    // settled since the last mix
+    bool pri_same = update_last_frame(last_pri_source_dv_,
+				      m.source_frames[pri_source_id_]);
+    bool sec_same = update_last_frame(last_sec_source_dv_,
+				      m.source_frames[sec_source_id_]);
+    bool result = pri_same && sec_same && !timed_ && scale_ == last_scale_;
+    last_scale_ = scale_;
+    return result;
+}
+
+void mixer::video_mix_fade::want_decoded(const mix_data &,
+					decoded_frames & decoded)
+{
+    decoded.want(pri_source_id_);
+    decoded.want(sec_source_id_);
+}
+
 bool mixer::video_mix_fade::apply(const mix_data & m,
-				  const auto_codec & decoder,
+				  decoded_frames & decoded,
 				  raw_frame_ptr & mixed_raw,
 				  dv_frame_ptr &)
 {
@@ -798,10 +1356,14 @@ bool mixer::video_mix_fade::apply(const mix_data & m,
 	sec_source_dv &&
 	dv_frame_system(sec_source_dv.get()) == m.format.system)
     {
-	// Decode sources
-	mixed_raw = decode_video_frame(decoder, pri_source_dv);
-	raw_frame_ptr sec_source_raw =
-	    decode_video_frame(decoder, sec_source_dv);
+	// Get decoded sources.  The primary is mixed in place.
+	mixed_raw = decoded.get_writable(pri_source_id_);
+	const raw_frame_ptr & sec_source_raw = decoded.get(sec_source_id_);
+	if (!mixed_raw || !sec_source_raw)
+	{
+	    mixed_raw.reset();
+	    return retval;
+	}
 
 	// Mix raw video
 	video_effect_fade(make_raw_frame_ref(mixed_raw),
@@ -834,15 +1396,117 @@ mixer::create_video_mix_fade(source_id pri_source_id,
 
 void mixer::run_mixer()
 {
-    dv_frame_ptr last_mixed_dv;
     unsigned serial_num = 0;
-    const mix_data * m = 0;
+    std::vector<std::tr1::shared_ptr<video_mix> > last_video_mixes;
+
+    // Decode mix inputs concurrently, with up to one thread per CPU
+    decode_pool decoders(
+	std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1));
+    std::cout << "INFO: DV decoder threads: " << decoders.thread_count()
+	      << "\n";
+
+    for (;;)
+    {
+	output_data out;
+	const mix_data * m = &out.mix;
+
+	// Get the next set of source frames and mix settings (or stop
+	// if requested)
+	{
+	    boost::mutex::scoped_lock lock(mixer_mutex_);
+
+	    while (mixer_state_ != run_state_stop && mixer_queue_.empty())
+		mixer_state_cond_.wait(lock);
+	    if (mixer_state_ == run_state_stop)
+		break;
+
+	    mixer_queue_.pop_swap(out.mix);
+	}
+
+	for (unsigned id = 0; id != m->source_frames.size(); ++id)
+	    if (m->source_frames[id])
+		m->source_frames[id]->serial_num = serial_num;
+
+	out.serial_num = serial_num;
+
+	const std::size_t output_count = m->output_count();
+	out.outputs.resize(output_count);
+	last_video_mixes.resize(output_count);
 
-    auto_codec decoder(auto_codec_open_decoder(CODEC_ID_DVVIDEO));
-    AVCodecContext * dec = decoder.get();
-    dec->get_buffer = raw_frame_get_buffer;
-    dec->release_buffer = raw_frame_release_buffer;
-    dec->reget_buffer = raw_frame_reget_buffer;
+	{
+	    // If the inputs to an output's video mix haven't changed
+	    // since the last mix, the output thread can reuse the last
+	    // mixed video.  Otherwise find which sources the mix
+	    // needs decoded.
+	    out.decoded.reset(new decoded_frame_cache(serial_num));
+	    decoded_frames decoded(decoders, *m, *out.decoded);
+	    // The monitor may be able to use source frames decoded for
+	    // other outputs, so keep them intact for it.
+	    decoded.set_retained(monitor_ != 0 && output_count > 1);
+	    std::vector<bool> video_lost;
+	    {
+		boost::mutex::scoped_lock lock(output_mutex_);
+		video_lost.swap(output_video_lost_);
+	    }
+	    video_lost.resize(output_count, false);
+	    for (output_id id = 0; id != output_count; ++id)
+	    {
+		const std::tr1::shared_ptr<video_mix> & video_mix =
+		    m->output_video_mix(id);
+		if (!video_mix)
+		    continue;
+		out.outputs[id].reuse_video =
+		    (video_mix->is_unchanged(*m)
+		     && video_mix == last_video_mixes[id]
+		     && !video_lost[id]);
+		if (!out.outputs[id].reuse_video)
+		    video_mix->want_decoded(*m, decoded);
+		last_video_mixes[id] = video_mix;
+	    }
+
+	    // Decode the sources for all outputs together, then mix
+	    decoded.decode();
+	    for (output_id id = 0; id != output_count; ++id)
+	    {
+		const std::tr1::shared_ptr<video_mix> & video_mix =
+		    m->output_video_mix(id);
+		output_frames & frames = out.outputs[id];
+		if (video_mix && !frames.reuse_video
+		    && video_mix->apply(*m, decoded,
+					frames.mixed_raw, frames.mixed_dv)
+		    && id == main_output_id)
+		    video_mix->status(monitor_);
+	    }
+	}
+
+	// Hand over to the output thread, waiting if it is still busy
+	// with earlier frames
+	{
+	    boost::mutex::scoped_lock lock(output_mutex_);
+	    while (output_queue_.full())
+		output_space_cond_.wait(lock);
+	    output_queue_.push_swap(out);
+	    output_state_ = run_state_run;
+	    output_state_cond_.notify_one();
+	}
+
+	++serial_num;
+    }
+
+    {
+	boost::mutex::scoped_lock lock(output_mutex_);
+	output_state_ = run_state_stop;
+	output_state_cond_.notify_one();
+    }
+}
+
+void mixer::run_output()
+{
+    // Last frame and serial number of the last mix whose video was
+    // output, for each output
+    std::vector<dv_frame_ptr> last_mixed_dvs;
+    std::vector<unsigned> last_video_serial_nums;
+    const output_data * out = 0;
 
     auto_codec encoder(avcodec_alloc_context());
     AVCodecContext * enc = encoder.get();
@@ -871,110 +1535,189 @@ void mixer::run_mixer()
 
     for (;;)
     {
-	// Get the next set of source frames and mix settings (or stop
-	// if requested)
+	// Get the next mixed frame (or stop if requested)
 	{
-	    boost::mutex::scoped_lock lock(mixer_mutex_);
+	    boost::mutex::scoped_lock lock(output_mutex_);
 
-	    if (m)
-		mixer_queue_.pop();
+	    if (out)
+	    {
+		output_queue_.pop();
+		output_space_cond_.notify_one();
+	    }
 
-	    while (mixer_state_ != run_state_stop && mixer_queue_.empty())
-		mixer_state_cond_.wait(lock);
-	    if (mixer_state_ == run_state_stop)
+	    while (output_state_ != run_state_stop && output_queue_.empty())
+		output_state_cond_.wait(lock);
+	    if (output_state_ == run_state_stop)
 		break;
 
-	    m = &mixer_queue_.front();
+	    out = &output_queue_.front();
 	}
 
-	for (unsigned id = 0; id != m->source_frames.size(); ++id)
-	    if (m->source_frames[id])
-		m->source_frames[id]->serial_num = serial_num;
+	const mix_data * m = &out->mix;
+	unsigned serial_num = out->serial_num;
 
-	dv_frame_ptr mixed_dv;
-	raw_frame_ptr mixed_raw;
-
-	if (m->settings.video_mix->apply(*m, decoder, mixed_raw, mixed_dv))
-	    m->settings.video_mix->status(monitor_);
-
-	if (mixed_raw)
-	{
-	    // Encode mixed video
-	    const dv_system * system = m->format.system;
-	    enc->sample_aspect_ratio.num = system->pixel_aspect[m->format.frame_aspect].width;
-	    enc->sample_aspect_ratio.den = system->pixel_aspect[m->format.frame_aspect].height;
-	    // Work around libavcodec's aspect ratio confusion (bug #790)
-	    enc->sample_aspect_ratio.num *= 40;
-	    enc->sample_aspect_ratio.den *= 41;
-	    enc->time_base.num = system->frame_rate_denom;
-	    enc->time_base.den = system->frame_rate_numer;
-	    enc->width = system->frame_width;
-	    enc->height = system->frame_height;
-	    enc->pix_fmt = mixed_raw->pix_fmt;
-	    mixed_raw->header.pts = serial_num;
-  	    mixed_dv = allocate_dv_frame();
-	    int out_size = avcodec_encode_video(enc,
-						mixed_dv->buffer, system->size,
-						&mixed_raw->header);
-	    assert(size_t(out_size) == system->size);
-	    mixed_dv->serial_num = serial_num;
-
-	    // libavcodec doesn't properly distinguish IEC and SMPTE
-	    // variants of NTSC.  Fix the APTs here.
-	    if (system == &dv_system_525_60)
-	    {
-		uint8_t * block = mixed_dv->buffer;
-		unsigned apt = 0;
-		for (unsigned i = 4; i != 8; ++i)
-		    block[i] = (block[i] & 0xf8) | apt;
-	    }
+	const std::size_t output_count = out->outputs.size();
+	if (last_mixed_dvs.size() < output_count)
+	{
+	    last_mixed_dvs.resize(output_count);
+	    last_video_serial_nums.resize(output_count, 0);
 	}
 
-	if (!mixed_dv)
+	for (output_id id = 0; id != output_count; ++id)
 	{
-	    std::cerr << "WARN: Repeating mixed frame\n"; // XXX not very informative
+	    const std::tr1::shared_ptr<video_mix> & video_mix =
+		m->output_video_mix(id);
+	    if (!video_mix)
+		continue;
+
+	    dv_frame_ptr mixed_dv = out->outputs[id].mixed_dv;
+	    const raw_frame_ptr & mixed_raw = out->outputs[id].mixed_raw;
+	    dv_frame_ptr & last_mixed_dv = last_mixed_dvs[id];
+
+	    const source_id audio_source_id = m->output_audio_source_id(id);
+	    dv_frame_ptr audio_source_dv;
+	    if (audio_source_id < m->source_frames.size())
+		audio_source_dv = m->source_frames[audio_source_id];
+	    bool has_source_audio = false;
+
+	    // A source frame used as it is may also be used by other
+	    // outputs, the monitor and later ticks, and sinks may already
+	    // be sending it.  Copy it so we can replace the audio and
+	    // timecode.
+	    if (mixed_dv
+		&& std::find(m->source_frames.begin(), m->source_frames.end(),
+			     mixed_dv) != m->source_frames.end())
+	    {
+		has_source_audio = mixed_dv == audio_source_dv;
+		mixed_dv = copy_dv_frame(mixed_dv);
+	    }
 
-	    // Make a copy of the last mixed frame so we can
-	    // replace the audio.  (We can't modify the last frame
-	    // because sinks may still be reading from it.)
-	    mixed_dv = allocate_dv_frame();
-	    std::memcpy(mixed_dv.get(),
-			last_mixed_dv.get(),
-			offsetof(dv_frame, buffer)
-			+ dv_frame_system(last_mixed_dv.get())->size);
-	    mixed_dv->serial_num = serial_num;
-	}
+	    if (mixed_raw)
+	    {
+		// Encode mixed video
+		const dv_system * system = m->format.system;
+		enc->sample_aspect_ratio.num = system->pixel_aspect[m->format.frame_aspect].width;
+		enc->sample_aspect_ratio.den = system->pixel_aspect[m->format.frame_aspect].height;
+		// Work around libavcodec's aspect ratio confusion (bug #790)
+		enc->sample_aspect_ratio.num *= 40;
+		enc->sample_aspect_ratio.den *= 41;
+		enc->time_base.num = system->frame_rate_denom;
+		enc->time_base.den = system->frame_rate_numer;
+		enc->width = system->frame_width;
+		enc->height = system->frame_height;
+		enc->pix_fmt = mixed_raw->pix_fmt;
+		mixed_raw->header.pts = serial_num;
+		mixed_dv = allocate_dv_frame(std::nothrow);
+		if (mixed_dv)
+		{
+		    int out_size = avcodec_encode_video(enc,
+							mixed_dv->buffer, system->size,
+							&mixed_raw->header);
+		    assert(size_t(out_size) == system->size);
+		    mixed_dv->serial_num = serial_num;
+
+		    // libavcodec doesn't properly distinguish IEC and SMPTE
+		    // variants of NTSC.  Fix the APTs here.
+		    if (system == &dv_system_525_60)
+		    {
+			uint8_t * block = mixed_dv->buffer;
+			unsigned apt = 0;
+			for (unsigned i = 4; i != 8; ++i)
+			    block[i] = (block[i] & 0xf8) | apt;
+		    }
 
-	const dv_frame_ptr & audio_source_dv =
-	    m->source_frames[m->settings.audio_source_id];
+		    video_mix->pass_through_video(*m, *mixed_dv);
+		}
+	    }
+	    else if (out->outputs[id].reuse_video && last_mixed_dv
+		     && last_video_serial_nums[id] == serial_num - 1)
+	    {
+		// Copy the last mixed frame so we can replace the audio
+		// and timecode, as for a repeat
+		mixed_dv = copy_dv_frame(last_mixed_dv);
+		if (mixed_dv)
+		    mixed_dv->serial_num = serial_num;
+	    }
 
-	if (!audio_source_dv ||
-	    dv_frame_get_sample_rate(audio_source_dv.get()) != m->format.sample_rate)
-	{
-	    if (m->format.sample_rate >= 0)
-		dv_buffer_silence_audio(mixed_dv->buffer, m->format.sample_rate,
-					serial_num);
-	}
-	else if (mixed_dv != audio_source_dv)
-	    dv_buffer_dub_audio(mixed_dv->buffer, audio_source_dv->buffer);
+	    bool is_repeat = !mixed_dv;
+	    if (is_repeat)
+	    {
+		// Make the mixer thread mix this output's video again,
+		// since later frames can't reuse video we didn't produce
+		boost::mutex::scoped_lock lock(output_mutex_);
+		if (output_video_lost_.size() <= id)
+		    output_video_lost_.resize(id + 1, false);
+		output_video_lost_[id] = true;
+	    }
+	    if (is_repeat && last_mixed_dv)
+	    {
+		std::cerr << "WARN: Repeating mixed frame\n"; // XXX not very informative
+
+		// Make a copy of the last mixed frame so we can
+		// replace the audio.  (We can't modify the last frame
+		// because sinks may still be reading from it.)
+		mixed_dv = copy_dv_frame(last_mixed_dv);
+		if (mixed_dv)
+		    mixed_dv->serial_num = serial_num;
+	    }
 
-	set_times(*mixed_dv);
+	    if (!mixed_dv)
+	    {
+		// The DV frame pool is exhausted, or the output has
+		// only just started and has no frame to repeat.  Sinks
+		// will see a gap.
+		if (last_mixed_dv)
+		    std::cerr << "WARN: Dropped mixed frame for lack of buffers\n";
+		if (id == main_output_id)
+		{
+		    boost::mutex::scoped_lock lock(mixer_mutex_);
+		    ++mix_dropped_count_;
+		}
+		continue;
+	    }
 
-	mixed_dv->do_record = m->settings.do_record;
-	mixed_dv->cut_before = m->settings.cut_before;
+	    if (!audio_source_dv ||
+		dv_frame_get_sample_rate(audio_source_dv.get()) != m->format.sample_rate)
+	    {
+		if (m->format.sample_rate >= 0)
+		    dv_buffer_silence_audio(mixed_dv->buffer, m->format.sample_rate,
+					    serial_num);
+	    }
+	    else if (!has_source_audio || is_repeat)
+		dv_buffer_dub_audio(mixed_dv->buffer, audio_source_dv->buffer);
 
-	last_mixed_dv = mixed_dv;
-	++serial_num;
+	    set_times(*mixed_dv);
 
-	// Sink the frame
-	{
-	    boost::mutex::scoped_lock lock(sink_mutex_);
-	    for (sink_id id = 0; id != sinks_.size(); ++id)
-		if (sinks_[id])
-		    sinks_[id]->put_frame(mixed_dv);
+	    mixed_dv->do_record = m->settings.do_record;
+	    mixed_dv->cut_before = m->settings.cut_before;
+
+	    last_mixed_dv = mixed_dv;
+	    if (!is_repeat)
+		last_video_serial_nums[id] = serial_num;
+
+	    mixed_dv->mix_timestamp = frame_timer_get();
+	    if (id == main_output_id)
+	    {
+		boost::mutex::scoped_lock lock(mixer_mutex_);
+		++mix_count_;
+		if (is_repeat)
+		    ++repeat_count_;
+		mix_latency_.record(mixed_dv->mix_timestamp > m->tick_timestamp
+				    ? mixed_dv->mix_timestamp - m->tick_timestamp
+				    : 0);
+	    }
+
+	    // Sink the frame
+	    {
+		boost::mutex::scoped_lock lock(sink_mutex_);
+		for (sink_id sink = 0; sink != sinks_.size(); ++sink)
+		    if (sinks_[sink] && sink_outputs_[sink] == id)
+			sinks_[sink]->put_frame(mixed_dv);
+	    }
+	    if (monitor_ && id == main_output_id)
+		monitor_->put_frames(m->source_frames.size(), &m->source_frames[0],
+				     m->settings, mixed_dv, mixed_raw,
+				     out->decoded);
 	}
-	if (monitor_)
-	    monitor_->put_frames(m->source_frames.size(), &m->source_frames[0],
-				 m->settings, mixed_dv, mixed_raw);
     }
 }
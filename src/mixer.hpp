@@ -9,11 +9,14 @@
 #ifndef DVSWITCH_MIXER_HPP
 #define DVSWITCH_MIXER_HPP
 
+#include <algorithm>
 #include <cstddef>
+#include <string>
 #include <vector>
 
 #include <tr1/memory>
 
+#include <boost/atomic.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
@@ -21,6 +24,7 @@
 #include "auto_handle.hpp"
 #include "frame.h"
 #include "frame_pool.hpp"
+#include "frame_timer.h"
 #include "geometry.h"
 #include "ring_buffer.hpp"
 
@@ -29,12 +33,16 @@ namespace boost
     class thread;
 }
 
+class decoded_frame_cache;
+
 class mixer
 {
 public:
-    // Identifiers to distinguish mixer's sources and sinks
-    typedef unsigned source_id, sink_id;
+    // Identifiers to distinguish mixer's sources, sinks and outputs
+    typedef unsigned source_id, sink_id, output_id;
     static const unsigned invalid_id = -1;
+    // The main output, which always exists and has an empty name
+    static const output_id main_output_id = 0;
 
     // Settings for mixing/switching
     struct format_settings
@@ -59,6 +67,63 @@ public:
 	source_active_video = 1,
     };
 
+    // Latency statistics.  Bucket i of the histogram counts
+    // latencies less than bucket_limits[i] us; the last bucket
+    // counts all longer latencies.
+    struct latency_stats
+    {
+	latency_stats();
+	void record(uint64_t latency); // in ns
+
+	static const unsigned bucket_count = 12;
+	static const unsigned bucket_limits[bucket_count - 1];
+
+	uint64_t count;
+	uint64_t total, max; // in ns
+	uint64_t buckets[bucket_count];
+    };
+
+    // Statistics for a source.  Latency is from arrival of a frame to
+    // the clock tick that selects it.
+    struct source_stats
+    {
+	source_stats();
+	bool is_active;
+	std::size_t queue_len, queue_capacity;
+	uint64_t frame_count;	// frames selected by the clock
+	uint64_t missing_count;	// clock ticks with no frame available
+	uint64_t dropped_count;	// frames dropped due to full queue
+	latency_stats latency;
+    };
+
+    // Statistics for a sink.  Latency is from completion of mixing a
+    // frame to the sink sending its last byte.
+    struct sink_stats
+    {
+	sink_stats();
+	bool is_active;
+	std::size_t queue_len, queue_capacity;
+	uint64_t frame_count;	// frames sent
+	uint64_t dropped_count;	// frames dropped due to full queue
+	latency_stats latency;
+    };
+
+    // Statistics for the whole mixer.  Mixing latency is from a clock
+    // tick to completion of mixing the frames it selected.
+    struct stats
+    {
+	frame_timer_stats clock;
+	std::size_t mixer_queue_len, mixer_queue_capacity;
+	std::size_t output_queue_len, output_queue_capacity;
+	uint64_t mix_count;	// frames mixed
+	uint64_t repeat_count;	// mixed frames repeated
+	// clock ticks dropped due to full queue or lack of buffers
+	uint64_t mix_dropped_count;
+	latency_stats mix_latency;
+	std::vector<source_stats> sources;
+	std::vector<sink_stats> sinks;
+    };
+
     // Interface to sinks
     struct sink
     {
@@ -70,6 +135,9 @@ public:
 	// member of the frame can be used to check whether the
 	// frame is new.
 	virtual void put_frame(const dv_frame_ptr &) = 0;
+	// Fill in statistics for the sink, other than is_active.
+	// Sinks that don't keep statistics need not override this.
+	virtual void get_stats(sink_stats &) {}
     };
 
     struct source_settings
@@ -105,6 +173,8 @@ public:
 	//
 	// mixed_raw is a pointer to the raw video for the mixed
 	// frame, or null if the mixer did not need to decode video.
+	// decoded is the cache of decoded source frames for this
+	// tick, which should be used to avoid decoding them again.
 	//
 	// All DV frames may be shared and must not be modified.  Raw
 	// frames may be modified by the monitor.  All references and
@@ -112,13 +182,15 @@ public:
 	// returns; it must copy shared_ptrs to ensure that frames
 	// remain valid.
 	//
-	// This is called in the context of the mixer thread and should
-	// return quickly.
+	// This is called in the context of the mixer's output thread
+	// and should return quickly.
 	virtual void put_frames(unsigned source_count,
 				const dv_frame_ptr * source_dv,
 				mix_settings,
 				const dv_frame_ptr & mixed_dv,
-				const raw_frame_ptr & mixed_raw) = 0;
+				const raw_frame_ptr & mixed_raw,
+				const std::tr1::shared_ptr<decoded_frame_cache> &
+				decoded) = 0;
 	virtual void effect_status(int min, int cur, int max, bool more) = 0;
     };
 
@@ -135,8 +207,10 @@ public:
     void put_frame(source_id, const dv_frame_ptr &);
 
     // Interface for sinks
-    // Register and unregister sinks
-    sink_id add_sink(sink *, bool will_record);
+    // Register and unregister sinks.  A sink receives the frames
+    // mixed for one output.
+    sink_id add_sink(sink *, bool will_record,
+		     output_id output = main_output_id);
     void remove_sink(sink_id, bool will_record);
 
     // Interface for monitors
@@ -169,60 +243,208 @@ public:
     void cut();
     // Enable/disable recording
     void enable_record(bool);
+    // Run the clock thread at the given real-time priority
+    void set_clock_priority(int priority);
+    // Get a snapshot of the clock's wakeup lateness statistics
+    frame_timer_stats get_clock_stats() const;
+    // Get a snapshot of all statistics
+    stats get_stats() const;
+
+    // Additional outputs.  Each output has its own video mix and
+    // audio source, but they all share the clock and source frames
+    // and have the same recording state.  Their video mixes may
+    // refer to sources that have not yet been registered; the
+    // output produces no frames until they are.  A video mix must
+    // not be used for more than one output at a time.
+    // Add an output with the given name, initially copying source 1
+    output_id add_output(const std::string & name);
+    // Find an output by name, returning invalid_id if there is none
+    output_id find_output(const std::string & name) const;
+    void set_output_video_mix(output_id, std::tr1::shared_ptr<video_mix>);
+    void set_output_audio_source(output_id, source_id);
 
 private:
     class video_mix_pic_in_pic;
     class video_mix_simple;
     class video_mix_fade;
+    class decoded_frames;
 
     // Source data.  We want to allow a bit of leeway in the input
     // pipeline before we have to drop or repeat a frame.  At the
     // same time we don't want to add much to latency.  We try to
     // keep the queue half-full so there are 2 frame-times
     // (66-80 ms) of added latency here.
+    // The frame queue is written by the source's thread and read by
+    // the clock thread, without locking.
     static const std::size_t target_queue_len = 2;
     static const std::size_t full_queue_len = target_queue_len * 2;
     struct source_data
     {
-	source_data() : frames(full_queue_len), src(NULL) {}
-	ring_buffer<dv_frame_ptr> frames;
+	source_data();
+	source_data(const source_data &);
+	source_data & operator=(const source_data &);
+	void reset_stats();
+	spsc_ring_buffer<dv_frame_ptr> frames;
 	source * src;
+	// Statistics.  dropped_count is written by put_frame() and the
+	// rest by the clock thread.
+	boost::atomic<uint64_t> dropped_count;
+	uint64_t frame_count, missing_count;
+	latency_stats latency;
+    };
+    static const std::size_t max_sources = 32;
+
+    // Settings for an additional output
+    struct output_settings
+    {
+	std::string name;
+	std::tr1::shared_ptr<mixer::video_mix> video_mix;
+	source_id audio_source_id;
+	bool is_valid;		// all sources of the video mix are registered
+    };
+
+    // Format settings, which sources may auto-select without locking
+    struct atomic_format_settings
+    {
+	boost::atomic<const dv_system *> system;
+	boost::atomic<dv_frame_aspect> frame_aspect;
+	boost::atomic<dv_sample_rate> sample_rate;
+    };
+
+    // Video mix and audio source of an additional output for one
+    // tick.  The video mix is null if the output is not yet valid.
+    struct output_mix
+    {
+	std::tr1::shared_ptr<mixer::video_mix> video_mix;
+	source_id audio_source_id;
     };
 
     struct mix_data
     {
+	uint64_t tick_timestamp;
 	std::vector<dv_frame_ptr> source_frames;
 	format_settings format;
 	mix_settings settings;
+	std::vector<output_mix> extra_outputs;
+
+	std::size_t output_count() const
+	{
+	    return 1 + extra_outputs.size();
+	}
+	const std::tr1::shared_ptr<mixer::video_mix> &
+	output_video_mix(output_id id) const
+	{
+	    return id == main_output_id
+		? settings.video_mix : extra_outputs[id - 1].video_mix;
+	}
+	source_id output_audio_source_id(output_id id) const
+	{
+	    return id == main_output_id
+		? settings.audio_source_id
+		: extra_outputs[id - 1].audio_source_id;
+	}
+
+	// Mix data is swapped from thread to thread rather than
+	// copied, so that frame and video mix references are not
+	// repeatedly taken and dropped.
+	friend void swap(mix_data & left, mix_data & right)
+	{
+	    using std::swap;
+	    swap(left.tick_timestamp, right.tick_timestamp);
+	    left.source_frames.swap(right.source_frames);
+	    swap(left.format, right.format);
+	    left.settings.video_mix.swap(right.settings.video_mix);
+	    swap(left.settings.audio_source_id, right.settings.audio_source_id);
+	    swap(left.settings.do_record, right.settings.do_record);
+	    swap(left.settings.cut_before, right.settings.cut_before);
+	    left.extra_outputs.swap(right.extra_outputs);
+	}
     };
 
+    // Results of mixing, passed from the mixer thread to the output
+    // thread.  Encoding and output of one frame overlap with
+    // decoding and mixing of the next.  The queue is kept short
+    // since each entry adds a frame-time of latency; if the output
+    // thread falls behind then the mixer thread waits for it, and
+    // the clock thread will drop ticks as the mixer queue fills.
+    struct output_frames
+    {
+	output_frames() : reuse_video(false) {}
+	raw_frame_ptr mixed_raw;
+	dv_frame_ptr mixed_dv;
+	// The video is the same as for the previous mix, so the
+	// output thread may reuse the last mixed frame's video
+	bool reuse_video;
+    };
+    struct output_data
+    {
+	mix_data mix;
+	unsigned serial_num;
+	std::vector<output_frames> outputs; // indexed by output_id
+	std::tr1::shared_ptr<decoded_frame_cache> decoded;
+
+	friend void swap(output_data & left, output_data & right)
+	{
+	    using std::swap;
+	    swap(left.mix, right.mix);
+	    swap(left.serial_num, right.serial_num);
+	    left.outputs.swap(right.outputs);
+	    left.decoded.swap(right.decoded);
+	}
+    };
+    static const std::size_t output_queue_len = 2;
+
     enum run_state {
 	run_state_wait,
 	run_state_run,
 	run_state_stop
     };
 
+    void check_format(source_id, dv_frame &);
+    void update_output_validity(output_settings &);
+
     void run_clock();   // clock thread function
     void run_mixer();   // mixer thread function
+    void run_output();  // output thread function
+
+    atomic_format_settings format_;
 
     mutable boost::mutex source_mutex_; // controls access to the following
-    format_settings format_;
     mix_settings settings_;
+    std::vector<output_settings> outputs_; // indexed by output_id - 1
+    // The vector is only resized under the lock, but elements are
+    // accessed by put_frame() without it.  Capacity is reserved up
+    // front so that it is never reallocated.
     std::vector<source_data> sources_;
     run_state clock_state_;
     boost::condition clock_state_cond_;
+    boost::atomic<bool> clock_running_;
+    frame_timer_stats clock_stats_;
 
     boost::thread clock_thread_;
 
-    boost::mutex mixer_mutex_; // controls access to the following
+    mutable boost::mutex mixer_mutex_; // controls access to the following
     ring_buffer<mix_data> mixer_queue_;
     run_state mixer_state_;
     boost::condition mixer_state_cond_;
+    uint64_t mix_count_, repeat_count_, mix_dropped_count_;
+    latency_stats mix_latency_;
+
+    mutable boost::mutex output_mutex_; // controls access to the following
+    ring_buffer<output_data> output_queue_;
+    run_state output_state_;
+    boost::condition output_state_cond_, output_space_cond_;
+    // Outputs for which the output thread failed to produce video,
+    // so that the mixer thread must mix them again rather than
+    // reusing the last video; indexed by output_id
+    std::vector<bool> output_video_lost_;
 
     boost::thread mixer_thread_;
+    boost::thread output_thread_;
 
-    boost::mutex sink_mutex_; // controls access to the following
+    mutable boost::mutex sink_mutex_; // controls access to the following
     std::vector<sink *> sinks_;
+    std::vector<output_id> sink_outputs_;
     unsigned recorders_count_;
 
     monitor * monitor_;
@@ -20,6 +20,7 @@
 #include <gtkmm/stockid.h>
 
 #include "connector.hpp"
+#include "decoded_frame_cache.hpp"
 #include "format_dialog.hpp"
 #include "frame.h"
 #include "gui.hpp"
@@ -91,8 +92,7 @@ mixer_window::mixer_window(mixer & mixer, connector & connector)
       pip_active_(false),
       pip_pending_(false),
       progress_active_(false),
-      wakeup_pipe_(O_NONBLOCK, O_NONBLOCK),
-      next_source_id_(0)
+      wakeup_pipe_(O_NONBLOCK, O_NONBLOCK)
 {
     record_button_.set_use_stock();
     cut_button_.set_use_stock();
@@ -520,7 +520,9 @@ void mixer_window::put_frames(unsigned source_count,
 			      const dv_frame_ptr * source_dv,
 			      mixer::mix_settings mix_settings,
 			      const dv_frame_ptr & mixed_dv,
-			      const raw_frame_ptr & mixed_raw)
+			      const raw_frame_ptr & mixed_raw,
+			      const std::tr1::shared_ptr<decoded_frame_cache> &
+			      decoded)
 {
     {
 	boost::mutex::scoped_lock lock(frame_mutex_);
@@ -528,6 +530,7 @@ void mixer_window::put_frames(unsigned source_count,
 	mix_settings_ = mix_settings;
 	mixed_dv_ = mixed_dv;
 	mixed_raw_ = mixed_raw;
+	decoded_ = decoded;
     }
 
     // Poke the event loop.
@@ -547,15 +550,29 @@ bool mixer_window::update(Glib::IOCondition) throw()
 	dv_frame_ptr mixed_dv;
 	std::vector<dv_frame_ptr> source_dv;
 	raw_frame_ptr mixed_raw;
+	std::tr1::shared_ptr<decoded_frame_cache> decoded;
 
 	{
 	    boost::mutex::scoped_lock lock(frame_mutex_);
-	    mixed_dv = mixed_dv_;
-	    mixed_dv_.reset();
-	    source_dv = source_dv_;
-	    source_dv_.clear();
-	    mixed_raw = mixed_raw_;
-	    mixed_raw_.reset();
+	    mixed_dv.swap(mixed_dv_);
+	    source_dv.swap(source_dv_);
+	    mixed_raw.swap(mixed_raw_);
+	    decoded.swap(decoded_);
+	}
+
+	// If the mixed video is just a source frame that the mixer
+	// decoded anyway (for another output), display that rather
+	// than decoding it again.
+	if (!mixed_raw && mixed_dv && decoded)
+	{
+	    for (mixer::source_id id = 0; id != source_dv.size(); ++id)
+	    {
+		if (source_dv[id] == mixed_dv)
+		{
+		    mixed_raw = decoded->find(id, decoded->serial_num());
+		    break;
+		}
+	    }
 	}
 
 	bool can_record = mixer_.can_record();
@@ -582,28 +599,11 @@ bool mixer_window::update(Glib::IOCondition) throw()
         switch_a_b_button_.set_sensitive(count >= 2);
 	pip_box_.set_sensitive(count >= 2);
 
-	// Update the thumbnail displays of sources.  If a new mixed frame
-	// arrives while we were doing this, return to the event loop.
-	// (We want to handle the next mixed frame but we need to let it
-	// handle other events as well.)  Use a rota for source updates so
-	// even if we don't have time to run them all at full frame rate
-	// they all get updated at roughly the same rate.
-
-	for (std::size_t i = 0; i != source_dv.size(); ++i)
-	{
-	    if (next_source_id_ >= source_dv.size())
-		next_source_id_ = 0;
-	    mixer::source_id id = next_source_id_++;
-
+	// Update the thumbnail displays of sources.  The selector
+	// decodes them in other threads, so this is quick.
+	for (mixer::source_id id = 0; id != source_dv.size(); ++id)
 	    if (source_dv[id])
-	    {
 		selector_.put_frame(id, source_dv[id]);
-
-		boost::mutex::scoped_lock lock(frame_mutex_);
-		if (mixed_dv_)
-		    break;
-	    }
-	}
     }
     catch (std::exception & e)
     {
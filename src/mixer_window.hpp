@@ -62,7 +62,9 @@ private:
 			    const dv_frame_ptr * source_dv,
 			    mixer::mix_settings,
 			    const dv_frame_ptr & mixed_dv,
-			    const raw_frame_ptr & mixed_raw);
+			    const raw_frame_ptr & mixed_raw,
+			    const std::tr1::shared_ptr<decoded_frame_cache> &
+			    decoded);
     virtual void effect_status(int min, int cur, int max, bool more);
 
     mixer & mixer_;
@@ -122,10 +124,10 @@ private:
 
     boost::mutex frame_mutex_; // controls access to the following
     std::vector<dv_frame_ptr> source_dv_;
-    mixer::source_id next_source_id_;
     mixer::mix_settings mix_settings_;
     dv_frame_ptr mixed_dv_;
     raw_frame_ptr mixed_raw_;
+    std::tr1::shared_ptr<decoded_frame_cache> decoded_;
 };
 
 #endif // !defined(DVSWITCH_MIXER_WINDOW_HPP)
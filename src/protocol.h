@@ -20,6 +20,16 @@
 #define GREETING_SINK "SINK"
 // As above, but receives only frames to be recorded.
 #define GREETING_REC_SINK "SNKR"
+// Monitoring client which receives a text snapshot of the mixer's
+// statistics, after which the mixer closes the connection.
+#define GREETING_STATS "STAT"
+// Sink which selects one of the mixer's named outputs.  This is
+// followed by a 1-byte name length, the name (not terminated), and
+// then one of the sink greetings above.  An empty name selects the
+// main output.
+#define GREETING_SELECT_OUTPUT "OUTP"
+// Maximum length of an output name.
+#define OUTPUT_NAME_MAX 255
 
 // Length of the frame header.
 #define SINK_FRAME_HEADER_SIZE 4
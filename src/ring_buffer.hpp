@@ -1,7 +1,7 @@
 // Copyright 2007, 2011 Ben Hutchings.
 // See the file "COPYING" for licence details.
 
-// Class template for ring buffers
+// Class templates for ring buffers
 
 #ifndef DVSWITCH_RING_BUFFER_HPP
 #define DVSWITCH_RING_BUFFER_HPP
@@ -12,6 +12,8 @@
 
 #include <tr1/type_traits>
 
+#include <boost/atomic.hpp>
+
 template<typename T>
 class ring_buffer;
 
@@ -45,6 +47,14 @@ public:
     void push(const T &);
     const T & back() const;
 
+    // Swapping variants of push and pop, which hand over a value
+    // without copying it.  push_swap() leaves value
+    // default-constructed; pop_swap() leaves it with the former
+    // front value.  T must be default-constructible and its swap()
+    // should be cheap.
+    void push_swap(T & value);
+    void pop_swap(T & value);
+
     friend void swap<T>(ring_buffer & left, ring_buffer & right);
 
 private:
@@ -124,6 +134,25 @@ const T & ring_buffer<T>::back() const
     return buffer_[(back_ - 1) % capacity_];
 }
 
+template<typename T>
+void ring_buffer<T>::push_swap(T & value)
+{
+    assert(!full());
+    T * slot = new (&buffer_[back_ % capacity_]) T();
+    using std::swap;
+    swap(*slot, value);
+    ++back_;
+}
+
+template<typename T>
+void ring_buffer<T>::pop_swap(T & value)
+{
+    assert(!empty());
+    using std::swap;
+    swap(buffer_[front_ % capacity_], value);
+    pop();
+}
+
 template<typename T>
 void swap(ring_buffer<T> & left, ring_buffer<T> & right)
 {
@@ -134,4 +163,139 @@ void swap(ring_buffer<T> & left, ring_buffer<T> & right)
     swap(left.buffer_, right.buffer_);
 }
 
+// Ring buffer that may be used concurrently by a single reader
+// thread and a single writer thread without locking.  Only the
+// reader may call the reader functions and only the writer may call
+// the writer functions.  The size, empty and full functions may be
+// called by either, but the result is only a snapshot and may be
+// out-of-date by the time it's used: the reader can rely on
+// !empty() and the writer on !full().
+//
+// Copying is not thread-safe.
+
+template<typename T>
+class spsc_ring_buffer
+{
+public:
+    explicit spsc_ring_buffer(std::size_t capacity)
+	: capacity_(capacity), front_(0), back_(0),
+	  buffer_(reinterpret_cast<T *>(new char[sizeof(T) * capacity_]))
+    {}
+    spsc_ring_buffer(const spsc_ring_buffer &);
+    ~spsc_ring_buffer();
+    spsc_ring_buffer & operator=(const spsc_ring_buffer &);
+
+    std::size_t capacity() const { return capacity_; }
+    std::size_t size() const
+    {
+	std::size_t back = back_.load(boost::memory_order_acquire);
+	return back - front_.load(boost::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    bool full() const { return size() == capacity_; }
+
+    // Reader functions
+    void pop();
+    void pop_swap(T & value); // as for ring_buffer
+    const T & front() const;
+
+    // Writer functions
+    void push(const T &);
+
+private:
+    std::size_t capacity_;
+    // Keep the indices on separate cache lines so the reader and
+    // writer don't keep stealing them from each other.
+    char pad0_[64];
+    boost::atomic<std::size_t> front_; // written only by reader
+    char pad1_[64];
+    boost::atomic<std::size_t> back_;  // written only by writer
+    char pad2_[64];
+    T * buffer_;
+};
+
+template<typename T>
+spsc_ring_buffer<T>::spsc_ring_buffer(const spsc_ring_buffer & other)
+    : capacity_(other.capacity_), front_(0), back_(0),
+      buffer_(reinterpret_cast<T *>(new char[sizeof(T) * capacity_]))
+{
+    std::size_t front = other.front_.load(boost::memory_order_relaxed);
+    std::size_t back = other.back_.load(boost::memory_order_relaxed);
+    try
+    {
+	for (std::size_t i = front; i != back; ++i)
+	    push(other.buffer_[i % capacity_]);
+    }
+    catch (...)
+    {
+	while (!empty())
+	    pop();
+	delete[] reinterpret_cast<char*>(buffer_);
+	throw;
+    }
+}
+
+template<typename T>
+spsc_ring_buffer<T>::~spsc_ring_buffer()
+{
+    while (!empty())
+	pop();
+    delete[] reinterpret_cast<char*>(buffer_);
+}
+
+template<typename T>
+spsc_ring_buffer<T> &
+spsc_ring_buffer<T>::operator=(const spsc_ring_buffer & other)
+{
+    while (!empty())
+	pop();
+
+    std::size_t front = other.front_.load(boost::memory_order_relaxed);
+    std::size_t back = other.back_.load(boost::memory_order_relaxed);
+    assert(back - front <= capacity_);
+    for (std::size_t i = front; i != back; ++i)
+	push(other.buffer_[i % other.capacity_]);
+
+    return *this;
+}
+
+template<typename T>
+void spsc_ring_buffer<T>::pop()
+{
+    std::size_t front = front_.load(boost::memory_order_relaxed);
+    assert(back_.load(boost::memory_order_acquire) != front);
+    buffer_[front % capacity_].~T();
+    // Release the slot to the writer only after destroying the value
+    front_.store(front + 1, boost::memory_order_release);
+}
+
+template<typename T>
+void spsc_ring_buffer<T>::pop_swap(T & value)
+{
+    std::size_t front = front_.load(boost::memory_order_relaxed);
+    assert(back_.load(boost::memory_order_acquire) != front);
+    using std::swap;
+    swap(buffer_[front % capacity_], value);
+    buffer_[front % capacity_].~T();
+    front_.store(front + 1, boost::memory_order_release);
+}
+
+template<typename T>
+const T & spsc_ring_buffer<T>::front() const
+{
+    std::size_t front = front_.load(boost::memory_order_relaxed);
+    assert(back_.load(boost::memory_order_acquire) != front);
+    return buffer_[front % capacity_];
+}
+
+template<typename T>
+void spsc_ring_buffer<T>::push(const T & value)
+{
+    std::size_t back = back_.load(boost::memory_order_relaxed);
+    assert(back - front_.load(boost::memory_order_acquire) != capacity_);
+    new (&buffer_[back % capacity_]) T(value);
+    // Publish the value to the reader only after constructing it
+    back_.store(back + 1, boost::memory_order_release);
+}
+
 #endif // !defined(DVSWITCH_RING_BUFFER_HPP)
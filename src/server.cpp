@@ -3,38 +3,178 @@
 
 // Server for the original network protocol
 
+#include <algorithm>
 #include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <ostream>
+#include <set>
+#include <sstream>
 #include <stdexcept>
 
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/errqueue.h>
+
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "frame.h"
+#include "frame_pool.hpp"
+#include "frame_timer.h"
 #include "mixer.hpp"
 #include "os_error.hpp"
 #include "protocol.h"
 #include "server.hpp"
 #include "socket.h"
 
+// Older C library headers may not define this, but the kernel will
+// ignore it if it's too old to support it.
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+// Similarly for zero-copy transmission, though setting SO_ZEROCOPY
+// will fail if it's not supported.
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#ifndef TCP_USER_TIMEOUT
+#define TCP_USER_TIMEOUT 18
+#endif
+
 namespace
 {
     // Numbers used in the message pipe
     enum {
 	message_quit = -1
     };
+
+    // Maximum number of events handled per call to epoll_wait()
+    const int max_events = 64;
+
+    // Check whether a reserved DV frame pool is down to its last
+    // quarter
+    bool dv_frame_pool_is_short()
+    {
+	frame_pool_stats stats(get_dv_frame_pool_stats());
+	return stats.limit && (stats.limit - stats.in_use) * 4 < stats.limit;
+    }
+
+    // Time to wait for a dropped sink to acknowledge frames sent with
+    // zero-copy, in milliseconds
+    const unsigned zero_copy_linger_ms = 10000;
+
+    // Frames sent with MSG_ZEROCOPY.  The kernel numbers zero-copy
+    // sends consecutively and later reports ranges of them as
+    // complete.  Until then it may still read from the frame
+    // buffers, so we must keep references to them.
+    class zero_copy_queue
+    {
+    public:
+	zero_copy_queue()
+	    : next_num_(0),
+	      copied_(false)
+	{}
+
+	// Record a successful zero-copy send of (part of) a frame
+	void push(const dv_frame_ptr & frame)
+	{
+	    frames_.push_back(std::make_pair(next_num_++, frame));
+	}
+	bool empty() const { return frames_.empty(); }
+	// Return whether the kernel has had to copy rather than
+	// transmitting directly from the frame buffers
+	bool copied() const { return copied_; }
+
+	// Read completion notifications from the socket's error queue
+	// and release the completed frames.  Set handled if there
+	// were any.  Return false if the error queue held anything
+	// else.
+	bool read_completions(int socket, bool & handled);
+
+	friend void swap(zero_copy_queue & left, zero_copy_queue & right)
+	{
+	    using std::swap;
+	    swap(left.next_num_, right.next_num_);
+	    swap(left.copied_, right.copied_);
+	    left.frames_.swap(right.frames_);
+	}
+
+    private:
+	void release(uint32_t last_num);
+
+	uint32_t next_num_;
+	bool copied_;
+	std::deque<std::pair<uint32_t, dv_frame_ptr> > frames_;
+    };
+
+    bool zero_copy_queue::read_completions(int socket, bool & handled)
+    {
+	handled = false;
+
+	for (;;)
+	{
+	    char control[CMSG_SPACE(sizeof(sock_extended_err))
+			 + CMSG_SPACE(sizeof(sockaddr_storage))];
+	    msghdr message = {};
+	    message.msg_control = control;
+	    message.msg_controllen = sizeof(control);
+	    if (recvmsg(socket, &message, MSG_ERRQUEUE) < 0)
+		return true;
+
+	    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+		 cmsg;
+		 cmsg = CMSG_NXTHDR(&message, cmsg))
+	    {
+		if (!((cmsg->cmsg_level == SOL_IP
+		       && cmsg->cmsg_type == IP_RECVERR)
+		      || (cmsg->cmsg_level == SOL_IPV6
+			  && cmsg->cmsg_type == IPV6_RECVERR)))
+		    continue;
+		const sock_extended_err * error =
+		    reinterpret_cast<const sock_extended_err *>(
+			CMSG_DATA(cmsg));
+		if (error->ee_errno != 0
+		    || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		    return false;
+
+		// ee_info and ee_data are the first and last send numbers
+		release(error->ee_data);
+		handled = true;
+		if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+		    copied_ = true;
+	    }
+	}
+    }
+
+    void zero_copy_queue::release(uint32_t last_num)
+    {
+	while (!frames_.empty()
+	       && int32_t(frames_.front().first - last_num) <= 0)
+	    frames_.pop_front();
+    }
 }
 
 // connection: base class for client connections
@@ -45,12 +185,28 @@ public:
     enum send_status {
 	send_failed,
 	sent_some,
-	sent_all
+	sent_all,
+	sent_final		// sent all and connection is finished
     };
 
     virtual ~connection() {}
-    connection * do_receive();
-    virtual send_status do_send() { return send_failed; }
+    // Receive as much as is available, until the socket buffer is
+    // drained or the connection is replaced by a more specific one.
+    // Return this, the replacement connection, or null if the
+    // connection should be dropped.
+    connection * do_receive(bool & drained);
+    virtual send_status do_send() { return sent_all; }
+    // Handle an error condition on the socket.  Return true if it
+    // was only a notification and the connection can continue.
+    virtual bool do_error() { return false; }
+    // Handle the connection being hung up.  Return true if the
+    // connection should continue anyway.
+    virtual bool do_hangup() { return false; }
+    // Prepare for the connection to be dropped.  Return a connection
+    // to take over the socket, or null if it can be closed.
+    virtual connection * handle_drop() { return 0; }
+
+    int get_socket() const { return socket_.get(); }
 
 protected:
     struct receive_buffer
@@ -67,23 +223,22 @@ protected:
 	std::size_t size;
     };
 
-    connection(server & server, auto_fd socket);
+    connection(server & server, worker & worker, auto_fd socket);
 
-    void schedule_send()
-    {
-	int fd = socket_.get();
-	os_check_zero(
-	    "write",
-	    write(server_.message_pipe_.writer.get(), &fd, sizeof(int))
-	    - sizeof(int));
-    }
+    // Wake the owning worker to send on this connection.  This may
+    // be called from any thread.
+    void schedule_send();
 
     server & server_;
+    worker & worker_;
     auto_fd socket_;
 
 private:
     virtual receive_buffer get_receive_buffer() = 0;
     virtual connection * handle_complete_receive() = 0;
+    // Handle the client shutting down its side of the connection.
+    // Return this if the connection should continue, or null.
+    virtual connection * handle_end_of_input() { return 0; }
     virtual std::ostream & print_identity(std::ostream &) = 0;
 
     receive_buffer receive_buffer_;
@@ -94,14 +249,23 @@ private:
 class server::unknown_connection : public connection
 {
 public:
-    unknown_connection(server & server, auto_fd socket);
+    unknown_connection(server & server, worker & worker, auto_fd socket);
 
 private:
     virtual receive_buffer get_receive_buffer();
     virtual connection * handle_complete_receive();
     virtual std::ostream & print_identity(std::ostream &);
 
+    enum {
+	state_greeting,
+	state_name_length,
+	state_name
+    } state_;
     uint8_t greeting_[4];
+    uint8_t name_length_;
+    char name_[OUTPUT_NAME_MAX];
+    bool output_selected_;
+    mixer::output_id output_id_;
 };
 
 // source_connection: connection from source
@@ -109,7 +273,8 @@ private:
 class server::source_connection : public connection, private mixer::source
 {
 public:
-    source_connection(server & server, auto_fd socket, bool wants_act = false);
+    source_connection(server & server, worker & worker, auto_fd socket,
+		      bool wants_act = false);
     virtual ~source_connection();
 
 private:
@@ -122,8 +287,10 @@ private:
 
     dv_frame_ptr frame_;
     bool first_sequence_;
+    bool starved_;		// dropping frames for lack of buffers
     bool wants_act_;		// client wants activation messages
     mixer::source_activation act_flags_;
+    bool act_pending_;		// activation flags changed since last message
     char act_message_[ACT_MSG_SIZE];
     std::size_t act_message_pos_;
 
@@ -135,7 +302,9 @@ private:
 class server::sink_connection : public connection, private mixer::sink
 {
 public:
-    sink_connection(server &, auto_fd socket, bool is_raw, bool will_record);
+    sink_connection(server &, worker &, auto_fd socket,
+		    bool is_raw, bool will_record,
+		    mixer::output_id output_id);
     virtual ~sink_connection();
 
 private:
@@ -143,14 +312,23 @@ private:
     {
 	dv_frame_ptr frame;
 	bool overflow_before;
+
+	friend void swap(queue_elem & left, queue_elem & right)
+	{
+	    left.frame.swap(right.frame);
+	    std::swap(left.overflow_before, right.overflow_before);
+	}
     };
 
     virtual send_status do_send();
+    virtual bool do_error();
+    virtual connection * handle_drop();
     virtual receive_buffer get_receive_buffer();
     virtual connection * handle_complete_receive();
     virtual std::ostream & print_identity(std::ostream &);
 
     virtual void put_frame(const dv_frame_ptr & frame);
+    virtual void get_stats(mixer::sink_stats &);
 
     receive_buffer handle_unexpected_input();
 
@@ -160,193 +338,358 @@ private:
     mixer::sink_id sink_id_;
     std::size_t frame_pos_;
 
+    bool zero_copy_;		// SO_ZEROCOPY is enabled
+    bool zero_copy_copied_;	// kernel fell back to copying
+    zero_copy_queue zero_copy_sends_;
+
     boost::mutex mutex_; // controls access to the following
     ring_buffer<queue_elem> queue_;
     bool overflowed_;
+    uint64_t frame_count_, dropped_count_;
+    mixer::latency_stats latency_;
+};
+
+// closing_connection: socket of a dropped sink connection that has
+// zero-copy sends outstanding.  It stays open until the kernel has
+// finished with the frames, since we can't find out once it's closed.
+
+class server::closing_connection : public connection
+{
+public:
+    closing_connection(server &, worker &, auto_fd socket,
+		       zero_copy_queue & sends);
+
+private:
+    virtual bool do_error();
+    virtual bool do_hangup();
+    virtual receive_buffer get_receive_buffer();
+    virtual connection * handle_complete_receive();
+    virtual std::ostream & print_identity(std::ostream &);
+
+    zero_copy_queue sends_;
+};
+
+// stats_connection: connection from monitoring client
+
+class server::stats_connection : public connection
+{
+public:
+    stats_connection(server &, worker &, auto_fd socket);
+
+private:
+    virtual send_status do_send();
+    virtual receive_buffer get_receive_buffer();
+    virtual connection * handle_complete_receive();
+    virtual connection * handle_end_of_input();
+    virtual std::ostream & print_identity(std::ostream &);
+
+    std::string message_;
+    std::size_t message_pos_;
+};
+
+// worker: thread servicing a shard of the client connections
+//
+// Each worker has its own epoll instance in which the listening
+// socket is registered exclusively, so each new connection is
+// accepted by (and then belongs to) exactly one worker.  Client
+// sockets are registered edge-triggered, so each wakeup only costs
+// in proportion to the number of ready connections.
+
+class server::worker
+{
+public:
+    explicit worker(server & server);
+    ~worker();
+
+    void run();
+
+    int get_epoll_fd() const { return epoll_fd_.get(); }
+
+private:
+    void accept_connection();
+    void handle_event(connection * conn, uint32_t events);
+    void drop_connection(connection * conn);
+
+    server & server_;
+    auto_fd epoll_fd_;
+    std::set<connection *> connections_;
 };
 
 // server implementation
 
 server::server(const std::string & host, const std::string & port,
-	       mixer & mixer)
+	       mixer & mixer, bool zero_copy)
     : mixer_(mixer),
+      zero_copy_(zero_copy),
       listen_socket_(create_listening_socket(host.c_str(), port.c_str())),
       message_pipe_(O_NONBLOCK, O_NONBLOCK)
 {
-    server_thread_.reset(new boost::thread(boost::bind(&server::serve, this)));
+    // Workers may be woken together and race to accept connections,
+    // so the listening socket must not block.
+    os_check_nonneg("fcntl",
+		    fcntl(listen_socket_.get(), F_SETFL, O_NONBLOCK));
+
+    // Try to use one thread per CPU, up to a limit of 4
+    int worker_count =
+	std::min<int>(4, std::max<long>(sysconf(_SC_NPROCESSORS_ONLN), 1));
+    std::cout << "INFO: Server threads: " << worker_count << "\n";
+
+    for (int i = 0; i != worker_count; ++i)
+	workers_.push_back(std::tr1::shared_ptr<worker>(new worker(*this)));
+    for (int i = 0; i != worker_count; ++i)
+	worker_threads_.create_thread(
+	    boost::bind(&worker::run, workers_[i].get()));
 }
 
 server::~server()
 {
+    // The message pipe is level-triggered and never read, so every
+    // worker will see the quit message.
     static const int message = message_quit;
     write(message_pipe_.writer.get(), &message, sizeof(int));
-    server_thread_->join();
+    worker_threads_.join_all();
 }
 
-void server::serve()
+// worker implementation
+
+server::worker::worker(server & server)
+    : server_(server),
+      epoll_fd_(epoll_create(max_events))
 {
-    enum {
-	poll_index_message,
-	poll_index_listen,
-	poll_count_fixed,
-	poll_index_clients = poll_count_fixed
-    };
-    std::vector<pollfd> poll_fds(poll_count_fixed);
-    std::vector<std::tr1::shared_ptr<connection> > connections;
-    poll_fds[poll_index_message].fd = message_pipe_.reader.get();
-    poll_fds[poll_index_message].events = POLLIN;
-    poll_fds[poll_index_listen].fd = listen_socket_.get();
-    poll_fds[poll_index_listen].events = POLLIN;
+    os_check_nonneg("epoll_create", epoll_fd_.get());
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = &server_.message_pipe_;
+    os_check_zero("epoll_ctl",
+		  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD,
+			    server_.message_pipe_.reader.get(), &event));
+
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = &server_.listen_socket_;
+    os_check_zero("epoll_ctl",
+		  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD,
+			    server_.listen_socket_.get(), &event));
+}
+
+server::worker::~worker()
+{
+    for (std::set<connection *>::iterator it = connections_.begin();
+	 it != connections_.end();
+	 ++it)
+	delete *it;
+}
+
+void server::worker::run()
+{
+    epoll_event events[max_events];
 
     for (;;)
     {
-	int count = poll(&poll_fds[0], poll_fds.size(), -1);
+	int count = epoll_wait(epoll_fd_.get(), events, max_events, -1);
 	if (count < 0)
 	{
 	    int error = errno;
 	    if (error == EAGAIN || error == EINTR)
 		continue;
-	    std::cerr << "ERROR: poll: " << std::strerror(errno) << "\n";
+	    std::cerr << "ERROR: epoll_wait: " << std::strerror(errno) << "\n";
 	    break;
 	}
 
-	// Check message pipe
-	if (poll_fds[poll_index_message].revents & POLLIN)
+	for (int i = 0; i != count; ++i)
 	{
-	    int messages[1024];
-	    ssize_t size = read(message_pipe_.reader.get(),
-				messages, sizeof(messages));
-	    if (size > 0)
-	    {
-		assert(size % sizeof(int) == 0);
-		for (std::size_t i = 0; i != size / sizeof(int); ++i)
-		{
-		    if (messages[i] == message_quit)
-			return;
-		    // otherwise message is the number of a file
-		    // descriptor we want to send on
-		    for (std::size_t j = poll_index_clients;
-			 j != poll_fds.size();
-			 ++j)
-		    {
-			if (poll_fds[j].fd == messages[i])
-			{
-			    poll_fds[j].events |= POLLOUT;
-			    break;
-			}
-		    }
-		}
-	    }
+	    void * ptr = events[i].data.ptr;
+	    if (ptr == &server_.message_pipe_)
+		// The only message is message_quit
+		return;
+	    else if (ptr == &server_.listen_socket_)
+		accept_connection();
+	    else
+		handle_event(static_cast<connection *>(ptr), events[i].events);
 	}
+    }
+}
+
+void server::worker::accept_connection()
+{
+    auto_fd conn_socket(accept(server_.listen_socket_.get(), 0, 0));
+
+    // Another worker may have beaten us to it
+    if (conn_socket.get() < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	return;
+
+    try
+    {
+	os_check_nonneg("accept", conn_socket.get());
+	os_check_nonneg("fcntl",
+			fcntl(conn_socket.get(), F_SETFL, O_NONBLOCK));
+	int fd = conn_socket.get();
+	std::auto_ptr<connection> conn(
+	    new unknown_connection(server_, *this, conn_socket));
+	epoll_event event = {};
+	event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	event.data.ptr = conn.get();
+	os_check_zero("epoll_ctl",
+		      epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &event));
+	connections_.insert(conn.release());
+    }
+    catch (std::exception & e)
+    {
+	std::cerr << "ERROR: " << e.what() << "\n";
+    }
+}
 
-	// Check listening socket
-	if (poll_fds[poll_index_listen].revents & POLLIN)
+void server::worker::handle_event(connection * conn, uint32_t events)
+{
+    try
+    {
+	if (((events & EPOLLERR) && !conn->do_error())
+	    || ((events & EPOLLHUP) && !conn->do_hangup()))
 	{
-	    auto_fd conn_socket(accept(listen_socket_.get(), 0, 0));
-	    try
-	    {
-		os_check_nonneg("accept", conn_socket.get());
-		os_check_nonneg("fcntl",
-				fcntl(conn_socket.get(), F_SETFL, O_NONBLOCK));
-		pollfd new_poll_fd = { conn_socket.get(), POLLIN, 0 };
-		poll_fds.reserve(poll_fds.size() + 1);
-		connections.push_back(
-		    std::tr1::shared_ptr<connection>(
-			new unknown_connection(*this, conn_socket)));
-		poll_fds.push_back(new_poll_fd);
-	    }
-	    catch (std::exception & e)
-	    {
-		std::cerr << "ERROR: " << e.what() << "\n";
-	    }
+	    drop_connection(conn);
+	    return;
 	}
 
-	// Check client connections
-	for (std::size_t i = 0; i != connections.size();)
+	if (events & EPOLLIN)
 	{
-	    short revents = poll_fds[poll_index_clients + i].revents;
-	    bool should_drop = false;
-	    try
+	    bool drained = false;
+	    do
 	    {
-		if (revents & (POLLHUP | POLLERR))
-		{
-		    should_drop = true;
-		}
-		else if (revents & POLLIN)
+		connection * new_conn = conn->do_receive(drained);
+		if (!new_conn)
 		{
-		    connection * new_connection = connections[i]->do_receive();
-		    if (!new_connection)
-			should_drop = true;
-		    else if (new_connection != connections[i].get())
-			connections[i].reset(new_connection);
+		    drop_connection(conn);
+		    return;
 		}
-		else if (revents & POLLOUT)
+		if (new_conn != conn)
 		{
-		    switch (connections[i]->do_send())
-		    {
-		    case connection::send_failed:
-			should_drop = true;
-			break;
-		    case connection::sent_some:
-			break;
-		    case connection::sent_all:
-			poll_fds[poll_index_clients + i].events &= ~POLLOUT;
-		        break;
-		    }
+		    // Redirect events to the replacement connection
+		    epoll_event event = {};
+		    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		    event.data.ptr = new_conn;
+		    connections_.erase(conn);
+		    connections_.insert(new_conn);
+		    delete conn;
+		    conn = new_conn;
+		    os_check_zero("epoll_ctl",
+				  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_MOD,
+					    conn->get_socket(), &event));
 		}
 	    }
-	    catch (std::exception & e)
-	    {
-		std::cerr << "ERROR: " << e.what() << "\n";
-		should_drop = true;
-	    }
+	    while (!drained);
+	}
 
-	    if (should_drop)
-	    {
-		connections.erase(connections.begin() + i);
-		poll_fds.erase(poll_fds.begin() + 2 + i);
-	    }
-	    else
-	    {
-		++i;
-	    }
+	// Sockets are edge-triggered, so we must try to send whenever
+	// we're woken, whether by the socket becoming writable or by
+	// schedule_send().  A connection with nothing to send will
+	// just report sent_all.
+	if (events & EPOLLOUT)
+	{
+	    connection::send_status status = conn->do_send();
+	    if (status == connection::send_failed
+		|| status == connection::sent_final)
+		drop_connection(conn);
 	}
     }
+    catch (std::exception & e)
+    {
+	std::cerr << "ERROR: " << e.what() << "\n";
+	drop_connection(conn);
+    }
+}
+
+void server::worker::drop_connection(connection * conn)
+{
+    connections_.erase(conn);
+
+    connection * successor = 0;
+    try
+    {
+	successor = conn->handle_drop();
+	if (successor)
+	{
+	    // Only errors and hang-up are of interest now, and those
+	    // are always reported
+	    epoll_event event = {};
+	    event.events = EPOLLET;
+	    event.data.ptr = successor;
+	    os_check_zero("epoll_ctl",
+			  epoll_ctl(epoll_fd_.get(), EPOLL_CTL_MOD,
+				    successor->get_socket(), &event));
+	    connections_.insert(successor);
+	}
+    }
+    catch (std::exception & e)
+    {
+	std::cerr << "ERROR: " << e.what() << "\n";
+	delete successor;
+    }
+
+    // Closing the socket removes it from the epoll set.
+    delete conn;
 }
 
 // connection
 
-server::connection::connection(server & server, auto_fd socket)
+server::connection::connection(server & server, worker & worker,
+			       auto_fd socket)
     : server_(server),
+      worker_(worker),
       socket_(socket)
 {}
 
-server::connection * server::connection::do_receive()
+void server::connection::schedule_send()
 {
-    connection * result = 0;
+    // Re-arming the socket with EPOLL_CTL_MOD generates a new edge if
+    // it's writable, which wakes the worker without any extra
+    // message passing.
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = this;
+    os_check_zero("epoll_ctl",
+		  epoll_ctl(worker_.get_epoll_fd(), EPOLL_CTL_MOD,
+			    socket_.get(), &event));
+}
 
-    if (receive_buffer_.size == 0)
-    {
-	receive_buffer_ = get_receive_buffer();
-	assert(receive_buffer_.pointer && receive_buffer_.size);
-    }
+server::connection * server::connection::do_receive(bool & drained)
+{
+    connection * result = 0;
 
-    ssize_t received_size = read(socket_.get(),
-				 receive_buffer_.pointer,
-				 receive_buffer_.size);
-    if (received_size > 0)
+    for (;;)
     {
-	receive_buffer_.pointer += received_size;
-	receive_buffer_.size -= received_size;
 	if (receive_buffer_.size == 0)
+	{
+	    receive_buffer_ = get_receive_buffer();
+	    assert(receive_buffer_.pointer && receive_buffer_.size);
+	}
+
+	ssize_t received_size = read(socket_.get(),
+				     receive_buffer_.pointer,
+				     receive_buffer_.size);
+	if (received_size > 0)
+	{
+	    receive_buffer_.pointer += received_size;
+	    receive_buffer_.size -= received_size;
+	    if (receive_buffer_.size != 0)
+		continue;
 	    result = handle_complete_receive();
-	else
+	    if (result == this)
+		continue;
+	    // Let the caller carry on with the replacement connection
+	    // (or drop this one).
+	}
+	else if (received_size == -1 && errno == EWOULDBLOCK)
+	{
+	    // This is expected when the socket buffer is empty
+	    drained = true;
 	    result = this;
-    }
-    else if (received_size == -1 && errno == EWOULDBLOCK)
-    {
-	// This is expected when the socket buffer is empty
-	result = this;
+	}
+	else if (received_size == 0)
+	{
+	    drained = true;
+	    result = handle_end_of_input();
+	}
+	break;
     }
 
     if (!result)
@@ -363,18 +706,61 @@ server::connection * server::connection::do_receive()
 
 // unknown_connection implementation
 
-server::unknown_connection::unknown_connection(server & server, auto_fd socket)
-    : connection(server, socket)
+server::unknown_connection::unknown_connection(server & server,
+						worker & worker,
+						auto_fd socket)
+    : connection(server, worker, socket),
+      state_(state_greeting),
+      name_length_(0),
+      output_selected_(false),
+      output_id_(mixer::main_output_id)
 {}
 
 server::connection::receive_buffer
 server::unknown_connection::get_receive_buffer()
 {
-    return receive_buffer(greeting_, sizeof(greeting_));
+    switch (state_)
+    {
+    case state_name_length:
+	return receive_buffer(&name_length_, 1);
+    case state_name:
+	return receive_buffer(reinterpret_cast<uint8_t *>(name_),
+			      name_length_);
+    default:
+	return receive_buffer(greeting_, sizeof(greeting_));
+    }
 }
 
 server::connection * server::unknown_connection::handle_complete_receive()
 {
+    // An output selection is followed by the sink's usual greeting
+    if (state_ == state_name_length)
+    {
+	state_ = name_length_ ? state_name : state_greeting;
+	return this;
+    }
+    if (state_ == state_name)
+    {
+	std::string name(name_, name_length_);
+	output_id_ = server_.mixer_.find_output(name);
+	if (output_id_ == mixer::invalid_id)
+	{
+	    std::cerr << "WARN: Sink selected unknown output \""
+		      << name << "\"\n";
+	    return 0;
+	}
+	state_ = state_greeting;
+	return this;
+    }
+
+    if (std::memcmp(greeting_, GREETING_SELECT_OUTPUT, GREETING_SIZE) == 0
+	&& !output_selected_)
+    {
+	output_selected_ = true;
+	state_ = state_name_length;
+	return this;
+    }
+
     enum {
 	client_type_unknown,
 	client_type_source,     // source which sends greeting (>= 0.3)
@@ -384,6 +770,7 @@ server::connection * server::unknown_connection::handle_complete_receive()
 	client_type_raw_sink,   // sink which wants raw DIF
 	client_type_rec_sink,   // sink which wants DIF with control headers
 	                        // and is recording
+	client_type_stats,      // monitoring client which wants statistics
     } client_type;
 
     if (std::memcmp(greeting_, GREETING_SOURCE, GREETING_SIZE) == 0)
@@ -400,21 +787,33 @@ server::connection * server::unknown_connection::handle_complete_receive()
     else if (std::memcmp(greeting_, GREETING_ACT_SOURCE, GREETING_SIZE)
     	     == 0)
     	client_type = client_type_act_source;
+    else if (std::memcmp(greeting_, GREETING_STATS, GREETING_SIZE) == 0)
+	client_type = client_type_stats;
     else
 	client_type = client_type_unknown;
 
+    // Only sinks may select an output
+    if (output_selected_
+	&& client_type != client_type_sink
+	&& client_type != client_type_raw_sink
+	&& client_type != client_type_rec_sink)
+	client_type = client_type_unknown;
+
     switch (client_type)
     {
     case client_type_source:
     case client_type_act_source:
-	return new source_connection(server_, socket_,
+	return new source_connection(server_, worker_, socket_,
 				     client_type == client_type_act_source);
     case client_type_sink:
     case client_type_raw_sink:
     case client_type_rec_sink:
-	return new sink_connection(server_, socket_,
+	return new sink_connection(server_, worker_, socket_,
 				   client_type == client_type_raw_sink,
-				   client_type == client_type_rec_sink);
+				   client_type == client_type_rec_sink,
+				   output_id_);
+    case client_type_stats:
+	return new stats_connection(server_, worker_, socket_);
     default:
 	return 0;
     }
@@ -427,12 +826,18 @@ std::ostream & server::unknown_connection::print_identity(std::ostream & os)
 
 // source_connection implementation
 
-server::source_connection::source_connection(server & server, auto_fd socket,
+server::source_connection::source_connection(server & server,
+					     worker & worker,
+					     auto_fd socket,
 					     bool wants_act)
-    : connection(server, socket),
+    : connection(server, worker, socket),
       frame_(allocate_dv_frame()),
       first_sequence_(true),
-      wants_act_(wants_act)
+      starved_(false),
+      wants_act_(wants_act),
+      act_flags_(mixer::source_active_none),
+      act_pending_(false),
+      act_message_pos_(0)
 {
     mixer::source_settings settings;
     union {
@@ -466,6 +871,7 @@ void server::source_connection::set_active(mixer::source_activation flags)
     if (wants_act_)
     {
 	act_flags_ = flags;
+	act_pending_ = true;
 	schedule_send();
     }
 }
@@ -474,34 +880,42 @@ server::connection::send_status server::source_connection::do_send()
 {
     send_status result = send_failed;
 
-    if (act_message_pos_ == 0)
-    {
-	// Generate message
-	memset(act_message_, 0, ACT_MSG_SIZE);
-	act_message_[ACT_MSG_VIDEO_POS] =
-	    !!(act_flags_ & mixer::source_active_video);
-    }
-
-    ssize_t sent_size = write(socket_.get(), act_message_, ACT_MSG_SIZE);
-    if (sent_size > 0)
+    for (;;)
     {
-	act_message_pos_ += sent_size;
-	if (act_message_pos_ == ACT_MSG_SIZE)
+	if (act_message_pos_ == 0)
 	{
-	    // We've finished sending this message, but we must check
-	    // whether the activation flags have changed.
-	    act_message_pos_ = 0;
-	    if (act_message_[ACT_MSG_VIDEO_POS] ==
-		!!(act_flags_ & mixer::source_active_video))
+	    // We may be woken just because the socket is writable
+	    if (!act_pending_)
+	    {
 		result = sent_all;
-	    else
+		break;
+	    }
+	    act_pending_ = false;
+
+	    // Generate message
+	    memset(act_message_, 0, ACT_MSG_SIZE);
+	    act_message_[ACT_MSG_VIDEO_POS] =
+		!!(act_flags_ & mixer::source_active_video);
+	}
+
+	ssize_t sent_size = write(socket_.get(),
+				  act_message_ + act_message_pos_,
+				  ACT_MSG_SIZE - act_message_pos_);
+	if (sent_size > 0)
+	{
+	    // Carry on until the socket buffer fills or we've sent
+	    // all pending messages.
+	    act_message_pos_ += sent_size;
+	    if (act_message_pos_ == ACT_MSG_SIZE)
+		act_message_pos_ = 0;
+	}
+	else
+	{
+	    if (sent_size == -1 && errno == EWOULDBLOCK)
 		result = sent_some;
+	    break;
 	}
     }
-    else if (sent_size == -1 && errno == EWOULDBLOCK)
-    {
-	result = sent_some;
-    }
 
     if (result == send_failed)
     {
@@ -530,9 +944,26 @@ server::connection * server::source_connection::handle_complete_receive()
 {
     if (!first_sequence_)
     {
- 	server_.mixer_.put_frame(source_id_, frame_);
- 	frame_.reset();
- 	frame_ = allocate_dv_frame();
+	// If there is no buffer for the next frame, drop this one
+	// and reuse its buffer.
+	dv_frame_ptr next_frame(allocate_dv_frame(std::nothrow));
+	if (next_frame)
+	{
+	    server_.mixer_.put_frame(source_id_, frame_);
+	    frame_ = next_frame;
+	    if (starved_)
+	    {
+		std::cout << "INFO: ";
+		print_identity(std::cout) << " recovered\n";
+		starved_ = false;
+	    }
+	}
+	else if (!starved_)
+	{
+	    std::cerr << "WARN: ";
+	    print_identity(std::cerr) << " dropping frames for lack of buffers\n";
+	    starved_ = true;
+	}
     }
 
     first_sequence_ = !first_sequence_;
@@ -546,17 +977,34 @@ std::ostream & server::source_connection::print_identity(std::ostream & os)
 
 // sink_connection implementation
 
-server::sink_connection::sink_connection(server & server, auto_fd socket,
-					 bool is_raw, bool will_record)
-    : connection(server, socket),
+server::sink_connection::sink_connection(server & server, worker & worker,
+					 auto_fd socket,
+					 bool is_raw, bool will_record,
+					 mixer::output_id output_id)
+    : connection(server, worker, socket),
       is_raw_(is_raw),
       will_record_(will_record),
       is_recording_(false),
       frame_pos_(0),
+      zero_copy_(false),
+      zero_copy_copied_(false),
       queue_(30),
-      overflowed_(false)
+      overflowed_(false),
+      frame_count_(0),
+      dropped_count_(0)
 {
-    sink_id_ = server_.mixer_.add_sink(this, will_record);
+    static const int one = 1;
+    if (server_.zero_copy_)
+    {
+	if (setsockopt(socket_.get(), SOL_SOCKET, SO_ZEROCOPY,
+		       &one, sizeof(one)) == 0)
+	    zero_copy_ = true;
+	else
+	    std::cerr << "WARN: Cannot enable zero-copy for sink: "
+		      << std::strerror(errno) << "\n";
+    }
+
+    sink_id_ = server_.mixer_.add_sink(this, will_record, output_id);
 }
 
 server::sink_connection::~sink_connection()
@@ -568,18 +1016,29 @@ server::connection::send_status server::sink_connection::do_send()
 {
     send_status result = send_failed;
     bool finished_frame = false;
+    bool skipped_frame = false;
 
-    do
+    for (;;)
     {
 	struct queue_elem elem;
 	{
 	    boost::mutex::scoped_lock lock(mutex_);
 	    if (finished_frame)
 	    {
+		const dv_frame_ptr & frame = queue_.front().frame;
+		if (!skipped_frame)
+		{
+		    uint64_t now = frame_timer_get();
+		    ++frame_count_;
+		    latency_.record(now > frame->mix_timestamp
+				    ? now - frame->mix_timestamp
+				    : 0);
+		}
 		if (will_record_)
-		    is_recording_ = queue_.front().frame->do_record;
+		    is_recording_ = frame->do_record;
 		queue_.pop();
 		finished_frame = false;
+		skipped_frame = false;
 	    }
 	    if (queue_.empty())
 	    {
@@ -592,12 +1051,14 @@ server::connection::send_status server::sink_connection::do_send()
 	if (will_record_ && !is_recording_ && !elem.frame->do_record)
 	{
 	    finished_frame = true;
+	    skipped_frame = true;
 	    continue;
 	}
 
 	uint8_t frame_header[SINK_FRAME_HEADER_SIZE] = {};
 	iovec vector[2];
 	int vector_size;
+	int body_pos = -1;
 	std::size_t frame_size;
 
 	if (is_raw_)
@@ -626,6 +1087,7 @@ server::connection::send_status server::sink_connection::do_send()
 
 	if (!will_record_ || elem.frame->do_record)
 	{
+	    body_pos = vector_size;
 	    vector[vector_size].iov_base = elem.frame->buffer;
 	    vector[vector_size].iov_len =
 		dv_frame_system(elem.frame.get())->size;
@@ -641,11 +1103,34 @@ server::connection::send_status server::sink_connection::do_send()
 	    static_cast<char *>(vector[vector_pos].iov_base) + rel_pos;
 	vector[vector_pos].iov_len -= rel_pos;
 
-	ssize_t sent_size = writev(socket_.get(),
-				   vector + vector_pos,
-				   vector_size - vector_pos);
+	// The kernel may read zero-copy data after we return, so it
+	// must not include the header on our stack.  Send that
+	// separately and normally.
+	int flags = 0;
+	int vector_end = vector_size;
+	if (zero_copy_ && !zero_copy_copied_ && body_pos >= 0)
+	{
+	    if (vector_pos < body_pos)
+	    {
+		flags = MSG_MORE;
+		vector_end = body_pos;
+	    }
+	    else
+	    {
+		flags = MSG_ZEROCOPY;
+	    }
+	}
+
+	msghdr message = {};
+	message.msg_iov = vector + vector_pos;
+	message.msg_iovlen = vector_end - vector_pos;
+	ssize_t sent_size = sendmsg(socket_.get(), &message, flags);
+	if (sent_size > 0 && (flags & MSG_ZEROCOPY))
+	    zero_copy_sends_.push(elem.frame);
 	if (sent_size > 0)
 	{
+	    // Carry on until the socket buffer fills, since we won't
+	    // be woken again until it has drained.
 	    frame_pos_ += sent_size;
 	    if (frame_pos_ == frame_size)
 	    {
@@ -654,12 +1139,13 @@ server::connection::send_status server::sink_connection::do_send()
 	    }
 	    result = sent_some;
 	}
-	else if (sent_size == -1 && errno == EWOULDBLOCK)
+	else
 	{
-	    result = sent_some;
+	    if (sent_size == -1 && errno == EWOULDBLOCK)
+		result = sent_some;
+	    break;
 	}
     }
-    while (finished_frame);
 
     if (result == send_failed)
     {
@@ -673,6 +1159,37 @@ server::connection::send_status server::sink_connection::do_send()
     return result;
 }
 
+bool server::sink_connection::do_error()
+{
+    if (!zero_copy_)
+	return false;
+
+    // Read zero-copy completion notifications from the error queue.
+    // Anything else is a real error.
+    bool handled;
+    if (!zero_copy_sends_.read_completions(socket_.get(), handled))
+	return false;
+
+    // If the kernel had to copy (e.g. the sink is on the same host)
+    // then zero-copy only adds overhead.
+    if (zero_copy_sends_.copied() && !zero_copy_copied_)
+    {
+	zero_copy_copied_ = true;
+	std::cout << "INFO: ";
+	print_identity(std::cout) << " does not support zero-copy\n";
+    }
+
+    return handled;
+}
+
+server::connection * server::sink_connection::handle_drop()
+{
+    if (zero_copy_sends_.empty())
+	return 0;
+    return new closing_connection(server_, worker_, socket_,
+				  zero_copy_sends_);
+}
+
 server::connection::receive_buffer
 server::sink_connection::get_receive_buffer()
 {
@@ -695,8 +1212,29 @@ void server::sink_connection::put_frame(const dv_frame_ptr & frame)
     bool was_empty = false;
     {
 	boost::mutex::scoped_lock lock(mutex_);
+
+	// If frame buffers are running short, a sink that isn't
+	// recording gives up its oldest queued frames so that sources
+	// and the mixer can carry on.  We keep the frame at the front
+	// since we may be part-way through sending it.  Recording
+	// sinks never drop frames for this reason.
+	if (!will_record_ && queue_.size() > 1 && dv_frame_pool_is_short())
+	{
+	    queue_elem head = queue_.front();
+	    dropped_count_ += queue_.size() - 1;
+	    queue_.reset();
+	    queue_.push(head);
+	    if (!overflowed_)
+	    {
+		std::cerr << "WARN: ";
+		print_identity(std::cerr) << " dropped frames to free buffers\n";
+		overflowed_ = true;
+	    }
+	}
+
 	if (queue_.full())
 	{
+	    ++dropped_count_;
 	    if (!overflowed_)
 	    {
 		std::cerr << "WARN: ";
@@ -715,9 +1253,219 @@ void server::sink_connection::put_frame(const dv_frame_ptr & frame)
 	    }
 	    if (queue_.empty())
 		was_empty = true;
-	    queue_.push(elem);
+	    queue_.push_swap(elem);
 	}
     }
     if (was_empty)
 	schedule_send();
 }
+
+void server::sink_connection::get_stats(mixer::sink_stats & stats)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    stats.queue_len = queue_.size();
+    stats.queue_capacity = queue_.capacity();
+    stats.frame_count = frame_count_;
+    stats.dropped_count = dropped_count_;
+    stats.latency = latency_;
+}
+
+// closing_connection implementation
+
+server::closing_connection::closing_connection(server & server,
+					       worker & worker,
+					       auto_fd socket,
+					       zero_copy_queue & sends)
+    : connection(server, worker, socket)
+{
+    swap(sends_, sends);
+
+    // Finish sending as close() would, but don't let a sink that
+    // has stopped reading keep hold of our frames for long.
+    shutdown(socket_.get(), SHUT_WR);
+    setsockopt(socket_.get(), IPPROTO_TCP, TCP_USER_TIMEOUT,
+	       &zero_copy_linger_ms, sizeof(zero_copy_linger_ms));
+}
+
+bool server::closing_connection::do_error()
+{
+    // Once the connection fails, the kernel releases all the frames
+    // and reports them as complete.  Until then we ignore errors.
+    bool handled;
+    sends_.read_completions(socket_.get(), handled);
+    return !sends_.empty();
+}
+
+bool server::closing_connection::do_hangup()
+{
+    return do_error();
+}
+
+server::connection::receive_buffer
+server::closing_connection::get_receive_buffer()
+{
+    static uint8_t dummy;
+    return receive_buffer(&dummy, sizeof(dummy));
+}
+
+server::connection * server::closing_connection::handle_complete_receive()
+{
+    return 0;
+}
+
+std::ostream & server::closing_connection::print_identity(std::ostream & os)
+{
+    return os << "closing sink connection";
+}
+
+// stats_connection implementation
+
+namespace
+{
+    // Print average, maximum and histogram in the units of the
+    // histogram limits (us)
+    void print_latency(std::ostream & os, const char * name,
+		       uint64_t count, uint64_t total, uint64_t max,
+		       const uint64_t * buckets, unsigned bucket_count)
+    {
+	os << ' ' << name << "_avg=" << (count ? total / count / 1000 : 0)
+	   << ' ' << name << "_max=" << max / 1000
+	   << ' ' << name << "_hist=";
+	for (unsigned i = 0; i != bucket_count; ++i)
+	    os << (i ? "," : "") << buckets[i];
+    }
+
+    void print_latency(std::ostream & os, const char * name,
+		       const mixer::latency_stats & stats)
+    {
+	print_latency(os, name, stats.count, stats.total, stats.max,
+		      stats.buckets, mixer::latency_stats::bucket_count);
+    }
+
+    void print_pool(std::ostream & os, const char * name,
+		    const frame_pool_stats & stats)
+    {
+	os << "pool " << name
+	   << " capacity=" << stats.capacity
+	   << " limit=" << stats.limit
+	   << " in_use=" << stats.in_use
+	   << " in_use_max=" << stats.in_use_max
+	   << '\n';
+    }
+
+    void print_limits(std::ostream & os, const char * name,
+		      const unsigned * limits, unsigned limit_count)
+    {
+	os << name << "_buckets=";
+	for (unsigned i = 0; i != limit_count; ++i)
+	    os << (i ? "," : "") << limits[i];
+	os << '\n';
+    }
+}
+
+server::stats_connection::stats_connection(server & server, worker & worker,
+					   auto_fd socket)
+    : connection(server, worker, socket),
+      message_pos_(0)
+{
+    // Format the snapshot now; we'll be woken to send it when the
+    // socket is registered for this connection.
+    mixer::stats stats(server_.mixer_.get_stats());
+    std::ostringstream os;
+
+    print_limits(os, "latency", mixer::latency_stats::bucket_limits,
+		 mixer::latency_stats::bucket_count - 1);
+    print_limits(os, "lateness", frame_timer_lateness_limits,
+		 FRAME_TIMER_LATENESS_BUCKETS - 1);
+
+    os << "clock wakeups=" << stats.clock.wakeup_count;
+    print_latency(os, "lateness", stats.clock.wakeup_count,
+		  stats.clock.total_lateness, stats.clock.max_lateness,
+		  stats.clock.lateness_hist, FRAME_TIMER_LATENESS_BUCKETS);
+    os << '\n';
+
+    os << "mixer queue=" << stats.mixer_queue_len
+       << '/' << stats.mixer_queue_capacity
+       << " output_queue=" << stats.output_queue_len
+       << '/' << stats.output_queue_capacity
+       << " frames=" << stats.mix_count
+       << " repeated=" << stats.repeat_count
+       << " dropped=" << stats.mix_dropped_count;
+    print_latency(os, "latency", stats.mix_latency);
+    os << '\n';
+
+    for (mixer::source_id id = 0; id != stats.sources.size(); ++id)
+    {
+	const mixer::source_stats & source = stats.sources[id];
+	if (!source.is_active)
+	    continue;
+	os << "source " << 1 + id
+	   << " queue=" << source.queue_len << '/' << source.queue_capacity
+	   << " frames=" << source.frame_count
+	   << " missing=" << source.missing_count
+	   << " dropped=" << source.dropped_count;
+	print_latency(os, "latency", source.latency);
+	os << '\n';
+    }
+
+    for (mixer::sink_id id = 0; id != stats.sinks.size(); ++id)
+    {
+	const mixer::sink_stats & sink = stats.sinks[id];
+	if (!sink.is_active)
+	    continue;
+	os << "sink " << 1 + id
+	   << " queue=" << sink.queue_len << '/' << sink.queue_capacity
+	   << " frames=" << sink.frame_count
+	   << " dropped=" << sink.dropped_count;
+	print_latency(os, "latency", sink.latency);
+	os << '\n';
+    }
+
+    print_pool(os, "dv", get_dv_frame_pool_stats());
+    print_pool(os, "raw", get_raw_frame_pool_stats());
+    print_pool(os, "pcm", get_pcm_packet_pool_stats());
+
+    message_ = os.str();
+}
+
+server::connection::send_status server::stats_connection::do_send()
+{
+    while (message_pos_ != message_.size())
+    {
+	ssize_t sent_size = write(socket_.get(),
+				  message_.data() + message_pos_,
+				  message_.size() - message_pos_);
+	if (sent_size > 0)
+	    message_pos_ += sent_size;
+	else if (sent_size == -1 && errno == EWOULDBLOCK)
+	    return sent_some;
+	else
+	    return send_failed;
+    }
+
+    return sent_final;
+}
+
+server::connection::receive_buffer
+server::stats_connection::get_receive_buffer()
+{
+    static uint8_t dummy;
+    return receive_buffer(&dummy, sizeof(dummy));
+}
+
+server::connection * server::stats_connection::handle_complete_receive()
+{
+    return 0;
+}
+
+server::connection * server::stats_connection::handle_end_of_input()
+{
+    // The client need not send anything after the greeting, so it
+    // may shut down its side of the connection while we're sending.
+    return this;
+}
+
+std::ostream & server::stats_connection::print_identity(std::ostream & os)
+{
+    return os << "stats client";
+}
@@ -8,6 +8,9 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <tr1/memory>
 
 #include <boost/thread.hpp>
 
@@ -18,7 +21,10 @@
 class server
 {
 public:
-    server(const std::string & host, const std::string & port, mixer & mixer);
+    // If zero_copy is set, frames are sent to sinks using
+    // MSG_ZEROCOPY where the kernel supports it.
+    server(const std::string & host, const std::string & port, mixer & mixer,
+	   bool zero_copy = false);
     ~server();
 
 private:
@@ -26,13 +32,16 @@ private:
     class unknown_connection;
     class source_connection;
     class sink_connection;
-
-    void serve();
+    class closing_connection;
+    class stats_connection;
+    class worker;
 
     mixer & mixer_;
+    bool zero_copy_;
     auto_fd listen_socket_;
     auto_pipe message_pipe_;
-    std::auto_ptr<boost::thread> server_thread_;
+    std::vector<std::tr1::shared_ptr<worker> > workers_;
+    boost::thread_group worker_threads_;
 };
 
 #endif // !defined(DVSWITCH_SERVER_HPP)
@@ -6,10 +6,15 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "socket.h"
 
 int create_connected_socket(const char * host, const char * port)
 {
@@ -85,3 +90,32 @@ int create_listening_socket(const char * host, const char * port)
     freeaddrinfo(addr);
     return sock;
 }
+
+void send_sink_greeting(int sock, const char * greeting,
+			const char * output_name)
+{
+    char buf[GREETING_SIZE + 1 + OUTPUT_NAME_MAX + GREETING_SIZE];
+    size_t len = 0;
+
+    if (output_name)
+    {
+	size_t name_len = strlen(output_name);
+	if (name_len > OUTPUT_NAME_MAX)
+	{
+	    fprintf(stderr, "ERROR: output name is too long\n");
+	    exit(2);
+	}
+	memcpy(buf, GREETING_SELECT_OUTPUT, GREETING_SIZE);
+	buf[GREETING_SIZE] = name_len;
+	memcpy(buf + GREETING_SIZE + 1, output_name, name_len);
+	len = GREETING_SIZE + 1 + name_len;
+    }
+    memcpy(buf + len, greeting, GREETING_SIZE);
+    len += GREETING_SIZE;
+
+    if (write(sock, buf, len) != (ssize_t)len)
+    {
+	perror("ERROR: write");
+	exit(1);
+    }
+}
@@ -12,6 +12,10 @@ extern "C" {
 
 int create_connected_socket(const char * host, const char * port);
 int create_listening_socket(const char * host, const char * port);
+/* Send a sink greeting, first selecting the named mixer output if
+ * output_name is not null */
+void send_sink_greeting(int sock, const char * greeting,
+			const char * output_name);
 
 #ifdef __cplusplus
 }
@@ -4,8 +4,18 @@
 // Video effects for raw video frames
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define VIDEO_EFFECT_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VIDEO_EFFECT_NEON
+#endif
+
 #include "video_effect.h"
 
 enum {
@@ -14,6 +24,361 @@ enum {
     chroma_bias = 128 // neutral level (chroma components are signed)
 };
 
+// Row kernels for video_effect_fade().  These move each dest pixel
+// towards the corresponding sec pixel by scale/256 of the difference.
+// The vector versions must give exactly the same results as the
+// scalar version, including its truncation of the product to 16 bits.
+
+typedef void fade_row_func(uint8_t * dest, const uint8_t * sec,
+			   unsigned width, uint8_t scale);
+
+static void fade_row_scalar(uint8_t * dest, const uint8_t * sec,
+			    unsigned width, uint8_t scale)
+{
+    for (unsigned x = 0; x != width; ++x)
+    {
+	uint16_t tmp = scale * (sec[x] - dest[x]);
+	dest[x] += (uint8_t)(tmp >> 8);
+    }
+}
+
+#ifdef VIDEO_EFFECT_X86
+
+__attribute__((target("sse2")))
+static void fade_row_sse2(uint8_t * dest, const uint8_t * sec,
+			  unsigned width, uint8_t scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale_v = _mm_set1_epi16(scale);
+    unsigned x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+	__m128i d = _mm_loadu_si128((const __m128i *)(dest + x));
+	__m128i s = _mm_loadu_si128((const __m128i *)(sec + x));
+	__m128i lo = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(s, zero),
+						   _mm_unpacklo_epi8(d, zero)),
+				     scale_v);
+	__m128i hi = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(s, zero),
+						   _mm_unpackhi_epi8(d, zero)),
+				     scale_v);
+	__m128i delta = _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+					 _mm_srli_epi16(hi, 8));
+	_mm_storeu_si128((__m128i *)(dest + x), _mm_add_epi8(d, delta));
+    }
+
+    fade_row_scalar(dest + x, sec + x, width - x, scale);
+}
+
+__attribute__((target("avx2")))
+static void fade_row_avx2(uint8_t * dest, const uint8_t * sec,
+			  unsigned width, uint8_t scale)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i scale_v = _mm256_set1_epi16(scale);
+    unsigned x;
+
+    // Unpacking and packing work within each 128-bit lane, so the
+    // bytes end up back in their original order.
+    for (x = 0; x + 32 <= width; x += 32)
+    {
+	__m256i d = _mm256_loadu_si256((const __m256i *)(dest + x));
+	__m256i s = _mm256_loadu_si256((const __m256i *)(sec + x));
+	__m256i lo = _mm256_mullo_epi16(
+	    _mm256_sub_epi16(_mm256_unpacklo_epi8(s, zero),
+			     _mm256_unpacklo_epi8(d, zero)),
+	    scale_v);
+	__m256i hi = _mm256_mullo_epi16(
+	    _mm256_sub_epi16(_mm256_unpackhi_epi8(s, zero),
+			     _mm256_unpackhi_epi8(d, zero)),
+	    scale_v);
+	__m256i delta = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+					    _mm256_srli_epi16(hi, 8));
+	_mm256_storeu_si256((__m256i *)(dest + x), _mm256_add_epi8(d, delta));
+    }
+
+    // Avoid the penalty for mixing AVX and legacy SSE instructions,
+    // which the compiler doesn't take care of for tail calls
+    _mm256_zeroupper();
+    fade_row_sse2(dest + x, sec + x, width - x, scale);
+}
+
+#endif // VIDEO_EFFECT_X86
+
+#ifdef VIDEO_EFFECT_NEON
+
+static void fade_row_neon(uint8_t * dest, const uint8_t * sec,
+			  unsigned width, uint8_t scale)
+{
+    unsigned x;
+
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+	uint8x8_t d = vld1_u8(dest + x);
+	uint16x8_t tmp = vmulq_n_u16(vsubl_u8(vld1_u8(sec + x), d), scale);
+	vst1_u8(dest + x, vadd_u8(d, vshrn_n_u16(tmp, 8)));
+    }
+
+    fade_row_scalar(dest + x, sec + x, width - x, scale);
+}
+
+#endif // VIDEO_EFFECT_NEON
+
+// Row kernels for the picture-in-picture scaler.  Sums never exceed
+// 32 bits, so the order of summation doesn't affect the results.
+
+// Add a row of pixels to 16-bit sums (for box filtering)
+typedef void box_add_row_func(uint16_t * sums, const uint8_t * row,
+			      unsigned width);
+// Add a row of 32-bit values, multiplied by a weight, to 32-bit sums
+typedef void weight_add_row_func(uint32_t * sums, const uint32_t * row,
+				 unsigned width, uint32_t weight);
+// Convert 32-bit sums to pixels by multiplying by a 0.32 fixed-point
+// scale and rounding
+typedef void scale_row_func(uint8_t * dest, const uint32_t * sums,
+			    unsigned width, uint32_t scale);
+
+static void box_add_row_scalar(uint16_t * sums, const uint8_t * row,
+			       unsigned width)
+{
+    for (unsigned x = 0; x != width; ++x)
+	sums[x] += row[x];
+}
+
+static void weight_add_row_scalar(uint32_t * sums, const uint32_t * row,
+				  unsigned width, uint32_t weight)
+{
+    for (unsigned x = 0; x != width; ++x)
+	sums[x] += row[x] * weight;
+}
+
+static void scale_row_scalar(uint8_t * dest, const uint32_t * sums,
+			     unsigned width, uint32_t scale)
+{
+    for (unsigned x = 0; x != width; ++x)
+	dest[x] = (sums[x] * (uint64_t)scale + (1U << 31)) >> 32;
+}
+
+#ifdef VIDEO_EFFECT_X86
+
+__attribute__((target("sse2")))
+static void box_add_row_sse2(uint16_t * sums, const uint8_t * row,
+			     unsigned width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+	__m128i r = _mm_loadu_si128((const __m128i *)(row + x));
+	__m128i * p = (__m128i *)(sums + x);
+	_mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p),
+					  _mm_unpacklo_epi8(r, zero)));
+	_mm_storeu_si128(p + 1, _mm_add_epi16(_mm_loadu_si128(p + 1),
+					      _mm_unpackhi_epi8(r, zero)));
+    }
+
+    box_add_row_scalar(sums + x, row + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void weight_add_row_sse2(uint32_t * sums, const uint32_t * row,
+				unsigned width, uint32_t weight)
+{
+    // SSE2 has no 32-bit multiply giving 32-bit results, so multiply
+    // even and odd elements separately giving 64-bit results, then
+    // interleave the low halves.
+    const __m128i weight_v = _mm_set1_epi32(weight);
+    unsigned x;
+
+    for (x = 0; x + 4 <= width; x += 4)
+    {
+	__m128i r = _mm_loadu_si128((const __m128i *)(row + x));
+	__m128i even = _mm_mul_epu32(r, weight_v);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(r, 32), weight_v);
+	__m128i prod = _mm_unpacklo_epi32(
+	    _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+	    _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	__m128i * p = (__m128i *)(sums + x);
+	_mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), prod));
+    }
+
+    weight_add_row_scalar(sums + x, row + x, width - x, weight);
+}
+
+__attribute__((target("sse2")))
+static void scale_row_sse2(uint8_t * dest, const uint32_t * sums,
+			   unsigned width, uint32_t scale)
+{
+    const __m128i scale_v = _mm_set1_epi32(scale);
+    const __m128i round = _mm_set1_epi64x(1U << 31);
+    const __m128i high_mask = _mm_set1_epi64x(0xffffffff00000000ULL);
+    const __m128i byte_mask = _mm_set1_epi32(0xff);
+    unsigned x;
+
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+	__m128i result[2];
+	for (int i = 0; i != 2; ++i)
+	{
+	    __m128i s = _mm_loadu_si128((const __m128i *)(sums + x + 4 * i));
+	    __m128i even = _mm_add_epi64(_mm_mul_epu32(s, scale_v), round);
+	    __m128i odd = _mm_add_epi64(
+		_mm_mul_epu32(_mm_srli_epi64(s, 32), scale_v), round);
+	    // Take the high halves, truncated to 8 bits as in the
+	    // scalar version
+	    result[i] = _mm_and_si128(
+		_mm_or_si128(_mm_srli_epi64(even, 32),
+			     _mm_and_si128(odd, high_mask)),
+		byte_mask);
+	}
+	__m128i packed = _mm_packus_epi16(
+	    _mm_packs_epi32(result[0], result[1]), result[0]);
+	_mm_storel_epi64((__m128i *)(dest + x), packed);
+    }
+
+    scale_row_scalar(dest + x, sums + x, width - x, scale);
+}
+
+__attribute__((target("avx2")))
+static void box_add_row_avx2(uint16_t * sums, const uint8_t * row,
+			     unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x + 16 <= width; x += 16)
+    {
+	__m256i r = _mm256_cvtepu8_epi16(
+	    _mm_loadu_si128((const __m128i *)(row + x)));
+	__m256i * p = (__m256i *)(sums + x);
+	_mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), r));
+    }
+
+    _mm256_zeroupper();
+    box_add_row_scalar(sums + x, row + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void weight_add_row_avx2(uint32_t * sums, const uint32_t * row,
+				unsigned width, uint32_t weight)
+{
+    const __m256i weight_v = _mm256_set1_epi32(weight);
+    unsigned x;
+
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+	__m256i r = _mm256_loadu_si256((const __m256i *)(row + x));
+	__m256i * p = (__m256i *)(sums + x);
+	_mm256_storeu_si256(p,
+			    _mm256_add_epi32(_mm256_loadu_si256(p),
+					     _mm256_mullo_epi32(r, weight_v)));
+    }
+
+    _mm256_zeroupper();
+    weight_add_row_scalar(sums + x, row + x, width - x, weight);
+}
+
+#endif // VIDEO_EFFECT_X86
+
+// Scalers for ratios that box filtering doesn't handle.  The fused
+// version does all the work in a single pass over each source row
+// and is fastest without vector row kernels; the separable version
+// is built from the row kernels.
+typedef void pic_in_pic_general_func(const struct video_effect_scaler *,
+				     uint8_t * dest_p, unsigned dest_linesize,
+				     unsigned d_width,
+				     const uint8_t * source_p,
+				     unsigned source_linesize,
+				     unsigned s_width, unsigned s_height);
+static pic_in_pic_general_func pic_in_pic_general_fused;
+#ifdef VIDEO_EFFECT_X86
+static pic_in_pic_general_func pic_in_pic_general_separable;
+#endif
+
+static const struct video_effect_kernels
+{
+    const char * name;
+    fade_row_func * fade_row;
+    box_add_row_func * box_add_row;
+    weight_add_row_func * weight_add_row;
+    scale_row_func * scale_row;
+    pic_in_pic_general_func * pic_in_pic_general;
+} video_effect_impls[video_effect_isa_count] = {
+    [video_effect_isa_scalar] = {
+	"scalar", fade_row_scalar,
+	box_add_row_scalar, weight_add_row_scalar, scale_row_scalar,
+	pic_in_pic_general_fused
+    },
+#ifdef VIDEO_EFFECT_X86
+    [video_effect_isa_sse2] = {
+	"sse2", fade_row_sse2,
+	box_add_row_sse2, weight_add_row_sse2, scale_row_sse2,
+	pic_in_pic_general_separable
+    },
+    [video_effect_isa_avx2] = {
+	"avx2", fade_row_avx2,
+	box_add_row_avx2, weight_add_row_avx2, scale_row_sse2,
+	pic_in_pic_general_separable
+    },
+#else
+    [video_effect_isa_sse2] = { "sse2" },
+    [video_effect_isa_avx2] = { "avx2" },
+#endif
+#ifdef VIDEO_EFFECT_NEON
+    [video_effect_isa_neon] = {
+	"neon", fade_row_neon,
+	box_add_row_scalar, weight_add_row_scalar, scale_row_scalar,
+	pic_in_pic_general_fused
+    },
+#else
+    [video_effect_isa_neon] = { "neon" },
+#endif
+};
+
+static const struct video_effect_kernels * kernels =
+    &video_effect_impls[video_effect_isa_scalar];
+
+const char * video_effect_isa_name(enum video_effect_isa isa)
+{
+    assert(isa < video_effect_isa_count);
+    return video_effect_impls[isa].name;
+}
+
+int video_effect_isa_supported(enum video_effect_isa isa)
+{
+    assert(isa < video_effect_isa_count);
+    if (!video_effect_impls[isa].fade_row)
+	return 0;
+#ifdef VIDEO_EFFECT_X86
+    if (isa == video_effect_isa_sse2)
+	return __builtin_cpu_supports("sse2");
+    if (isa == video_effect_isa_avx2)
+	return __builtin_cpu_supports("avx2");
+#endif
+    return 1;
+}
+
+void video_effect_set_isa(enum video_effect_isa isa)
+{
+    assert(video_effect_isa_supported(isa));
+    kernels = &video_effect_impls[isa];
+}
+
+// Select the best instruction set before any threads can use the
+// kernels
+__attribute__((constructor))
+static void video_effect_select_isa(void)
+{
+    int isa = video_effect_isa_count;
+#ifdef VIDEO_EFFECT_X86
+    __builtin_cpu_init();
+#endif
+    while (!video_effect_isa_supported(--isa))
+	;
+    video_effect_set_isa(isa);
+}
+
+
 void video_effect_show_title_safe(struct raw_frame_ref dest)
 {
     int chroma_shift_horiz, chroma_shift_vert;
@@ -90,13 +455,66 @@ void video_effect_brighten(struct raw_frame_ref dest,
     }
 }
 
-void video_effect_pic_in_pic(struct raw_frame_ref dest,
-			     struct rectangle d_rect,
-			     struct raw_frame_ref source,
-			     struct rectangle s_rect)
+// Scaling tables
+
+struct weights {
+    // Weight of source column/row on current dest column/row
+    uint16_t cur;
+    // Weight of source column/row on next dest column/row, plus 1
+    // if this the last source column/row for this dest column/row.
+    uint16_t spill;
+};
+
+// Maximum ratio handled by box filtering
+#define BOX_RATIO_MAX 4
+
+struct video_effect_scaler
 {
+    enum PixelFormat pix_fmt;
     int chroma_shift_horiz, chroma_shift_vert;
-    avcodec_get_chroma_sub_sample(dest.pix_fmt,
+    struct rectangle d_rect, s_rect;
+    uint32_t weight_scale;
+    struct weights col_weights[FRAME_WIDTH];
+    struct weights row_weights[FRAME_HEIGHT_MAX];
+    // If the source is a small whole multiple of the destination size
+    // then each dest pixel is the scaled sum of a box of source pixels
+    // and we can look up the result of scaling.  Otherwise these are
+    // 0.
+    unsigned box_width, box_height;
+    uint8_t box_table[255 * BOX_RATIO_MAX * BOX_RATIO_MAX + 1];
+};
+
+static void init_weights(struct weights * weights,
+			 unsigned s_size, unsigned d_size)
+{
+    unsigned e = 0;
+    for (unsigned i = 0; i != s_size; ++i)
+    {
+	e += d_size;
+	if (e >= s_size)
+	{
+	    e -= s_size;
+	    weights[i].cur = d_size - e;
+	    weights[i].spill = 1 + e;
+	}
+	else
+	{
+	    weights[i].cur = d_size;
+	    weights[i].spill = 0;
+	}
+    }
+}
+
+static struct video_effect_scaler *
+scaler_new(enum PixelFormat pix_fmt,
+	   struct rectangle d_rect, struct rectangle s_rect, int use_box)
+{
+    struct video_effect_scaler * scaler = malloc(sizeof(*scaler));
+    if (!scaler)
+	return NULL;
+
+    int chroma_shift_horiz, chroma_shift_vert;
+    avcodec_get_chroma_sub_sample(pix_fmt,
 				  &chroma_shift_horiz, &chroma_shift_vert);
 
     // Round coordinates so they include whole numbers of chroma pixels
@@ -112,169 +530,321 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
     assert(s_rect.left >= 0 && s_rect.left < s_rect.right
 	   && s_rect.right <= FRAME_WIDTH);
     assert(s_rect.top >= 0 && s_rect.top < s_rect.bottom
-	   && (unsigned)s_rect.bottom <= source.height);
+	   && s_rect.bottom <= FRAME_HEIGHT_MAX);
     assert(d_rect.left >= 0 && d_rect.left <= d_rect.right
 	   && d_rect.right <= FRAME_WIDTH);
-    assert(d_rect.top >= 0 && d_rect.top <= d_rect.bottom
-	   && (unsigned)d_rect.bottom <= dest.height);
+    assert(d_rect.top >= 0 && d_rect.top <= d_rect.bottom);
+
+    scaler->pix_fmt = pix_fmt;
+    scaler->chroma_shift_horiz = chroma_shift_horiz;
+    scaler->chroma_shift_vert = chroma_shift_vert;
+    scaler->d_rect = d_rect;
+    scaler->s_rect = s_rect;
+    scaler->box_width = 0;
+    scaler->box_height = 0;
 
     if (d_rect.left == d_rect.right || d_rect.top == d_rect.bottom)
-	return;
+	return scaler;
 
-    unsigned s_left = s_rect.left;
     unsigned s_width = s_rect.right - s_rect.left;
-    unsigned s_top = s_rect.top;
     unsigned s_height = s_rect.bottom - s_rect.top;
-    unsigned d_left = d_rect.left;
     unsigned d_width = d_rect.right - d_rect.left;
-    unsigned d_top = d_rect.top;
     unsigned d_height = d_rect.bottom - d_rect.top;
     assert(d_width <= s_width && d_height <= s_height);
 
-    // Scaling tables
+    scaler->weight_scale = (((1ULL << 32) + s_width * s_height / 2)
+			    / (s_width * s_height));
+    init_weights(scaler->col_weights, s_width, d_width);
+    init_weights(scaler->row_weights, s_height, d_height);
+
+    assert(scaler->col_weights[s_width - 1].spill == 1);
+    assert(scaler->col_weights[(s_width >> chroma_shift_horiz) - 1].spill
+	   == 1);
+    assert(scaler->row_weights[s_height - 1].spill == 1);
+    assert(scaler->row_weights[(s_height >> chroma_shift_vert) - 1].spill
+	   == 1);
+
+    if (use_box
+	&& s_width % d_width == 0 && s_width / d_width <= BOX_RATIO_MAX
+	&& s_height % d_height == 0 && s_height / d_height <= BOX_RATIO_MAX)
+    {
+	// Every source pixel has weight d_width * d_height in a single
+	// dest pixel, so the weighted sum is a multiple of the box sum.
+	scaler->box_width = s_width / d_width;
+	scaler->box_height = s_height / d_height;
+	unsigned box_max = 255 * scaler->box_width * scaler->box_height;
+	for (unsigned sum = 0; sum <= box_max; ++sum)
+	    scaler->box_table[sum] =
+		((uint32_t)(sum * d_width * d_height)
+		 * (uint64_t)scaler->weight_scale
+		 + (1U << 31)) >> 32;
+    }
 
-    struct weights {
-	// Weight of source column/row on current dest column/row
-	uint16_t cur;
-	// Weight of source column/row on next dest column/row, plus 1
-	// if this the last source column/row for this dest column/row.
-	uint16_t spill;
-    };
-    struct weights col_weights[FRAME_WIDTH];
-    struct weights row_weights[FRAME_HEIGHT_MAX];
-    unsigned e, x, y;
-    uint32_t weight_scale = (((1ULL << 32) + s_width * s_height / 2)
-			     / (s_width * s_height));
+    return scaler;
+}
 
-    e = 0;
-    for (x = 0; x != s_width; ++x)
+struct video_effect_scaler *
+video_effect_scaler_new(enum PixelFormat pix_fmt,
+			struct rectangle d_rect,
+			struct rectangle s_rect)
+{
+    return scaler_new(pix_fmt, d_rect, s_rect, 1);
+}
+
+void video_effect_scaler_free(struct video_effect_scaler * scaler)
+{
+    free(scaler);
+}
+
+static void pic_in_pic_box(const struct video_effect_scaler * scaler,
+			   uint8_t * dest_p, unsigned dest_linesize,
+			   unsigned d_width, unsigned d_height,
+			   const uint8_t * source_p, unsigned source_linesize)
+{
+    const unsigned box_width = scaler->box_width;
+    const unsigned box_height = scaler->box_height;
+    const unsigned s_width = d_width * box_width;
+    uint16_t col_sums[FRAME_WIDTH];
+
+    for (unsigned y = 0; y != d_height; ++y)
     {
-	e += d_width;
-	if (e >= s_width)
+	// Sum columns of the box
+	memset(col_sums, 0, s_width * sizeof(uint16_t));
+	for (unsigned i = 0; i != box_height; ++i)
 	{
-	    e -= s_width;
-	    col_weights[x].cur = d_width - e;
-	    col_weights[x].spill = 1 + e;
+	    kernels->box_add_row(col_sums, source_p, s_width);
+	    source_p += source_linesize;
 	}
-	else
+
+	// Sum rows of the box and scale
+	const uint16_t * sum_p = col_sums;
+	for (unsigned x = 0; x != d_width; ++x)
 	{
-	    col_weights[x].cur = d_width;
-	    col_weights[x].spill = 0;
+	    unsigned sum = 0;
+	    for (unsigned i = 0; i != box_width; ++i)
+		sum += *sum_p++;
+	    dest_p[x] = scaler->box_table[sum];
 	}
+	dest_p += dest_linesize;
     }
+}
 
-    e = 0;
-    for (y = 0; y != s_height; ++y)
+static void pic_in_pic_general_fused(const struct video_effect_scaler * scaler,
+				     uint8_t * dest_p, unsigned dest_linesize,
+				     unsigned d_width,
+				     const uint8_t * source_p,
+				     unsigned source_linesize,
+				     unsigned s_width, unsigned s_height)
+{
+    const struct weights * col_weights = scaler->col_weights;
+    const struct weights * row_weights = scaler->row_weights;
+    const uint32_t weight_scale = scaler->weight_scale;
+    const unsigned dest_gap = dest_linesize - d_width;
+    uint32_t row_buffer[FRAME_WIDTH], * row_p;
+    unsigned x, y;
+
+    memset(row_buffer, 0, d_width * sizeof(uint32_t));
+
+    // Loop over source rows
+    for (y = 0; ; ++y)
     {
-	e += d_height;
-	if (e >= s_height)
-	{
-	    e -= s_height;
-	    row_weights[y].cur = d_height - e;
-	    row_weights[y].spill = 1 + e;
-	}
-	else
+	unsigned row_weight = row_weights[y].cur;
+	unsigned row_spill = row_weights[y].spill;
+
+	// Loop over source columns
+	row_p = row_buffer;
+	uint32_t value_sum = *row_p;
+	for (x = 0; x != s_width; ++x)
 	{
-	    row_weights[y].cur = d_height;
-	    row_weights[y].spill = 0;
+	    unsigned value_rw = *source_p++ * row_weight;
+	    value_sum += value_rw * col_weights[x].cur;
+	    if (col_weights[x].spill)
+	    {
+		*row_p++ = value_sum;
+		value_sum = *row_p + value_rw * (col_weights[x].spill - 1);
+	    }
 	}
-    }
+	source_p += source_linesize - s_width;
 
-    assert(col_weights[s_width - 1].spill == 1);
-    assert(col_weights[(s_width >> chroma_shift_horiz) - 1].spill == 1);
-    assert(row_weights[s_height - 1].spill == 1);
-    assert(row_weights[(s_height >> chroma_shift_vert) - 1].spill == 1);
+	if (!row_spill)
+	    continue;
 
-    for (unsigned plane = 0; plane != 3; ++plane)
-    {
-	if (plane == 1)
+	// Spit out destination row
+	row_p = row_buffer;
+	for (x = 0; x != d_width; ++x)
+	    *dest_p++ = (*row_p++ * (uint64_t)weight_scale
+			 + (1U << 31)) >> 32;
+
+	if (y == s_height - 1)
+	    break;
+
+	dest_p += dest_gap;
+
+	// Scale source row to next dest row if it overlaps
+	// otherwise just reinitialise row buffer
+	row_weight = row_spill - 1;
+	if (!row_weight)
 	{
-	    d_left >>= chroma_shift_horiz;
-	    d_width >>= chroma_shift_horiz;
-	    s_left >>= chroma_shift_horiz;
-	    s_width >>= chroma_shift_horiz;
-	    d_top >>= chroma_shift_vert;
-	    d_height >>= chroma_shift_vert;
-	    s_top >>= chroma_shift_vert;
-	    s_height >>= chroma_shift_vert;
+	    memset(row_buffer, 0, d_width * sizeof(uint32_t));
 	}
-	uint8_t * dest_p = (dest.planes.data[plane]
-			    + d_top * dest.planes.linesize[plane] + d_left);
-	const unsigned dest_gap = dest.planes.linesize[plane] - d_width;
-	uint32_t row_buffer[FRAME_WIDTH], * row_p;
-	memset(row_buffer, 0, d_width * sizeof(uint32_t));
-
-	// Loop over source rows
-	for (y = 0; ; ++y)
+	else
 	{
-	    unsigned row_weight = row_weights[y].cur;
-	    unsigned row_spill = row_weights[y].spill;
-
-	    // Loop over source columns
-	    const uint8_t * source_p =
-		source.planes.data[plane]
-		+ source.planes.linesize[plane] * (s_top + y) + s_left;
+	    const uint8_t * prev_p = source_p - source_linesize;
 	    row_p = row_buffer;
-	    uint32_t value_sum = *row_p;
+	    uint32_t value_sum = 0;
 	    for (x = 0; x != s_width; ++x)
 	    {
-		unsigned value_rw = *source_p++ * row_weight;
+		unsigned value_rw = *prev_p++ * row_weight;
 		value_sum += value_rw * col_weights[x].cur;
 		if (col_weights[x].spill)
 		{
 		    *row_p++ = value_sum;
-		    value_sum = *row_p + value_rw * (col_weights[x].spill - 1);
+		    value_sum = value_rw * (col_weights[x].spill - 1);
 		}
 	    }
+	}
+    }
+}
 
-	    if (!row_spill)
-		continue;
+#ifdef VIDEO_EFFECT_X86
 
-	    // Spit out destination row
-	    row_p = row_buffer;
-	    for (x = 0; x != d_width; ++x)
-		*dest_p++ = (*row_p++ * (uint64_t)weight_scale
-			     + (1U << 31)) >> 32;
+static void
+pic_in_pic_general_separable(const struct video_effect_scaler * scaler,
+			     uint8_t * dest_p, unsigned dest_linesize,
+			     unsigned d_width,
+			     const uint8_t * source_p,
+			     unsigned source_linesize,
+			     unsigned s_width, unsigned s_height)
+{
+    const struct weights * col_weights = scaler->col_weights;
+    const struct weights * row_weights = scaler->row_weights;
+    // Source row scaled horizontally
+    uint32_t row_buffer[FRAME_WIDTH];
+    // Weighted sum of scaled source rows for the current dest row
+    uint32_t dest_buffer[FRAME_WIDTH];
+    unsigned x, y;
+
+    memset(dest_buffer, 0, d_width * sizeof(uint32_t));
+
+    // Loop over source rows
+    for (y = 0; ; ++y)
+    {
+	// Loop over source columns
+	uint32_t * row_p = row_buffer;
+	uint32_t value_sum = 0;
+	for (x = 0; x != s_width; ++x)
+	{
+	    unsigned value = source_p[x];
+	    value_sum += value * col_weights[x].cur;
+	    if (col_weights[x].spill)
+	    {
+		*row_p++ = value_sum;
+		value_sum = value * (col_weights[x].spill - 1);
+	    }
+	}
+	source_p += source_linesize;
 
-	    if (y == s_height - 1)
-		break;
+	kernels->weight_add_row(dest_buffer, row_buffer, d_width,
+				row_weights[y].cur);
 
-	    dest_p += dest_gap;
+	unsigned row_spill = row_weights[y].spill;
+	if (!row_spill)
+	    continue;
 
-	    // Scale source row to next dest row if it overlaps
-	    // otherwise just reinitialise row buffer
-	    row_weight = row_spill - 1;
-	    if (!row_weight)
-	    {
-		memset(row_buffer, 0, d_width * sizeof(uint32_t));
-	    }
-	    else
-	    {
-		source_p -= s_width;
-		row_p = row_buffer;
-		uint32_t value_sum = 0;
-		for (x = 0; x != s_width; ++x)
-		{
-		    unsigned value_rw = *source_p++ * row_weight;
-		    value_sum += value_rw * col_weights[x].cur;
-		    if (col_weights[x].spill)
-		    {
-			*row_p++ = value_sum;
-			value_sum = value_rw * (col_weights[x].spill - 1);
-		    }
-		}
-	    }
+	// Spit out destination row
+	kernels->scale_row(dest_p, dest_buffer, d_width,
+			   scaler->weight_scale);
+
+	if (y == s_height - 1)
+	    break;
+
+	dest_p += dest_linesize;
+
+	// Scale source row to next dest row if it overlaps
+	memset(dest_buffer, 0, d_width * sizeof(uint32_t));
+	if (row_spill > 1)
+	    kernels->weight_add_row(dest_buffer, row_buffer, d_width,
+				    row_spill - 1);
+    }
+}
+
+#endif // VIDEO_EFFECT_X86
+
+void video_effect_pic_in_pic_scaled(const struct video_effect_scaler * scaler,
+				    struct raw_frame_ref dest,
+				    struct raw_frame_ref source)
+{
+    assert(dest.pix_fmt == scaler->pix_fmt
+	   && source.pix_fmt == scaler->pix_fmt);
+    assert((unsigned)scaler->s_rect.bottom <= source.height);
+    assert((unsigned)scaler->d_rect.bottom <= dest.height);
+
+    if (scaler->d_rect.left == scaler->d_rect.right
+	|| scaler->d_rect.top == scaler->d_rect.bottom)
+	return;
+
+    unsigned s_left = scaler->s_rect.left;
+    unsigned s_width = scaler->s_rect.right - scaler->s_rect.left;
+    unsigned s_top = scaler->s_rect.top;
+    unsigned s_height = scaler->s_rect.bottom - scaler->s_rect.top;
+    unsigned d_left = scaler->d_rect.left;
+    unsigned d_width = scaler->d_rect.right - scaler->d_rect.left;
+    unsigned d_top = scaler->d_rect.top;
+    unsigned d_height = scaler->d_rect.bottom - scaler->d_rect.top;
+
+    for (unsigned plane = 0; plane != 3; ++plane)
+    {
+	if (plane == 1)
+	{
+	    d_left >>= scaler->chroma_shift_horiz;
+	    d_width >>= scaler->chroma_shift_horiz;
+	    s_left >>= scaler->chroma_shift_horiz;
+	    s_width >>= scaler->chroma_shift_horiz;
+	    d_top >>= scaler->chroma_shift_vert;
+	    d_height >>= scaler->chroma_shift_vert;
+	    s_top >>= scaler->chroma_shift_vert;
+	    s_height >>= scaler->chroma_shift_vert;
 	}
+	uint8_t * dest_p = (dest.planes.data[plane]
+			    + d_top * dest.planes.linesize[plane] + d_left);
+	const uint8_t * source_p =
+	    (source.planes.data[plane]
+	     + s_top * source.planes.linesize[plane] + s_left);
+
+	if (scaler->box_width)
+	    pic_in_pic_box(scaler,
+			   dest_p, dest.planes.linesize[plane],
+			   d_width, d_height,
+			   source_p, source.planes.linesize[plane]);
+	else
+	    kernels->pic_in_pic_general(
+		scaler,
+		dest_p, dest.planes.linesize[plane], d_width,
+		source_p, source.planes.linesize[plane],
+		s_width, s_height);
     }
 }
 
+void video_effect_pic_in_pic(struct raw_frame_ref dest,
+			     struct rectangle d_rect,
+			     struct raw_frame_ref source,
+			     struct rectangle s_rect)
+{
+    // Building the box filter table costs more than it saves for a
+    // single frame, so always use the general filter here
+    struct video_effect_scaler * scaler =
+	scaler_new(dest.pix_fmt, d_rect, s_rect, 0);
+    assert(scaler);
+    video_effect_pic_in_pic_scaled(scaler, dest, source);
+    video_effect_scaler_free(scaler);
+}
+
 void video_effect_fade(struct raw_frame_ref dest,
 		       struct raw_frame_ref sec,
 		       uint8_t scale)
 {
-    int x, y, plane;
+    int y, plane;
     uint8_t *ptr_d, *ptr_s;
-    uint16_t tmp;
     int width, height;
 
     int chroma_shift_horiz, chroma_shift_vert;
@@ -294,14 +864,9 @@ void video_effect_fade(struct raw_frame_ref dest,
 	}
         for (y = 0; y < height; y++)
         {
-	    for (x = 0; x < width; x++)
-	    {
-		tmp = scale * (*ptr_s - *ptr_d);
-		*ptr_d += (uint8_t)(tmp >> 8);
-		ptr_d++; ptr_s++;
-	    }
-	    ptr_d += dest.planes.linesize[plane] - width;
-	    ptr_s += dest.planes.linesize[plane] - width;
+	    kernels->fade_row(ptr_d, ptr_s, width, scale);
+	    ptr_d += dest.planes.linesize[plane];
+	    ptr_s += dest.planes.linesize[plane];
         }
     }
 }
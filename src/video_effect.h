@@ -13,6 +13,24 @@ extern "C" {
 #include "frame.h"
 #include "geometry.h"
 
+// Instruction sets that video effects may be implemented with.  By
+// default the best one supported by the CPU is used.
+enum video_effect_isa
+{
+    video_effect_isa_scalar,	// portable C; the reference
+    video_effect_isa_sse2,
+    video_effect_isa_avx2,
+    video_effect_isa_neon,
+    video_effect_isa_count
+};
+
+const char * video_effect_isa_name(enum video_effect_isa isa);
+// Return whether this build and the CPU support the instruction set.
+int video_effect_isa_supported(enum video_effect_isa isa);
+// Select the instruction set to use.  This is only for testing and
+// must not be called while any effect is running.
+void video_effect_set_isa(enum video_effect_isa isa);
+
 void video_effect_show_title_safe(struct raw_frame_ref dest);
 void video_effect_brighten(struct raw_frame_ref dest,
 			   struct rectangle dest_rect);
@@ -20,6 +38,20 @@ void video_effect_pic_in_pic(struct raw_frame_ref dest,
 			     struct rectangle dest_rect,
                              struct raw_frame_ref source,
 			     struct rectangle source_rect);
+
+// Scaler for picture-in-picture.  This holds the scaling tables for a
+// pixel format and pair of destination and source rectangles, so that
+// they can be reused for a series of frames.
+struct video_effect_scaler;
+struct video_effect_scaler *
+video_effect_scaler_new(enum PixelFormat pix_fmt,
+			struct rectangle dest_rect,
+			struct rectangle source_rect);
+void video_effect_scaler_free(struct video_effect_scaler * scaler);
+void video_effect_pic_in_pic_scaled(const struct video_effect_scaler * scaler,
+				    struct raw_frame_ref dest,
+				    struct raw_frame_ref source);
+
 void video_effect_fade(struct raw_frame_ref dest,
 		       struct raw_frame_ref sec,
 		       uint8_t scale);
@@ -0,0 +1,50 @@
+#include <cassert>
+
+#include "decoded_frame_cache.hpp"
+#include "frame.h"
+#include "frame_pool.hpp"
+
+int main()
+{
+    raw_frame_ptr full = allocate_raw_frame(&dv_system_625_50);
+    raw_frame_ptr small = allocate_raw_frame(&dv_system_625_50);
+    raw_frame_ptr other = allocate_raw_frame(&dv_system_625_50);
+
+    decoded_frame_cache cache(42);
+    assert(cache.serial_num() == 42);
+    assert(!cache.find(0, 42));
+
+    // Frames are keyed by source and resolution
+    cache.insert(0, 42, 0, full);
+    cache.insert(0, 42, 3, small);
+    cache.insert(1, 42, 0, other);
+    assert(cache.find(0, 42) == full);
+    assert(cache.find(0, 42, 3) == small);
+    assert(cache.find(1, 42) == other);
+    assert(!cache.find(1, 42, 3));
+    assert(!cache.find(2, 42));
+
+    // Frames for other ticks are neither added nor found
+    cache.insert(2, 43, 0, other);
+    assert(!cache.find(2, 43));
+    assert(!cache.find(0, 41));
+
+    // Null frames aren't added
+    cache.insert(2, 42, 0, raw_frame_ptr());
+    assert(!cache.find(2, 42));
+
+    // Inserting again replaces
+    cache.insert(1, 42, 0, full);
+    assert(cache.find(1, 42) == full);
+
+    // Taking a frame removes it
+    assert(cache.take(0, 42, 3) == small);
+    assert(!cache.find(0, 42, 3));
+    assert(!cache.take(0, 42, 3));
+    assert(cache.find(0, 42) == full);
+
+    // The cache holds references to its frames
+    raw_frame * full_p = full.get();
+    full.reset();
+    assert(cache.find(0, 42).get() == full_p);
+}
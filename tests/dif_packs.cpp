@@ -0,0 +1,100 @@
+#include <cassert>
+#include <cstring>
+#include <ctime>
+
+#include "dif.h"
+
+// Check that the time code and record time written by the mixer
+// (mixer::set_times) can be read back from a frame.
+
+namespace
+{
+    uint8_t bcd(unsigned v)
+    {
+	return ((v / 10) << 4) + v % 10;
+    }
+
+    void init_buffer(uint8_t * buffer, const dv_system * system)
+    {
+	std::memset(buffer, 0xff, system->size);
+	buffer[3] = (system == &dv_system_625_50) ? 0x80 : 0;
+	assert(dv_buffer_system(buffer) == system);
+    }
+
+    // Write the time code for a frame number as the mixer does
+    void set_timecode(uint8_t * buffer, unsigned frame_num)
+    {
+	unsigned frame_rate;
+	if (buffer[3] & 0x80)
+	{
+	    frame_rate = 25;
+	}
+	else
+	{
+	    unsigned block_pos = frame_num % (10 * 60 * 30 - 18);
+	    frame_num += 18 * (frame_num / (10 * 60 * 30 - 18));
+	    if (block_pos > 1)
+		frame_num += 2 * ((block_pos - 2) / (60 * 30 - 2));
+	    frame_rate = 30;
+	}
+
+	uint8_t * pack = buffer + 6 * DIF_SEQUENCE_SIZE + DIF_BLOCK_SIZE + 6;
+	pack[0] = 0x13;
+	pack[1] = bcd(frame_num % frame_rate) | (1 << 6);
+	pack[2] = bcd(frame_num / frame_rate % 60);
+	pack[3] = bcd(frame_num / (60 * frame_rate) % 60);
+	pack[4] = bcd(frame_num / (60 * 60 * frame_rate) % 24);
+    }
+
+    void test_timecode(const dv_system * system)
+    {
+	static uint8_t buffer[DIF_MAX_FRAME_SIZE];
+	init_buffer(buffer, system);
+
+	unsigned frame_count;
+	assert(!dv_buffer_get_timecode(buffer, &frame_count));
+
+	// Every frame of a day should give back its own number.  A day
+	// is 144 blocks of 10 minutes, each 15000 frames at 25 Hz or
+	// 17982 frames with drop-frame time code.
+	unsigned frames_per_day =
+	    24 * 6 * (system == &dv_system_625_50 ? 15000 : 17982);
+	for (unsigned frame_num = 0; frame_num != frames_per_day; ++frame_num)
+	{
+	    set_timecode(buffer, frame_num);
+	    assert(dv_buffer_get_timecode(buffer, &frame_count));
+	    assert(frame_count == frame_num);
+	}
+    }
+
+    void test_record_time(const dv_system * system)
+    {
+	static uint8_t buffer[DIF_MAX_FRAME_SIZE];
+	init_buffer(buffer, system);
+
+	std::tm tm;
+	assert(!dv_buffer_get_record_time(buffer, &tm));
+
+	uint8_t * vaux = buffer + 3 * DIF_BLOCK_SIZE;
+	static const uint8_t date_pack[DIF_PACK_SIZE] = {
+	    0x62, 0xff, 0x18, 0x10, 0x09
+	};
+	static const uint8_t time_pack[DIF_PACK_SIZE] = {
+	    0x63, 0xff, 0x05, 0x32, 0x14
+	};
+	std::memcpy(vaux + 13, date_pack, DIF_PACK_SIZE);
+	std::memcpy(vaux + 18, time_pack, DIF_PACK_SIZE);
+
+	assert(dv_buffer_get_record_time(buffer, &tm));
+	assert(tm.tm_year == 109 && tm.tm_mon == 9 && tm.tm_mday == 18);
+	assert(tm.tm_hour == 14 && tm.tm_min == 32 && tm.tm_sec == 5);
+    }
+}
+
+int main()
+{
+    test_timecode(&dv_system_625_50);
+    test_timecode(&dv_system_525_60);
+    test_record_time(&dv_system_625_50);
+    test_record_time(&dv_system_525_60);
+}
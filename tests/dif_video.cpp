@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "dif.h"
+
+namespace
+{
+    void init_buffer(uint8_t * buffer, const dv_system * system,
+		     unsigned apt, uint8_t fill)
+    {
+	std::memset(buffer, fill, system->size);
+	buffer[3] = (system == &dv_system_625_50) ? 0x80 : 0;
+	buffer[4] = apt;
+	assert(dv_buffer_system(buffer) == system);
+    }
+
+    bool intersects(rectangle rect, const rectangle & region)
+    {
+	rect &= region;
+	return !rect.empty();
+    }
+
+    void test_layout(const dv_system * system)
+    {
+	static uint8_t buffer[DIF_MAX_FRAME_SIZE];
+	init_buffer(buffer, system, 0, 0);
+
+	// Every pixel must be covered by exactly one macroblock
+	std::vector<unsigned> coverage(system->frame_width
+				       * system->frame_height);
+	// Every video block must be distinct from the other blocks
+	std::vector<bool> block_used(system->seq_count
+				     * DIF_BLOCKS_PER_SEQUENCE);
+
+	for (unsigned seq = 0; seq != system->seq_count; ++seq)
+	{
+	    for (unsigned seg = 0; seg != DIF_VIDEO_SEGMENTS_PER_SEQUENCE;
+		 ++seg)
+	    {
+		rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+		bool ok = dv_buffer_get_segment_rects(buffer, seq, seg, rects);
+		assert(ok);
+
+		for (unsigned mb = 0; mb != DIF_MACROBLOCKS_PER_SEGMENT; ++mb)
+		{
+		    const rectangle & rect = rects[mb];
+		    assert(rect.left >= 0 && rect.left < rect.right
+			   && rect.right <= int(system->frame_width));
+		    assert(rect.top >= 0 && rect.top < rect.bottom
+			   && rect.bottom <= int(system->frame_height));
+		    assert((rect.right - rect.left) * (rect.bottom - rect.top)
+			   == 256);
+		    for (int y = rect.top; y != rect.bottom; ++y)
+			for (int x = rect.left; x != rect.right; ++x)
+			    ++coverage[y * system->frame_width + x];
+
+		    size_t offset = dv_video_block_offset(
+			seq, seg * DIF_MACROBLOCKS_PER_SEGMENT + mb);
+		    assert(offset % DIF_BLOCK_SIZE == 0);
+		    unsigned block = offset / DIF_BLOCK_SIZE;
+		    assert(block / DIF_BLOCKS_PER_SEQUENCE == seq);
+		    // Not a header, subcode, VAUX or audio block
+		    assert(block % DIF_BLOCKS_PER_SEQUENCE >= 7);
+		    assert((block % DIF_BLOCKS_PER_SEQUENCE - 6) % 16 != 0);
+		    assert(!block_used[block]);
+		    block_used[block] = true;
+		}
+	    }
+	}
+
+	for (size_t i = 0; i != coverage.size(); ++i)
+	    assert(coverage[i] == 1);
+    }
+
+    void test_copy(const dv_system * system, rectangle region)
+    {
+	static uint8_t dest[DIF_MAX_FRAME_SIZE], source[DIF_MAX_FRAME_SIZE];
+	init_buffer(dest, system, 0, 0);
+	init_buffer(source, system, 0, 0xff);
+
+	unsigned copy_count = dv_buffer_copy_video_outside(dest, source,
+							   &region);
+	unsigned expected_count = 0;
+
+	for (unsigned seq = 0; seq != system->seq_count; ++seq)
+	{
+	    for (unsigned seg = 0; seg != DIF_VIDEO_SEGMENTS_PER_SEQUENCE;
+		 ++seg)
+	    {
+		rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+		dv_buffer_get_segment_rects(dest, seq, seg, rects);
+		bool keep = true;
+		for (unsigned mb = 0; mb != DIF_MACROBLOCKS_PER_SEGMENT; ++mb)
+		    if (intersects(rects[mb], region))
+			keep = false;
+		if (keep)
+		    ++expected_count;
+
+		for (unsigned mb = 0; mb != DIF_MACROBLOCKS_PER_SEGMENT; ++mb)
+		{
+		    const uint8_t * block = dest + dv_video_block_offset(
+			seq, seg * DIF_MACROBLOCKS_PER_SEGMENT + mb);
+		    assert(block[DIF_BLOCK_ID_SIZE - 1] == 0);
+		    for (unsigned i = DIF_BLOCK_ID_SIZE; i != DIF_BLOCK_SIZE; ++i)
+			assert(block[i] == (keep ? 0xff : 0));
+		}
+	    }
+	}
+	assert(copy_count == expected_count);
+
+	// Non-video blocks must be untouched
+	assert(dest[4] == 0 && dest[5] == 0);
+	assert(dest[6 * DIF_BLOCK_SIZE + DIF_BLOCK_ID_SIZE] == 0);
+    }
+
+    void set_dc(uint8_t * area, int dc)
+    {
+	unsigned bits = dc & 0x1ff;
+	area[0] = bits >> 1;
+	area[1] = (area[1] & 0x7f) | (bits & 1) << 7;
+    }
+
+    uint8_t dc_to_pixel(int dc)
+    {
+	return std::min((dc + 257) / 2, 255);
+    }
+
+    void test_thumbnail(const dv_system * system)
+    {
+	static uint8_t buffer[DIF_MAX_FRAME_SIZE];
+	init_buffer(buffer, system, 0, 0);
+
+	const bool is_625 = system == &dv_system_625_50;
+	const int widths[3] = {
+	    int(system->frame_width / 8), is_625 ? 45 : 23, is_625 ? 45 : 23
+	};
+	const int heights[3] = {
+	    int(system->frame_height / 8), is_625 ? 36 : 60, is_625 ? 36 : 60
+	};
+	// Use line sizes bigger than the widths
+	const int linesizes[3] = { widths[0] + 3, widths[1] + 5, widths[2] + 1 };
+	std::vector<uint8_t> planes[3], expected[3];
+	std::vector<bool> covered[3];
+	uint8_t * plane_ptrs[3];
+	for (int i = 0; i != 3; ++i)
+	{
+	    planes[i].resize(linesizes[i] * heights[i], 0xaa);
+	    expected[i].resize(linesizes[i] * heights[i], 0xaa);
+	    covered[i].resize(linesizes[i] * heights[i]);
+	    plane_ptrs[i] = &planes[i][0];
+	}
+
+	// With all DC coefficients 0, everything is mid-grey
+	bool ok = dv_buffer_get_thumbnail(buffer, plane_ptrs, linesizes);
+	assert(ok);
+	for (int i = 0; i != 3; ++i)
+	    for (int y = 0; y != heights[i]; ++y)
+		for (int x = 0; x != widths[i]; ++x)
+		    assert(planes[i][y * linesizes[i] + x] == 128);
+
+	// Give each DCT block a different DC coefficient, covering the
+	// whole range, and work out where it should appear
+	int dc = -256;
+	for (unsigned seq = 0; seq != system->seq_count; ++seq)
+	{
+	    for (unsigned seg = 0; seg != DIF_VIDEO_SEGMENTS_PER_SEQUENCE;
+		 ++seg)
+	    {
+		rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+		dv_buffer_get_segment_rects(buffer, seq, seg, rects);
+
+		for (unsigned mb = 0; mb != DIF_MACROBLOCKS_PER_SEGMENT; ++mb)
+		{
+		    uint8_t * block = buffer + dv_video_block_offset(
+			seq, seg * DIF_MACROBLOCKS_PER_SEGMENT + mb);
+		    const rectangle & rect = rects[mb];
+		    const bool is_row = rect.bottom - rect.top == 8;
+
+		    for (unsigned i = 0; i != 4; ++i)
+		    {
+			dc = (dc + 256 + 37) % 512 - 256;
+			set_dc(block + 4 + 14 * i, dc);
+			int x = rect.left / 8 + (is_row ? i : i & 1);
+			int y = rect.top / 8 + (is_row ? 0 : i >> 1);
+			expected[0][y * linesizes[0] + x] = dc_to_pixel(dc);
+			covered[0][y * linesizes[0] + x] = true;
+		    }
+
+		    int c_x = rect.left / (is_625 ? 16 : 32);
+		    int c_y = rect.top / (is_625 ? 16 : 8);
+		    int c_rows = is_625 || is_row ? 1 : 2;
+		    for (unsigned i = 0; i != 2; ++i)
+		    {
+			dc = (dc + 256 + 37) % 512 - 256;
+			set_dc(block + 60 + 10 * i, dc);
+			// Cr comes first in the macroblock but last in the
+			// planes
+			for (int row = 0; row != c_rows; ++row)
+			{
+			    int pos = (c_y + row) * linesizes[2 - i] + c_x;
+			    expected[2 - i][pos] = dc_to_pixel(dc);
+			    covered[2 - i][pos] = true;
+			}
+		    }
+		}
+	    }
+	}
+
+	ok = dv_buffer_get_thumbnail(buffer, plane_ptrs, linesizes);
+	assert(ok);
+	for (int i = 0; i != 3; ++i)
+	{
+	    assert(planes[i] == expected[i]);
+	    // Every pixel must be written
+	    for (int y = 0; y != heights[i]; ++y)
+		for (int x = 0; x != widths[i]; ++x)
+		    assert(covered[i][y * linesizes[i] + x]);
+	}
+
+	// Chroma is optional
+	std::fill(planes[0].begin(), planes[0].end(), 0xaa);
+	plane_ptrs[1] = plane_ptrs[2] = 0;
+	ok = dv_buffer_get_thumbnail(buffer, plane_ptrs, linesizes);
+	assert(ok && planes[0] == expected[0]);
+    }
+
+    void test_equal(const dv_system * system)
+    {
+	static uint8_t left[DIF_MAX_FRAME_SIZE], right[DIF_MAX_FRAME_SIZE];
+	init_buffer(left, system, 0, 0);
+	init_buffer(right, system, 0, 0);
+	assert(dv_buffer_video_equal(left, right));
+
+	// Differences outside the video blocks don't matter
+	right[6 * DIF_BLOCK_SIZE + DIF_BLOCK_ID_SIZE] = 1; // audio
+	right[(system->seq_count - 1) * DIF_SEQUENCE_SIZE + 4 * DIF_BLOCK_SIZE
+	      + DIF_BLOCK_ID_SIZE] = 1; // VAUX
+	assert(dv_buffer_video_equal(left, right));
+
+	// Differences in the last video block do
+	right[dv_video_block_offset(system->seq_count - 1,
+				    DIF_VIDEO_BLOCKS_PER_SEQUENCE - 1)
+	      + DIF_BLOCK_SIZE - 1] = 1;
+	assert(!dv_buffer_video_equal(left, right));
+
+	init_buffer(right, system == &dv_system_625_50
+		    ? &dv_system_525_60 : &dv_system_625_50, 0, 0);
+	assert(!dv_buffer_video_equal(left, right));
+    }
+}
+
+int main()
+{
+    static const rectangle regions[] = {
+	{ 0, 0, 0, 0 },
+	{ 0, 0, 720, 576 },
+	{ 360, 240, 600, 400 },
+	{ 700, 0, 720, 16 },
+	{ 17, 33, 18, 34 }
+    };
+
+    test_layout(&dv_system_625_50);
+    test_layout(&dv_system_525_60);
+
+    for (unsigned i = 0; i != sizeof(regions) / sizeof(regions[0]); ++i)
+    {
+	test_copy(&dv_system_625_50, regions[i]);
+	test_copy(&dv_system_525_60, regions[i]);
+    }
+
+    test_equal(&dv_system_625_50);
+    test_equal(&dv_system_525_60);
+
+    test_thumbnail(&dv_system_625_50);
+    test_thumbnail(&dv_system_525_60);
+
+    // DVCPRO 625/50 uses a different layout, so nothing is copied
+    {
+	static uint8_t dest[DIF_MAX_FRAME_SIZE], source[DIF_MAX_FRAME_SIZE];
+	rectangle rects[DIF_MACROBLOCKS_PER_SEGMENT];
+	init_buffer(dest, &dv_system_625_50, 1, 0);
+	init_buffer(source, &dv_system_625_50, 1, 0xff);
+	assert(!dv_buffer_get_segment_rects(source, 0, 0, rects));
+	assert(dv_buffer_copy_video_outside(dest, source, &regions[0]) == 0);
+	assert(dest[dv_video_block_offset(0, 0) + DIF_BLOCK_ID_SIZE] == 0);
+	uint8_t thumb[90 * 72];
+	uint8_t * planes[3] = { thumb, 0, 0 };
+	int linesizes[3] = { 90, 0, 0 };
+	assert(!dv_buffer_get_thumbnail(source, planes, linesizes));
+    }
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <sys/time.h>
+
+#include "avcodec_wrap.h"
+#include "video_effect.h"
+
+const int linesize = FRAME_WIDTH + 32;
+const int height = FRAME_HEIGHT_MAX;
+const size_t plane_size = linesize * height;
+
+raw_frame_ref alloc_frame(PixelFormat pix_fmt)
+{
+    raw_frame_ref frame;
+    for (int i = 0; i != 3; ++i)
+    {
+	frame.planes.data[i] = new uint8_t[plane_size];
+	frame.planes.linesize[i] = linesize;
+    }
+    frame.planes.data[3] = 0;
+    frame.planes.linesize[3] = 0;
+    frame.pix_fmt = pix_fmt;
+    frame.height = height;
+    return frame;
+}
+
+void free_frame(raw_frame_ref frame)
+{
+    for (int i = 0; i != 3; ++i)
+	delete[] frame.planes.data[i];
+}
+
+void fill_random(raw_frame_ref frame)
+{
+    for (int i = 0; i != 3; ++i)
+	for (size_t j = 0; j != plane_size; ++j)
+	    frame.planes.data[i][j] = std::rand();
+}
+
+void copy_frame(raw_frame_ref dest, raw_frame_ref source)
+{
+    for (int i = 0; i != 3; ++i)
+	std::memcpy(dest.planes.data[i], source.planes.data[i], plane_size);
+}
+
+bool frames_equal(raw_frame_ref left, raw_frame_ref right)
+{
+    for (int i = 0; i != 3; ++i)
+	if (std::memcmp(left.planes.data[i], right.planes.data[i], plane_size))
+	    return false;
+    return true;
+}
+
+#ifdef TEST_SPEED
+
+void test_format(PixelFormat pix_fmt)
+{
+    const int frame_count = 1000;
+    raw_frame_ref dest = alloc_frame(pix_fmt);
+    raw_frame_ref sec = alloc_frame(pix_fmt);
+    fill_random(dest);
+    fill_random(sec);
+
+    for (int isa = 0; isa != video_effect_isa_count; ++isa)
+    {
+	if (!video_effect_isa_supported(video_effect_isa(isa)))
+	    continue;
+	video_effect_set_isa(video_effect_isa(isa));
+
+	timeval start, end;
+	gettimeofday(&start, 0);
+	for (int i = 0; i != frame_count; ++i)
+	    video_effect_fade(dest, sec, i);
+	gettimeofday(&end, 0);
+
+	double secs = (end.tv_sec - start.tv_sec
+		       + (end.tv_usec - start.tv_usec) / 1e6);
+	std::cout << video_effect_isa_name(video_effect_isa(isa)) << ": "
+		  << frame_count / secs << " frames/s\n";
+    }
+
+    free_frame(sec);
+    free_frame(dest);
+}
+
+#else // !TEST_SPEED
+
+void test_format(PixelFormat pix_fmt)
+{
+    raw_frame_ref orig = alloc_frame(pix_fmt);
+    raw_frame_ref sec = alloc_frame(pix_fmt);
+    raw_frame_ref expected = alloc_frame(pix_fmt);
+    raw_frame_ref found = alloc_frame(pix_fmt);
+    fill_random(orig);
+    fill_random(sec);
+
+    for (unsigned scale = 0; scale != 256; ++scale)
+    {
+	video_effect_set_isa(video_effect_isa_scalar);
+	copy_frame(expected, orig);
+	video_effect_fade(expected, sec, scale);
+
+	// Check the edges of the range
+	if (scale == 0)
+	    assert(frames_equal(expected, orig));
+
+	// Check that every other implementation matches
+	for (int isa = 1; isa != video_effect_isa_count; ++isa)
+	{
+	    if (!video_effect_isa_supported(video_effect_isa(isa)))
+		continue;
+	    video_effect_set_isa(video_effect_isa(isa));
+	    copy_frame(found, orig);
+	    video_effect_fade(found, sec, scale);
+	    if (!frames_equal(expected, found))
+	    {
+		std::cerr << video_effect_isa_name(video_effect_isa(isa))
+			  << " fade differs at scale " << scale << "\n";
+		assert(false);
+	    }
+	}
+    }
+
+    free_frame(found);
+    free_frame(expected);
+    free_frame(sec);
+    free_frame(orig);
+}
+
+#endif // TEST_SPEED
+
+int main()
+{
+    avcodec_init();
+    avcodec_register_all();
+    test_format(PIX_FMT_YUV420P);
+    test_format(PIX_FMT_YUV411P);
+}
@@ -0,0 +1,137 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "frame_index.h"
+
+// Check that frame indices read back as written, and that the
+// remains of an interrupted recording are read up to the last valid
+// record.
+
+namespace
+{
+    const uint32_t frame_size = 144000;
+
+    std::vector<uint8_t> make_index(unsigned frame_count, bool complete)
+    {
+	std::vector<uint8_t> data(FRAME_INDEX_HEADER_SIZE
+				  + (frame_count + 1) * FRAME_INDEX_RECORD_SIZE);
+	frame_index_encode_header(&data[0], frame_size);
+
+	frame_index_record record;
+	for (unsigned i = 0; i != frame_count; ++i)
+	{
+	    record.frame_num = i;
+	    record.serial_num = 1000 + i;
+	    record.record_time = 1255870325 + i / 25;
+	    record.cut = i == 0 ? 'C' : 0;
+	    record.flags = FRAME_INDEX_FLAG_SERIAL | FRAME_INDEX_FLAG_TIME;
+	    frame_index_encode_record(
+		&data[FRAME_INDEX_HEADER_SIZE + i * FRAME_INDEX_RECORD_SIZE],
+		&record);
+	}
+
+	if (complete)
+	{
+	    std::memset(&record, 0, sizeof(record));
+	    record.frame_num = frame_count;
+	    record.cut = 'S';
+	    record.flags = FRAME_INDEX_FLAG_END;
+	    frame_index_encode_record(
+		&data[FRAME_INDEX_HEADER_SIZE
+		      + frame_count * FRAME_INDEX_RECORD_SIZE],
+		&record);
+	}
+	else
+	{
+	    data.resize(data.size() - FRAME_INDEX_RECORD_SIZE);
+	}
+
+	return data;
+    }
+
+    void write_index(const std::string & dif_name,
+		     const std::vector<uint8_t> & data)
+    {
+	std::string name = dif_name + FRAME_INDEX_SUFFIX;
+	std::FILE * file = std::fopen(name.c_str(), "wb");
+	assert(file);
+	if (!data.empty())
+	    assert(std::fwrite(&data[0], data.size(), 1, file) == 1);
+	std::fclose(file);
+    }
+
+    void check_index(const std::string & dif_name, unsigned frame_count,
+		     bool complete)
+    {
+	frame_index index;
+	assert(frame_index_read(dif_name.c_str(), &index));
+	assert(index.frame_size == frame_size);
+	assert(index.frame_count == frame_count);
+	assert(index.complete == complete);
+	for (unsigned i = 0; i != frame_count; ++i)
+	{
+	    assert(index.records[i].frame_num == i);
+	    assert(index.records[i].serial_num == 1000 + i);
+	    assert(index.records[i].record_time == 1255870325 + i / 25);
+	    assert(index.records[i].cut == (i == 0 ? 'C' : 0));
+	    assert(index.records[i].flags
+		   == (FRAME_INDEX_FLAG_VALID | FRAME_INDEX_FLAG_SERIAL
+		       | FRAME_INDEX_FLAG_TIME));
+	}
+	frame_index_free(&index);
+    }
+}
+
+int main()
+{
+    char dir_name[] = "/tmp/frame_index.XXXXXX";
+    assert(mkdtemp(dir_name));
+    std::string dif_name = std::string(dir_name) + "/test.dv";
+    std::vector<uint8_t> data;
+
+    // No index
+    frame_index index;
+    assert(!frame_index_read(dif_name.c_str(), &index));
+
+    // Complete index, with and without frames
+    write_index(dif_name, make_index(3000, true));
+    check_index(dif_name, 3000, true);
+    write_index(dif_name, make_index(0, true));
+    check_index(dif_name, 0, true);
+
+    // Interrupted recordings: no end record, a partial record, or
+    // zero-filled records
+    write_index(dif_name, make_index(100, false));
+    check_index(dif_name, 100, false);
+    data = make_index(100, false);
+    data.resize(data.size() - FRAME_INDEX_RECORD_SIZE / 2);
+    write_index(dif_name, data);
+    check_index(dif_name, 99, false);
+    data = make_index(100, false);
+    data.resize(data.size() + 4096);
+    write_index(dif_name, data);
+    check_index(dif_name, 100, false);
+
+    // A record out of sequence ends the index
+    data = make_index(100, true);
+    data[FRAME_INDEX_HEADER_SIZE + 50 * FRAME_INDEX_RECORD_SIZE] = 49;
+    write_index(dif_name, data);
+    check_index(dif_name, 50, false);
+
+    // Invalid header
+    write_index(dif_name, std::vector<uint8_t>());
+    assert(!frame_index_read(dif_name.c_str(), &index));
+    data = make_index(10, true);
+    data[4] = FRAME_INDEX_VERSION + 1;
+    write_index(dif_name, data);
+    assert(!frame_index_read(dif_name.c_str(), &index));
+
+    unlink((dif_name + FRAME_INDEX_SUFFIX).c_str());
+    rmdir(dir_name);
+}
@@ -0,0 +1,107 @@
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "frame.h"
+#include "frame_pool.hpp"
+
+namespace
+{
+    const unsigned thread_count = 4;
+    const unsigned frames_per_thread = 20;
+    const unsigned iterations = 2000;
+
+    // Repeatedly allocate a batch of frames, mark each with an owner
+    // id, yield and check that no other thread was given the same
+    // buffers.
+    void run_thread(unsigned id)
+    {
+	std::vector<dv_frame_ptr> frames(frames_per_thread);
+
+	for (unsigned i = 0; i != iterations; ++i)
+	{
+	    for (unsigned j = 0; j != frames_per_thread; ++j)
+	    {
+		frames[j] = allocate_dv_frame();
+		frames[j]->serial_num = id;
+		std::memset(frames[j]->buffer, id, 16);
+	    }
+	    boost::this_thread::yield();
+	    for (unsigned j = 0; j != frames_per_thread; ++j)
+	    {
+		assert(frames[j]->serial_num == id);
+		assert(frames[j]->buffer[0] == id && frames[j]->buffer[15] == id);
+		frames[j].reset();
+	    }
+	}
+    }
+}
+
+int main()
+{
+    frame_pool_stats stats = get_dv_frame_pool_stats();
+    assert(stats.capacity == 0 && stats.limit == 0 && stats.in_use == 0);
+
+    // Reserved pool has a hard limit
+    reserve_raw_frame_pool(&dv_system_625_50, 3, 0);
+    {
+	raw_frame_ptr raw[4];
+	for (unsigned i = 0; i != 3; ++i)
+	{
+	    raw[i] = allocate_raw_frame(&dv_system_625_50);
+	    // Raw frame buffers must be suitably aligned for SIMD
+	    assert(reinterpret_cast<uintptr_t>(raw_frame_buffer(raw[i].get()))
+		   % RAW_FRAME_ALIGN == 0);
+	}
+	assert(!allocate_raw_frame(&dv_system_625_50, std::nothrow));
+	bool threw = false;
+	try
+	{
+	    allocate_raw_frame(&dv_system_625_50);
+	}
+	catch (std::bad_alloc &)
+	{
+	    threw = true;
+	}
+	assert(threw);
+	stats = get_raw_frame_pool_stats();
+	assert(stats.capacity == 3 && stats.limit == 3 && stats.in_use == 3);
+
+	// A buffer is only freed once all references have gone
+	raw_frame_ptr copy(raw[0]);
+	raw[0].reset();
+	assert(get_raw_frame_pool_stats().in_use == 3);
+	raw[0].swap(copy);
+	assert(raw[0] && !copy);
+
+	raw[1].reset();
+	raw[3] = allocate_raw_frame(&dv_system_625_50, std::nothrow);
+	assert(raw[3]);
+
+	// The pool for the other system is separate and unreserved
+	raw_frame_ptr raw_525(allocate_raw_frame(&dv_system_525_60));
+	stats = get_raw_frame_pool_stats();
+	assert(stats.limit == 3 && stats.in_use == 4);
+    }
+    stats = get_raw_frame_pool_stats();
+    assert(stats.in_use == 0 && stats.in_use_max == 4);
+    assert(raw_frame_size(&dv_system_525_60)
+	   < raw_frame_size(&dv_system_625_50));
+
+    boost::thread_group threads;
+    for (unsigned id = 1; id <= thread_count; ++id)
+	threads.create_thread(boost::bind(run_thread, id));
+    threads.join_all();
+
+    stats = get_dv_frame_pool_stats();
+    assert(stats.in_use == 0);
+    assert(stats.in_use_max >= frames_per_thread
+	   && stats.in_use_max <= thread_count * frames_per_thread);
+    assert(stats.capacity >= stats.in_use_max);
+
+    return 0;
+}
@@ -1,26 +1,188 @@
 #include <cassert>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 
+#include <sys/time.h>
+
 #include "avcodec_wrap.h"
 #include "video_effect.h"
 
 const uint32_t source_colour = 0xfefefe, dest_colour = 0x000000, pad_colour = 0xbadbad;
 
-#ifdef TEST_SPEED
-const int pad = 0;
-const int dims[] = {
-    480, 576, 702, 712, 720
-};
-#else
 const int pad = 100;
 const int dims[] = {
     1, 2, 3, 4, 15, 16, 17, 31, 32, 33, 64,
     128, 256, 480, 576, 702, 712, 719, 720
 };
-#endif
 const int n_dims = sizeof(dims) / sizeof(dims[0]);
 
+// Source and destination frame sizes, which hold rectangles of all
+// the above sizes.  Testing every combination takes a long time, so
+// unless TEST_EXHAUSTIVE is defined we use a subset with small, odd
+// and full-size frames.
+#ifdef TEST_EXHAUSTIVE
+const int * const frame_dims = dims;
+const int n_frame_dims = n_dims;
+#else
+const int frame_dims[] = {
+    4, 17, 33, 128, 720
+};
+const int n_frame_dims = sizeof(frame_dims) / sizeof(frame_dims[0]);
+#endif
+
+// The original implementation of video_effect_pic_in_pic(), which
+// the optimised implementations must match exactly
+void reference_pic_in_pic(raw_frame_ref dest, rectangle d_rect,
+			  raw_frame_ref source, rectangle s_rect)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    avcodec_get_chroma_sub_sample(dest.pix_fmt,
+				  &chroma_shift_horiz, &chroma_shift_vert);
+
+    s_rect.left &= -(1U << chroma_shift_horiz);
+    s_rect.right &= -(1U << chroma_shift_horiz);
+    s_rect.top &= -(1U << chroma_shift_vert);
+    s_rect.bottom &= -(1U << chroma_shift_vert);
+    d_rect.left &= -(1U << chroma_shift_horiz);
+    d_rect.right &= -(1U << chroma_shift_horiz);
+    d_rect.top &= -(1U << chroma_shift_vert);
+    d_rect.bottom &= -(1U << chroma_shift_vert);
+
+    if (d_rect.left == d_rect.right || d_rect.top == d_rect.bottom)
+	return;
+
+    unsigned s_left = s_rect.left;
+    unsigned s_width = s_rect.right - s_rect.left;
+    unsigned s_top = s_rect.top;
+    unsigned s_height = s_rect.bottom - s_rect.top;
+    unsigned d_left = d_rect.left;
+    unsigned d_width = d_rect.right - d_rect.left;
+    unsigned d_top = d_rect.top;
+    unsigned d_height = d_rect.bottom - d_rect.top;
+
+    struct weights {
+	uint16_t cur;
+	uint16_t spill;
+    };
+    weights col_weights[FRAME_WIDTH];
+    weights row_weights[FRAME_HEIGHT_MAX];
+    unsigned e, x, y;
+    uint32_t weight_scale = (((1ULL << 32) + s_width * s_height / 2)
+			     / (s_width * s_height));
+
+    e = 0;
+    for (x = 0; x != s_width; ++x)
+    {
+	e += d_width;
+	if (e >= s_width)
+	{
+	    e -= s_width;
+	    col_weights[x].cur = d_width - e;
+	    col_weights[x].spill = 1 + e;
+	}
+	else
+	{
+	    col_weights[x].cur = d_width;
+	    col_weights[x].spill = 0;
+	}
+    }
+
+    e = 0;
+    for (y = 0; y != s_height; ++y)
+    {
+	e += d_height;
+	if (e >= s_height)
+	{
+	    e -= s_height;
+	    row_weights[y].cur = d_height - e;
+	    row_weights[y].spill = 1 + e;
+	}
+	else
+	{
+	    row_weights[y].cur = d_height;
+	    row_weights[y].spill = 0;
+	}
+    }
+
+    for (unsigned plane = 0; plane != 3; ++plane)
+    {
+	if (plane == 1)
+	{
+	    d_left >>= chroma_shift_horiz;
+	    d_width >>= chroma_shift_horiz;
+	    s_left >>= chroma_shift_horiz;
+	    s_width >>= chroma_shift_horiz;
+	    d_top >>= chroma_shift_vert;
+	    d_height >>= chroma_shift_vert;
+	    s_top >>= chroma_shift_vert;
+	    s_height >>= chroma_shift_vert;
+	}
+	uint8_t * dest_p = (dest.planes.data[plane]
+			    + d_top * dest.planes.linesize[plane] + d_left);
+	const unsigned dest_gap = dest.planes.linesize[plane] - d_width;
+	uint32_t row_buffer[FRAME_WIDTH], * row_p;
+	std::memset(row_buffer, 0, d_width * sizeof(uint32_t));
+
+	for (y = 0; ; ++y)
+	{
+	    unsigned row_weight = row_weights[y].cur;
+	    unsigned row_spill = row_weights[y].spill;
+
+	    const uint8_t * source_p =
+		source.planes.data[plane]
+		+ source.planes.linesize[plane] * (s_top + y) + s_left;
+	    row_p = row_buffer;
+	    uint32_t value_sum = *row_p;
+	    for (x = 0; x != s_width; ++x)
+	    {
+		unsigned value_rw = *source_p++ * row_weight;
+		value_sum += value_rw * col_weights[x].cur;
+		if (col_weights[x].spill)
+		{
+		    *row_p++ = value_sum;
+		    value_sum = *row_p + value_rw * (col_weights[x].spill - 1);
+		}
+	    }
+
+	    if (!row_spill)
+		continue;
+
+	    row_p = row_buffer;
+	    for (x = 0; x != d_width; ++x)
+		*dest_p++ = (*row_p++ * (uint64_t)weight_scale
+			     + (1U << 31)) >> 32;
+
+	    if (y == s_height - 1)
+		break;
+
+	    dest_p += dest_gap;
+
+	    row_weight = row_spill - 1;
+	    if (!row_weight)
+	    {
+		std::memset(row_buffer, 0, d_width * sizeof(uint32_t));
+	    }
+	    else
+	    {
+		source_p -= s_width;
+		row_p = row_buffer;
+		uint32_t value_sum = 0;
+		for (x = 0; x != s_width; ++x)
+		{
+		    unsigned value_rw = *source_p++ * row_weight;
+		    value_sum += value_rw * col_weights[x].cur;
+		    if (col_weights[x].spill)
+		    {
+			*row_p++ = value_sum;
+			value_sum = value_rw * (col_weights[x].spill - 1);
+		    }
+		}
+	    }
+	}
+    }
+}
+
 void alloc_plane(raw_frame_ref & frame, int i, int width, int height)
 {
     size_t size = (width + 2 * pad) * (height + 2 * pad);
@@ -155,7 +317,6 @@ void test_pic_in_pic(raw_frame_ref dest, int d_width, int d_height,
 
 	    video_effect_pic_in_pic(dest, d_rect, source, s_rect);
 
-#ifndef TEST_SPEED
 	    // Check we overwrote the area we were supposed to
 	    assert_rect_colour(dest, d_rect, source_colour);
 
@@ -176,7 +337,6 @@ void test_pic_in_pic(raw_frame_ref dest, int d_width, int d_height,
 
 	    // Restore destination area
 	    fill_rect_colour(dest, d_rect, dest_colour);
-#endif
 	}
     }
 }
@@ -229,13 +389,13 @@ void test_format_size(PixelFormat pix_fmt, int d_width, int d_height)
     avcodec_get_chroma_sub_sample(pix_fmt,
 				  &chroma_shift_horiz, &chroma_shift_vert);
 
-    for (int i = 0; i != n_dims; ++i)
+    for (int i = 0; i != n_frame_dims; ++i)
     {
-	int s_width = dims[i];
+	int s_width = frame_dims[i];
 	if ((s_width & ((1 << chroma_shift_horiz) - 1)) == 0)
-	    for (int j = 0; j != n_dims; ++j)
+	    for (int j = 0; j != n_frame_dims; ++j)
 	    {
-		int s_height = dims[j];
+		int s_height = frame_dims[j];
 		if (s_height > FRAME_HEIGHT_MAX)
 		    break;
 		if (s_height & ((1 << chroma_shift_vert) - 1))
@@ -253,23 +413,231 @@ void test_format(PixelFormat pix_fmt)
     avcodec_get_chroma_sub_sample(pix_fmt,
 				  &chroma_shift_horiz, &chroma_shift_vert);
 
-    for (int i = 0; i != n_dims; ++i)
+    for (int i = 0; i != n_frame_dims; ++i)
     {
-	int width = dims[i];
+	int width = frame_dims[i];
 	if ((width & ((1 << chroma_shift_horiz) - 1)) == 0)
-	    for (int j = 0; j != n_dims; ++j)
+	    for (int j = 0; j != n_frame_dims; ++j)
 	    {
-		int height = dims[j];
+		int height = frame_dims[j];
 		if ((height & ((1 << chroma_shift_vert) - 1)) == 0)
 		    test_format_size(pix_fmt, width, height);
 	    }
     }
 }
 
+void fill_random(raw_frame_ref frame, int width, int height)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    avcodec_get_chroma_sub_sample(frame.pix_fmt,
+				  &chroma_shift_horiz, &chroma_shift_vert);
+
+    for (int i = 0; i != 3; ++i)
+    {
+	if (i == 1)
+	{
+	    width >>= chroma_shift_horiz;
+	    height >>= chroma_shift_vert;
+	}
+	for (int y = 0; y != height; ++y)
+	    for (int x = 0; x != width; ++x)
+		frame.planes.data[i][frame.planes.linesize[i] * y + x] =
+		    std::rand();
+    }
+}
+
+void copy_frame(raw_frame_ref dest, raw_frame_ref source,
+		int width, int height)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    avcodec_get_chroma_sub_sample(dest.pix_fmt,
+				  &chroma_shift_horiz, &chroma_shift_vert);
+
+    for (int i = 0; i != 3; ++i)
+    {
+	if (i == 1)
+	{
+	    width >>= chroma_shift_horiz;
+	    height >>= chroma_shift_vert;
+	}
+	for (int y = 0; y != height; ++y)
+	    std::memcpy(dest.planes.data[i] + dest.planes.linesize[i] * y,
+			source.planes.data[i] + source.planes.linesize[i] * y,
+			width);
+    }
+}
+
+bool frames_equal(raw_frame_ref left, raw_frame_ref right,
+		  int width, int height)
+{
+    int chroma_shift_horiz, chroma_shift_vert;
+    avcodec_get_chroma_sub_sample(left.pix_fmt,
+				  &chroma_shift_horiz, &chroma_shift_vert);
+
+    for (int i = 0; i != 3; ++i)
+    {
+	if (i == 1)
+	{
+	    width >>= chroma_shift_horiz;
+	    height >>= chroma_shift_vert;
+	}
+	for (int y = 0; y != height; ++y)
+	    if (std::memcmp(left.planes.data[i] + left.planes.linesize[i] * y,
+			    right.planes.data[i] + right.planes.linesize[i] * y,
+			    width))
+		return false;
+    }
+    return true;
+}
+
+// Sizes of source and destination rectangles for comparison with the
+// reference implementation, including whole-number ratios
+const int exact_sizes[][2] = {
+    { 720, 576 }, { 720, 480 }, { 704, 576 }, { 360, 288 }, { 360, 240 },
+    { 240, 192 }, { 240, 160 }, { 180, 144 }, { 236, 190 }, { 100, 100 },
+    { 16, 34 }, { 4, 2 }
+};
+const int n_exact_sizes = sizeof(exact_sizes) / sizeof(exact_sizes[0]);
+
+#ifndef TEST_SPEED
+
+void test_exact(PixelFormat pix_fmt)
+{
+    raw_frame_ref source = alloc_frame(pix_fmt, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    raw_frame_ref orig = alloc_frame(pix_fmt, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    raw_frame_ref expected = alloc_frame(pix_fmt,
+					 FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    raw_frame_ref found = alloc_frame(pix_fmt, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    fill_random(source, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    fill_random(orig, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+
+    for (int i = 0; i != n_exact_sizes; ++i)
+    {
+	rectangle s_rect = { 0, 0, exact_sizes[i][0], exact_sizes[i][1] };
+	for (int j = 0; j != n_exact_sizes; ++j)
+	{
+	    if (exact_sizes[j][0] > s_rect.right
+		|| exact_sizes[j][1] > s_rect.bottom)
+		continue;
+	    rectangle d_rect = { FRAME_WIDTH - exact_sizes[j][0],
+				 FRAME_HEIGHT_MAX - exact_sizes[j][1],
+				 FRAME_WIDTH, FRAME_HEIGHT_MAX };
+
+	    copy_frame(expected, orig, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+	    reference_pic_in_pic(expected, d_rect, source, s_rect);
+
+	    // Cached scalers may use box filtering, but single frames
+	    // always use the general filter, so check both
+	    video_effect_scaler * scaler =
+		video_effect_scaler_new(pix_fmt, d_rect, s_rect);
+	    assert(scaler);
+	    for (int isa = 0; isa != video_effect_isa_count; ++isa)
+	    {
+		if (!video_effect_isa_supported(video_effect_isa(isa)))
+		    continue;
+		video_effect_set_isa(video_effect_isa(isa));
+		for (int cached = 0; cached != 2; ++cached)
+		{
+		    copy_frame(found, orig, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+		    if (cached)
+			video_effect_pic_in_pic_scaled(scaler, found, source);
+		    else
+			video_effect_pic_in_pic(found, d_rect, source, s_rect);
+		    if (!frames_equal(expected, found,
+				      FRAME_WIDTH, FRAME_HEIGHT_MAX))
+		    {
+			std::cerr << video_effect_isa_name(video_effect_isa(isa))
+				  << (cached ? " cached" : "")
+				  << " picture-in-picture differs for "
+				  << s_rect.right << "x" << s_rect.bottom
+				  << " -> " << exact_sizes[j][0]
+				  << "x" << exact_sizes[j][1] << "\n";
+			assert(false);
+		    }
+		}
+	    }
+	    video_effect_scaler_free(scaler);
+	}
+    }
+
+    free_frame(found);
+    free_frame(expected);
+    free_frame(orig);
+    free_frame(source);
+}
+
 int main()
 {
     avcodec_init();
     avcodec_register_all();
     test_format(PIX_FMT_YUV420P);
     test_format(PIX_FMT_YUV411P);
+    test_exact(PIX_FMT_YUV420P);
+    test_exact(PIX_FMT_YUV411P);
+}
+
+#else // TEST_SPEED
+
+double get_time()
+{
+    timeval now;
+    gettimeofday(&now, 0);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// Compare the speed of the reference implementation and the cached
+// scaler for scaling a full frame to each destination size
+void test_speed(PixelFormat pix_fmt, const char * name)
+{
+    const int frame_count = 200;
+    raw_frame_ref source = alloc_frame(pix_fmt, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    raw_frame_ref dest = alloc_frame(pix_fmt, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    fill_random(source, FRAME_WIDTH, FRAME_HEIGHT_MAX);
+    rectangle s_rect = { 0, 0, FRAME_WIDTH, FRAME_HEIGHT_MAX };
+
+    for (int i = 1; i != n_exact_sizes; ++i)
+    {
+	rectangle d_rect = { 0, 0, exact_sizes[i][0], exact_sizes[i][1] };
+	if (d_rect.right < 100)
+	    continue;
+	std::cout << name << " " << FRAME_WIDTH << "x" << FRAME_HEIGHT_MAX
+		  << " -> " << d_rect.right << "x" << d_rect.bottom << ":";
+
+	double start = get_time();
+	for (int n = 0; n != frame_count; ++n)
+	    reference_pic_in_pic(dest, d_rect, source, s_rect);
+	double ref_rate = frame_count / (get_time() - start);
+	std::cout << " reference " << int(ref_rate) << " frames/s";
+
+	video_effect_scaler * scaler =
+	    video_effect_scaler_new(pix_fmt, d_rect, s_rect);
+	for (int isa = 0; isa != video_effect_isa_count; ++isa)
+	{
+	    if (!video_effect_isa_supported(video_effect_isa(isa)))
+		continue;
+	    video_effect_set_isa(video_effect_isa(isa));
+	    start = get_time();
+	    for (int n = 0; n != frame_count; ++n)
+		video_effect_pic_in_pic_scaled(scaler, dest, source);
+	    double rate = frame_count / (get_time() - start);
+	    std::cout << ", " << video_effect_isa_name(video_effect_isa(isa))
+		      << " " << int(rate) << " frames/s ("
+		      << rate / ref_rate << "x)";
+	}
+	video_effect_scaler_free(scaler);
+	std::cout << "\n";
+    }
+
+    free_frame(dest);
+    free_frame(source);
+}
+
+int main()
+{
+    avcodec_init();
+    avcodec_register_all();
+    test_speed(PIX_FMT_YUV420P, "4:2:0");
+    test_speed(PIX_FMT_YUV411P, "4:1:1");
 }
+
+#endif // TEST_SPEED
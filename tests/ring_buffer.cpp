@@ -2,8 +2,100 @@
 #error "This is a test program and requires assertions to be enabled."
 #endif
 
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
 #include "ring_buffer.hpp"
 
+namespace
+{
+    const unsigned spsc_count = 100000;
+
+    void spsc_write(spsc_ring_buffer<unsigned> * buf)
+    {
+	for (unsigned i = 0; i != spsc_count; )
+	{
+	    if (buf->full())
+		boost::this_thread::yield();
+	    else
+		buf->push(i++);
+	}
+    }
+
+    void test_spsc()
+    {
+	spsc_ring_buffer<int> buf(2);
+	assert(buf.size() == 0);
+	assert(buf.empty());
+	buf.push(1);
+	assert(buf.front() == 1);
+	assert(buf.size() == 1);
+	assert(!buf.empty() && !buf.full());
+	buf.push(2);
+	assert(buf.front() == 1);
+	assert(buf.size() == 2);
+	assert(!buf.empty() && buf.full());
+	buf.pop();
+	assert(buf.front() == 2);
+	assert(buf.size() == 1);
+	spsc_ring_buffer<int> buf2(buf);
+	assert(buf2.front() == 2);
+	assert(buf2.size() == 1);
+	buf.pop();
+	assert(buf.empty());
+	buf = buf2;
+	assert(buf.front() == 2);
+	assert(buf.size() == 1);
+
+	// Check that values come out in order when the reader and
+	// writer are running concurrently
+	spsc_ring_buffer<unsigned> buf3(4);
+	boost::thread writer(boost::bind(spsc_write, &buf3));
+	for (unsigned i = 0; i != spsc_count; )
+	{
+	    if (buf3.empty())
+	    {
+		boost::this_thread::yield();
+	    }
+	    else
+	    {
+		assert(buf3.front() == i);
+		buf3.pop();
+		++i;
+	    }
+	}
+	writer.join();
+	assert(buf3.empty());
+    }
+
+    // Check that the swapping functions hand over values rather than
+    // copying them
+    void test_swap()
+    {
+	std::vector<int> value(3, 1);
+	const int * data = &value[0];
+
+	ring_buffer<std::vector<int> > buf(2);
+	buf.push_swap(value);
+	assert(value.empty());
+	assert(buf.size() == 1);
+	assert(buf.front().size() == 3 && &buf.front()[0] == data);
+	std::vector<int> other(1, 2);
+	buf.pop_swap(other);
+	assert(buf.empty());
+	assert(other.size() == 3 && &other[0] == data);
+
+	spsc_ring_buffer<std::vector<int> > buf2(2);
+	buf2.push(other);
+	value.clear();
+	buf2.pop_swap(value);
+	assert(buf2.empty());
+	assert(value.size() == 3 && value[0] == 1);
+    }
+}
+
 int main()
 {
     ring_buffer<int> buf(2);
@@ -55,4 +147,7 @@ int main()
     assert(buf3.back() == 2);
     assert(buf3.size() == 1);
     assert(!buf3.empty() && !buf3.full());
+
+    test_spsc();
+    test_swap();
 }